@@ -0,0 +1,269 @@
+// the firmware's control modules (heater, fans and their tachometers, the
+// spool's hall sensor, and the factory reset button) built for Linux atop
+// host/hal_linux.c, and run as the device's control and sensor tasks would
+// run them, against the chamber of plant.h. a dry is held at the setpoint
+// throughout, the fans' tachs pulse at speeds following their PWM, the
+// spool turns at a slow and fractional speed (its hall sensor bouncing
+// once), an eccentric spool loads the load cell filters, and the factory
+// reset button is held for a while halfway through. we report the cost of
+// each control iteration, and fail if what the firmware made of its inputs
+// doesn't match the simulation. useful under perf, valgrind, and the sanitizers.
+#include "dankdryer.h"
+#include "hal_linux.h"
+#include "lcfilter.h"
+#include "plant.h"
+#include "heater.h"
+#include "reset.h"
+#include "fans.h"
+#include "tach.h"
+#include "pins.h"
+#include "dry.h"
+#include <math.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <esp_log.h>
+
+#define DT_US 10000ll         // simulation step
+#define CONTROL_US 1000000ll  // control task period
+#define SENSOR_US 1000000ll   // sensor task period
+#define AMBIENT 25.0
+
+#define FAN_MAX_RPM 2500.0    // noctua NF-A8 at full PWM
+#define FAN_PPR 2
+#define SPOOL_RPM 5.9         // whole RPM would be off by 15%
+#define RESET_HOLD_US 6000000ll
+
+#define LC_US 50000ll         // load cell conversions, at 20sps
+#define LC_MEDIAN 5           // the firmware's default filters
+#define LC_EMA 3
+#define LC_RAW 1000000        // the loaded spool's true reading
+#define LC_ECCENTRIC 20000    // ripple from an off-center spool, +-raw
+#define LC_SPIKE 400000       // impulsive noise...
+#define LC_SPIKE_EVERY 37     // ...on every this many conversions
+
+typedef struct lcstats {
+  unsigned long samples;
+  unsigned revs, gapped, skipped;
+  int32_t mean;               // of the most recent revolution
+  int32_t emamin, emamax;     // once the EMA has settled
+} lcstats;
+
+// the firmware only ever runs on PCB 2.2.0+ in simulation
+bool electronics_use_lm35(void){
+  return false;
+}
+
+static double
+fan_rpm(gpio_num_t pwmpin){
+  return FAN_MAX_RPM * hal_linux_pwm(pwmpin) / 255;
+}
+
+// deliver whatever whole edges have accumulated over the step, returning
+// how many there were
+static unsigned
+spin(double* edges, double rpm, unsigned ppr, gpio_num_t pin){
+  *edges += rpm * ppr / 60 * (DT_US / 1e6);
+  unsigned whole = *edges;
+  if(whole){
+    hal_linux_pulses(pin, whole);
+    *edges -= whole;
+  }
+  return whole;
+}
+
+// one conversion through the filters, as loadcell.c's acquisition task
+// would run it, with the spool revs revolutions around
+static void
+weigh(lcfilter* f, const tach* hall, double revs, int64_t now, lcstats* s){
+  int32_t raw = LC_RAW + lrint(LC_ECCENTRIC * sin(2 * M_PI * revs));
+  if(++s->samples % LC_SPIKE_EVERY == 0){
+    raw += LC_SPIKE;
+  }
+  const int32_t med = lcfilter_push(f, raw);
+  int64_t last = 0, prev = 0;
+  uint32_t h = tach_last_edges(hall, &last, &prev);
+  if(tach_rpm(hall, now) == 0){
+    h = 0;
+  }
+  int32_t mean;
+  switch(lcfilter_phase(f, med, h, last, prev, hall->ppr, now, &mean)){
+    case LCPHASE_REVOLUTION: ++s->revs; s->mean = mean; break;
+    case LCPHASE_GAPPED: ++s->gapped; break;
+    case LCPHASE_SKIPPED: ++s->skipped; break;
+    default: break;
+  }
+  const int32_t ema = lcfilter_ema(f);
+  if(s->samples == 100){
+    s->emamin = s->emamax = ema;
+  }else if(s->samples > 100){
+    s->emamin = ema < s->emamin ? ema : s->emamin;
+    s->emamax = ema > s->emamax ? ema : s->emamax;
+  }
+}
+
+static double
+wallclock(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool
+rpm_ok(const char* name, uint32_t rpm, gpio_num_t pwmpin){
+  const double want = fan_rpm(pwmpin);
+  printf("%s fan: %" PRIu32 " rpm (simulated %.0f)\n", name, rpm, want);
+  return fabs(rpm - want) <= want * 0.02 + 1;
+}
+
+static bool
+spool_ok(uint32_t mrpm){
+  printf("spool: %.3f rpm (simulated %.3f)\n", mrpm / 1000.0, SPOOL_RPM);
+  return fabs(mrpm / 1000.0 - SPOOL_RPM) <= SPOOL_RPM * 0.01;
+}
+
+// the revolution averages ought cancel the eccentricity which the EMA
+// passes, and survive the bounce, which costs a revolution or two. until
+// the next true edge, the bounce leaves no pulse period to place samples
+// by, so they're skipped.
+static bool
+loadcell_ok(const lcstats* s, unsigned seconds){
+  const unsigned expected = seconds * SPOOL_RPM / 60;
+  const unsigned pulseconv = 60e6 / (SPOOL_RPM * HALL_PPR) / LC_US + 1;
+  printf("load cell: %u revolutions (%u discarded, %u samples skipped), "
+         "last mean %" PRId32 " ema %" PRId32 "..%" PRId32 " (simulated %d +-%d)\n",
+         s->revs, s->gapped, s->skipped, s->mean, s->emamin, s->emamax,
+         LC_RAW, LC_ECCENTRIC);
+  return s->revs + 3 >= expected && s->gapped <= 2
+         && s->skipped && s->skipped <= pulseconv
+         && abs(s->mean - LC_RAW) <= LC_ECCENTRIC / 200
+         && s->emamax - s->emamin >= LC_ECCENTRIC;
+}
+
+static void
+usage(const char* argv0){
+  fprintf(stderr, "usage: %s [ -s seconds ] [ -t temp ] [ -v ]\n", argv0);
+  fprintf(stderr, " -s: simulated seconds, at least 3600 (default 28800)\n");
+  fprintf(stderr, " -t: dry setpoint (default 65)\n");
+  fprintf(stderr, " -v: log at info level\n");
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char** argv){
+  unsigned seconds = 8 * 3600;
+  unsigned temp = 65;
+  bool verbose = false;
+  int c;
+  while((c = getopt(argc, argv, "s:t:v")) != -1){
+    switch(c){
+      case 's': seconds = strtoul(optarg, NULL, 10); break;
+      case 't': temp = strtoul(optarg, NULL, 10); break;
+      case 'v': verbose = true; break;
+      default: usage(argv[0]);
+    }
+  }
+  if(optind != argc || seconds < 3600){
+    usage(argv[0]);
+  }
+  if(!verbose){
+    esp_log_level_set("*", ESP_LOG_WARN);
+  }
+  nvs_handle_t nvsh;
+  if(nvs_open(NVS_HANDLE_NAME, NVS_READONLY, &nvsh) != ESP_OK){
+    return EXIT_FAILURE;
+  }
+  read_heater_pstore(nvsh);
+  read_fans_pstore(nvsh);
+  nvs_close(nvsh);
+  // as in app_main()
+  static tach hall;
+  if(setup_fans(LOWER_PWMPIN, UPPER_PWMPIN, LOWER_TACHPIN, UPPER_TACHPIN)
+      || setup_tach(&hall, HALL_DATAPIN, 1, HALL_PPR, HALL_STALL_USEC)
+      || setup_factory_reset(FRESET_PIN)
+      || hal_gpio_output(SSR_GPIN)
+      || setup_temp(THERM_DATAPIN)){
+    fprintf(stderr, "error setting up peripherals\n");
+    return EXIT_FAILURE;
+  }
+  set_upper_pwm(255);
+  drysched dry = { 0, 0 };
+  hal_linux_advance(CONTROL_US);
+  if(dry_schedule(&dry, seconds, temp, hal_now_us())){
+    fprintf(stderr, "invalid dry temperature %u\n", temp);
+    return EXIT_FAILURE;
+  }
+  plant p;
+  plant_init(&p, AMBIENT);
+  double ledges = 0, uedges = 0, sedges = 0; // fractional, yet to be delivered
+  double spoolrevs = 0;
+  lcfilter lcf;
+  lcfilter_init(&lcf, LC_MEDIAN, LC_EMA);
+  lcstats lcs = { 0 };
+  const int64_t endus = hal_now_us() + seconds * 1000000ll;
+  const int64_t pressus = hal_now_us() + seconds * 500000ll;
+  const int64_t bounceus = hal_now_us() + seconds * 250000ll;
+  bool early = false, reset = false, bounced = false;
+  unsigned long iters = 0;
+  uint32_t lrpm = 0, urpm = 0, smrpm = 0;
+  double ctlsecs = 0;
+  const double start = wallclock();
+  for(int64_t now = hal_now_us() ; now < endus ; now = hal_now_us()){
+    if(now == pressus){
+      hal_linux_gpio_drive(FRESET_PIN, false);
+    }else if(now == pressus + RESET_HOLD_US){
+      hal_linux_gpio_drive(FRESET_PIN, true);
+    }
+    if(now % CONTROL_US == 0){
+      hal_linux_therm(lrint(lmt87_mv(p.sensor)));
+      const double t0 = wallclock();
+      manage_heater(SSR_GPIN, dry_active_p(&dry), dry.targtemp);
+      if(check_factory_reset(now)){
+        if(now - pressus < 5000000ll){
+          early = true;
+        }
+        reset = true;
+      }
+      ctlsecs += wallclock() - t0;
+      ++iters;
+    }
+    if(now % SENSOR_US == 0){
+      lrpm = get_lower_tach_rpm(now);
+      urpm = get_upper_tach_rpm(now);
+      smrpm = tach_mrpm(&hall, now);
+    }
+    if(now % LC_US == 0){
+      weigh(&lcf, &hall, spoolrevs, now, &lcs);
+    }
+    plant_step(&p, hal_linux_gpio_output(SSR_GPIN), DT_US / 1e6);
+    spin(&ledges, fan_rpm(LOWER_PWMPIN), FAN_PPR, LOWER_TACHPIN);
+    spin(&uedges, fan_rpm(UPPER_PWMPIN), FAN_PPR, UPPER_TACHPIN);
+    spoolrevs += SPOOL_RPM / 60 * (DT_US / 1e6);
+    if(spin(&sedges, SPOOL_RPM, HALL_PPR, HALL_DATAPIN) && !bounced && now >= bounceus){
+      // contact bounce: a second edge at the same instant
+      hal_linux_pulses(HALL_DATAPIN, 1);
+      bounced = true;
+    }
+    hal_linux_advance(DT_US);
+  }
+  const double elapsed = wallclock() - start;
+  printf("%lu control iterations over %us simulated in %.3fs\n", iters, seconds, elapsed);
+  printf("control iteration: %.0fns\n", ctlsecs / iters * 1e9);
+  printf("chamber: %.2fC (setpoint %uC) heater duty: %" PRIu32 "/1000\n",
+         p.chamber, temp, get_heater_duty());
+  bool ok = true;
+  ok &= rpm_ok("lower", lrpm, LOWER_PWMPIN);
+  ok &= rpm_ok("upper", urpm, UPPER_PWMPIN);
+  ok &= spool_ok(smrpm);
+  ok &= loadcell_ok(&lcs, seconds);
+  if(fabs(p.chamber - temp) > 3){
+    fprintf(stderr, "chamber not held at setpoint\n");
+    ok = false;
+  }
+  if(!reset || early){
+    fprintf(stderr, "factory reset %s\n", early ? "fired early" : "not seen");
+    ok = false;
+  }
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,95 @@
+// host benchmark comparing the float sample path we used to run with the
+// Q8 fixed-point path now in the firmware. each "sample" is one load cell
+// scaling+tare, one thermometer conversion, and one heater threshold
+// comparison. the Q8 path is the firmware's own (weight_from_raw(), and
+// thermo_mv_to_q8() on the LMT87 table); the float path is kept as it was,
+// linear thermometer conversion and all. this measures only the host's
+// cost: with an FPU, floats are cheap, and the table's binary search makes
+// the Q8 path the slower one. it says nothing of the esp32-c6, which has
+// no FPU, and makes a libgcc call for every float operation.
+#include "weight.h"
+#include "thermo.h"
+#include <time.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define ITERATIONS 10000000u
+
+// thermo.c wants to know the board. we use the LMT87 table directly.
+bool electronics_use_lm35(void){
+  return false;
+}
+
+static inline uint64_t
+nsecs(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// pseudorandom inputs, so the compiler can't fold anything
+static uint32_t Seed = 0x2545f491u;
+
+static inline uint32_t
+xorshift(void){
+  Seed ^= Seed << 13;
+  Seed ^= Seed >> 17;
+  Seed ^= Seed << 5;
+  return Seed;
+}
+
+// the path as it was: float scaling, float tare, float temp conversion
+static unsigned
+float_sample(int32_t v, int raw, uint32_t targtemp, float tare){
+  float sv = v * ((float)LOAD_CELL_MAX / (1u << 22u));
+  if(tare >= 0 && tare <= LOAD_CELL_MAX){
+    sv -= tare;
+  }
+  float o = raw * 1750.0 / 4095;
+  float utemp = o / 10.0;
+  return (sv >= 0 && sv <= LOAD_CELL_MAX) + (utemp >= targtemp);
+}
+
+// the path as it is. the thermometer now arrives in mV.
+static unsigned
+fixed_sample(int32_t v, int mv, uint32_t targtemp, q8_t tare){
+  const q8_t sv = weight_from_raw(v, tare);
+  const q8_t utemp = thermo_mv_to_q8(&LMT87Table, mv);
+  return weight_valid_p(sv) + (utemp >= q8_from_int(targtemp));
+}
+
+typedef unsigned (*floatfxn)(int32_t, int, uint32_t, float);
+typedef unsigned (*fixedfxn)(int32_t, int, uint32_t, q8_t);
+
+// call through volatile function pointers, so that neither path is
+// vectorized or hoisted out of the loop.
+static volatile floatfxn FloatPath = float_sample;
+static volatile fixedfxn FixedPath = fixed_sample;
+
+static void
+report(const char* name, uint64_t ns, unsigned sink){
+  printf("%-6s %8.2f ns/sample (sink %u)\n", name, (double)ns / ITERATIONS, sink);
+}
+
+int main(void){
+  unsigned sink = 0;
+  floatfxn ff = FloatPath;
+  fixedfxn xf = FixedPath;
+  uint64_t t0 = nsecs();
+  for(unsigned i = 0 ; i < ITERATIONS ; ++i){
+    uint32_t r = xorshift();
+    sink += ff(r & 0x3fffff, r >> 20, 150, 12345.0f);
+  }
+  uint64_t t1 = nsecs();
+  report("float", t1 - t0, sink);
+  sink = 0;
+  t0 = nsecs();
+  for(unsigned i = 0 ; i < ITERATIONS ; ++i){
+    uint32_t r = xorshift();
+    sink += xf(r & 0x3fffff, r >> 20, 150, q8_from_int(12345));
+  }
+  t1 = nsecs();
+  report("q8", t1 - t0, sink);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,301 @@
+// the HAL (see main/hal.h) atop simulated peripherals, so that the control
+// modules can run as a Linux process. also provides the in-memory NVS and
+// the logging support behind host/include.
+#include "hal_linux.h"
+#include <nvs.h>
+#include <stdio.h>
+#include <string.h>
+#include <esp_log.h>
+
+#define TAG "hal"
+
+#define PWM_CHANNELS 8
+#define PULSE_COUNTERS 4 // as many PCNT units as the esp32-c6
+#define NVS_RECORDS 32
+#define NVS_KEY_MAX 16   // as in ESP-IDF, including the NUL
+
+typedef struct simpin {
+  bool configured;
+  bool output;
+  bool level;
+  hal_isr_fn edgefn;
+  void* edgearg;
+} simpin;
+
+typedef struct pulse_counter {
+  gpio_num_t pin;
+  unsigned pulses;
+  unsigned count;
+  hal_isr_fn fn;
+  void* arg;
+} pulse_counter;
+
+typedef struct nvsrec {
+  char key[NVS_KEY_MAX];
+  uint32_t val;
+} nvsrec;
+
+static int64_t Now;
+static simpin Pins[GPIO_NUM_MAX];
+static gpio_num_t PWMPins[PWM_CHANNELS];
+static unsigned PWMDuty[PWM_CHANNELS];
+static bool PWMConfigured[PWM_CHANNELS];
+static pulse_counter Counters[PULSE_COUNTERS];
+static unsigned CounterCount;
+static int32_t ThermMV;
+static int64_t ThermStampUs;
+static bool ThermStarted, ThermValid;
+static nvsrec NVS[NVS_RECORDS];
+static unsigned NVSCount;
+
+int64_t hal_now_us(void){
+  return Now;
+}
+
+esp_log_level_t esp_log_host_level = ESP_LOG_INFO;
+
+void esp_log_level_set(const char* tag, esp_log_level_t level){
+  (void)tag;
+  esp_log_host_level = level;
+}
+
+uint32_t esp_log_timestamp(void){
+  return Now / 1000;
+}
+
+const char* esp_err_to_name(esp_err_t e){
+  switch(e){
+    case ESP_OK: return "ESP_OK";
+    case ESP_FAIL: return "ESP_FAIL";
+    case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_NVS_NOT_FOUND: return "ESP_ERR_NVS_NOT_FOUND";
+    case ESP_ERR_NVS_NOT_ENOUGH_SPACE: return "ESP_ERR_NVS_NOT_ENOUGH_SPACE";
+  }
+  return "ERROR";
+}
+
+void hal_linux_advance(int64_t us){
+  Now += us;
+}
+
+static simpin*
+get_pin(gpio_num_t pin){
+  if(pin < 0 || pin >= GPIO_NUM_MAX){
+    ESP_LOGE(TAG, "invalid pin %d", pin);
+    return NULL;
+  }
+  return &Pins[pin];
+}
+
+static int
+setup_pin(gpio_num_t pin, bool output, bool level){
+  simpin* p = get_pin(pin);
+  if(p == NULL){
+    return -1;
+  }
+  p->configured = true;
+  p->output = output;
+  p->level = level;
+  return 0;
+}
+
+int hal_gpio_output(gpio_num_t pin){
+  return setup_pin(pin, true, false);
+}
+
+// an undriven input rests at its pull
+int hal_gpio_input(gpio_num_t pin, bool pullup, bool pulldown){
+  (void)pulldown;
+  return setup_pin(pin, false, pullup);
+}
+
+int hal_gpio_opendrain(gpio_num_t pin){
+  return setup_pin(pin, true, true);
+}
+
+int hal_gpio_level(gpio_num_t pin, bool level){
+  simpin* p = get_pin(pin);
+  if(p == NULL){
+    return -1;
+  }
+  if(!p->configured || !p->output){
+    ESP_LOGE(TAG, "pin %d is not an output", pin);
+    return -1;
+  }
+  p->level = level;
+  return 0;
+}
+
+int hal_gpio_get(gpio_num_t pin){
+  simpin* p = get_pin(pin);
+  return p ? p->level : 0;
+}
+
+int hal_gpio_on_edge(gpio_num_t pin, hal_isr_fn fn, void* arg){
+  simpin* p = get_pin(pin);
+  if(p == NULL){
+    return -1;
+  }
+  p->edgefn = fn;
+  p->edgearg = arg;
+  return 0;
+}
+
+void hal_linux_gpio_drive(gpio_num_t pin, bool level){
+  simpin* p = get_pin(pin);
+  if(p == NULL || p->level == level){
+    return;
+  }
+  p->level = level;
+  if(p->edgefn){
+    p->edgefn(p->edgearg);
+  }
+}
+
+bool hal_linux_gpio_output(gpio_num_t pin){
+  simpin* p = get_pin(pin);
+  return p && p->output && p->level;
+}
+
+int hal_pwm_setup(unsigned channel, gpio_num_t pin, unsigned freq){
+  if(channel >= PWM_CHANNELS || hal_gpio_output(pin)){
+    ESP_LOGE(TAG, "error setting up pwm channel %u on %d", channel, pin);
+    return -1;
+  }
+  PWMPins[channel] = pin;
+  PWMConfigured[channel] = true;
+  printf("setting up pin %d for %uHz PWM\n", pin, freq);
+  return 0;
+}
+
+int hal_pwm_set(unsigned channel, unsigned duty){
+  if(channel >= PWM_CHANNELS || !PWMConfigured[channel] || duty > 255){
+    ESP_LOGE(TAG, "error setting pwm!");
+    return -1;
+  }
+  PWMDuty[channel] = duty;
+  return 0;
+}
+
+unsigned hal_linux_pwm(gpio_num_t pin){
+  for(unsigned c = 0 ; c < PWM_CHANNELS ; ++c){
+    if(PWMConfigured[c] && PWMPins[c] == pin){
+      return PWMDuty[c];
+    }
+  }
+  return 0;
+}
+
+int hal_pulse_counter(gpio_num_t pin, unsigned pulses, hal_isr_fn fn, void* arg){
+  if(CounterCount == PULSE_COUNTERS || pulses == 0){
+    ESP_LOGE(TAG, "no pulse counter available for %d", pin);
+    return -1;
+  }
+  if(hal_gpio_input(pin, false, true)){
+    return -1;
+  }
+  pulse_counter* pc = &Counters[CounterCount++];
+  pc->pin = pin;
+  pc->pulses = pulses;
+  pc->count = 0;
+  pc->fn = fn;
+  pc->arg = arg;
+  return 0;
+}
+
+void hal_linux_pulses(gpio_num_t pin, unsigned edges){
+  for(unsigned i = 0 ; i < CounterCount ; ++i){
+    pulse_counter* pc = &Counters[i];
+    if(pc->pin != pin){
+      continue;
+    }
+    while(edges--){
+      if(++pc->count == pc->pulses){
+        pc->count = 0;
+        pc->fn(pc->arg);
+      }
+    }
+    return;
+  }
+}
+
+int hal_therm_start(gpio_num_t pin){
+  if(hal_gpio_input(pin, false, false)){
+    return -1;
+  }
+  ThermStarted = true;
+  return 0;
+}
+
+int hal_therm_read(int32_t* mv, int64_t* stampus){
+  if(!ThermValid){
+    return -1;
+  }
+  *mv = ThermMV;
+  *stampus = ThermStampUs;
+  return 0;
+}
+
+void hal_linux_therm(int32_t mv){
+  if(ThermStarted){
+    ThermMV = mv;
+    ThermStampUs = Now;
+    ThermValid = true;
+  }
+}
+
+// a single namespace suffices for the firmware
+esp_err_t nvs_open(const char* namespace_name, nvs_open_mode_t open_mode,
+                   nvs_handle_t* out_handle){
+  (void)namespace_name;
+  (void)open_mode;
+  *out_handle = 1;
+  return ESP_OK;
+}
+
+static nvsrec*
+nvs_find(const char* key){
+  for(unsigned i = 0 ; i < NVSCount ; ++i){
+    if(strcmp(NVS[i].key, key) == 0){
+      return &NVS[i];
+    }
+  }
+  return NULL;
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char* key, uint32_t* out_value){
+  (void)handle;
+  const nvsrec* r = nvs_find(key);
+  if(r == NULL){
+    return ESP_ERR_NVS_NOT_FOUND;
+  }
+  *out_value = r->val;
+  return ESP_OK;
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char* key, uint32_t value){
+  (void)handle;
+  if(strlen(key) >= NVS_KEY_MAX){
+    return ESP_ERR_INVALID_ARG;
+  }
+  nvsrec* r = nvs_find(key);
+  if(r == NULL){
+    if(NVSCount == NVS_RECORDS){
+      return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    }
+    r = &NVS[NVSCount++];
+    strcpy(r->key, key);
+  }
+  r->val = value;
+  return ESP_OK;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle){
+  (void)handle;
+  return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle){
+  (void)handle;
+}
@@ -0,0 +1,33 @@
+#ifndef DANKDRYER_HAL_LINUX
+#define DANKDRYER_HAL_LINUX
+
+// the simulated peripherals behind hal_linux.c, as driven by a host
+// program standing in for the hardware. there's a single virtual clock,
+// which only moves when the host program advances it; the "interrupt"
+// callbacks run synchronously within these calls. none of this is
+// thread-safe, and it ought all be called from one thread.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "hal.h"
+
+// move the virtual clock forward
+void hal_linux_advance(int64_t us);
+
+// drive an input pin, firing its edge callback if the level changes
+void hal_linux_gpio_drive(gpio_num_t pin, bool level);
+
+// the level last set on an output pin
+bool hal_linux_gpio_output(gpio_num_t pin);
+
+// the duty (0..255) last set on the PWM channel attached to pin
+unsigned hal_linux_pwm(gpio_num_t pin);
+
+// deliver falling edges to the pulse counter on pin, all at the current
+// virtual time
+void hal_linux_pulses(gpio_num_t pin, unsigned edges);
+
+// publish a decimated thermometer reading, stamped with the current time
+void hal_linux_therm(int32_t mv);
+
+#endif
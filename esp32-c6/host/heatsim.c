@@ -0,0 +1,139 @@
+// host-side thermal simulation of the hot chamber, comparing the old
+// bang-bang heater control with the firmware's PID + time-proportional
+// SSR output (heatctl, as linked into the firmware), against the chamber
+// of plant.h. we report time to reach the setpoint, overshoot, settling
+// time (last excursion beyond +-1C), and energy, for each controller at a
+// few setpoints. with -a, we first run the relay autotuner against the
+// plant, and simulate with its gains.
+#include "heatctl.h"
+#include "plant.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DT 0.1            // integration step, s
+#define CONTROL_MS 1000   // control period
+#define SIM_SECONDS (4 * 3600)
+#define AMBIENT 25.0
+
+typedef struct results {
+  double reached;  // first time chamber >= setpoint, s (-1 if never)
+  double peak;     // max chamber temp after reaching setpoint
+  double settled;  // last time chamber was outside +-1C, s
+  double wh;
+  unsigned switches;
+} results;
+
+static results
+simulate(bool usepid, unsigned setpoint, int32_t kp, int32_t ki, int32_t kd,
+         q8_t izone){
+  plant p;
+  plant_init(&p, AMBIENT);
+  results r = { -1, 0, 0, 0, 0 };
+  heatctl ctl;
+  heatctl_init(&ctl);
+  pid_init(&ctl.pid, kp, ki, kd, DUTY_MAX, izone);
+  const q8_t qsp = q8_from_int(setpoint);
+  const unsigned steps = SIM_SECONDS / DT;
+  const unsigned ctlsteps = CONTROL_MS / 1000.0 / DT;
+  bool on = false;
+  for(unsigned s = 0 ; s < steps ; ++s){
+    const double t = s * DT;
+    if(s % ctlsteps == 0){
+      // quantize like the firmware's Q8 conversion
+      q8_t meas = q8_from_float(p.sensor);
+      bool was = on;
+      if(usepid){
+        // as on the device, the clock is never 0
+        on = heatctl_step(&ctl, meas, true, setpoint, t * 1000 + CONTROL_MS);
+      }else{
+        on = meas < qsp;
+      }
+      r.switches += was != on;
+    }
+    plant_step(&p, on, DT);
+    if(r.reached < 0){
+      if(p.chamber >= setpoint){
+        r.reached = t;
+      }
+    }else if(p.chamber > r.peak){
+      r.peak = p.chamber;
+    }
+    if(p.chamber > setpoint + 1 || p.chamber < setpoint - 1){
+      r.settled = t;
+    }
+  }
+  r.wh = p.joules / 3600;
+  return r;
+}
+
+static void
+report(const char* name, unsigned sp, const results* r){
+  printf("%-9s %4uC reached %6.0fs overshoot %5.2fC settled %6.0fs %7.1fWh %6u switches\n",
+         name, sp, r->reached, r->reached < 0 ? 0 : r->peak - sp,
+         r->settled, r->wh, r->switches);
+}
+
+// run the relay autotuner against a cold plant, as the firmware would
+static int
+run_autotune(unsigned setpoint, int32_t* kp, int32_t* ki, int32_t* kd){
+  plant p;
+  plant_init(&p, AMBIENT);
+  autotune at;
+  const unsigned ctlsteps = CONTROL_MS / 1000.0 / DT;
+  bool on = false;
+  autotune_start(&at, q8_from_int(setpoint), q8_from_float(p.sensor), 0);
+  for(unsigned s = 0 ; autotune_active_p(&at) ; ++s){
+    if(s % ctlsteps == 0){
+      on = autotune_update(&at, q8_from_float(p.sensor), s * DT * 1000);
+    }
+    plant_step(&p, on, DT);
+  }
+  printf("autotune %uC: %s after %.0fs\n", setpoint,
+         autotune_state_str(at.state), at.lastms / 1000.0);
+  if(at.state != AUTOTUNE_DONE){
+    return -1;
+  }
+  printf(" Ku %.2f Tu %.0fs K %.4f C/permille L %.1fs T %.0fs\n",
+         at.ku, at.tu, at.k, at.l, at.t);
+  *kp = at.kp;
+  *ki = at.ki;
+  *kd = 0;
+  return 0;
+}
+
+static void
+usage(const char* argv0){
+  fprintf(stderr, "usage: %s [ -a | kp ki kd [ izone ] ] (floating-point gains)\n", argv0);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char** argv){
+  int32_t kp = PID_KP_DEFAULT, ki = PID_KI_DEFAULT, kd = PID_KD_DEFAULT;
+  q8_t izone = PID_IZONE_DEFAULT;
+  if(argc == 2 && strcmp(argv[1], "-a") == 0){
+    if(run_autotune(65, &kp, &ki, &kd)){
+      return EXIT_FAILURE;
+    }
+  }else if(argc == 4 || argc == 5){
+    kp = q8_from_float(strtof(argv[1], NULL));
+    ki = q8_from_float(strtof(argv[2], NULL));
+    kd = q8_from_float(strtof(argv[3], NULL));
+    if(argc == 5){
+      izone = q8_from_float(strtof(argv[4], NULL));
+    }
+  }else if(argc != 1){
+    usage(argv[0]);
+  }
+  printf("kp %.3f ki %.3f kd %.3f (permille duty per C, C*s, C/s) izone %.1fC\n",
+         q8_to_float(kp), q8_to_float(ki), q8_to_float(kd), q8_to_float(izone));
+  const unsigned setpoints[] = { 50, 65, 80 };
+  for(unsigned i = 0 ; i < sizeof(setpoints) / sizeof(*setpoints) ; ++i){
+    results r = simulate(false, setpoints[i], kp, ki, kd, izone);
+    report("bang-bang", setpoints[i], &r);
+    r = simulate(true, setpoints[i], kp, ki, kd, izone);
+    report("pid", setpoints[i], &r);
+  }
+  return EXIT_SUCCESS;
+}
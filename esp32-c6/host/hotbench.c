@@ -0,0 +1,1279 @@
+// host micro-benchmarks of the firmware paths which run every second, or
+// on every control message, built from the same sources as the firmware:
+//
+//  * MQTT topic dispatch and payload parsing,
+//  * load cell scaling,
+//  * batching samples, and deciding whether to publish,
+//  * rendering telemetry as JSON, as CBOR, and as the HTTP status page,
+//  * handing telemetry to the publisher through its queue,
+//  * publishing and reading the live state snapshot,
+//  * rendering that snapshot for the JSON API and the event stream, and
+//  * folding it into the history.
+//
+// for comparison, the cJSON construction we used to publish is retained
+// here as TelemetryCJSON. before benchmarking, we check that:
+//
+//  * TelemetryCJSON and telemetry_json() emit the same keys, in the same
+//    order,
+//  * telemetry_cbor() decodes to the same members and values as
+//    telemetry_json(),
+//  * telemetry_sse() frames exactly telemetry_json(),
+//  * telemetry_rebase() dates early records as they'd have been dated,
+//  * telemetry_compare() and telemetry_rate_of() classify a few states as
+//    they ought,
+//  * the history rolls up a minute correctly,
+//  * the publication queue evicts its oldest when full, and neither loses
+//    nor reorders anything with several threads contending,
+//  * readers of the live state never see a torn snapshot while it's being
+//    published, and
+//  * the thermometer tables agree with their datasheets.
+//
+// results are printed in the Go benchmark format (one "Benchmark" line per
+// benchmark, with ns/op, B/op, and allocs/op), so they can be compared
+// across commits with benchstat. the Makefile links us with --wrap for the
+// allocator entry points, so every allocation made by the firmware sources
+// and cJSON is counted. run on a host, absolute times understate the
+// esp32-c6 considerably (especially anything touching floats), but
+// regressions show up all the same.
+#include "ctlmsg.h"
+#include "weight.h"
+#include "heater.h"
+#include "telemetry.h"
+#include "pubq.h"
+#include "state.h"
+#include "history.h"
+#include "thermo.h"
+#include "plant.h"
+#include <math.h>
+#include <sched.h>
+#include <pthread.h>
+#include <time.h>
+#include <cJSON.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define HTML_BYTES 1024 // as allocated by the HTTP handler
+
+static uint64_t Allocs, AllocBytes;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t nmemb, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+void __real_free(void* ptr);
+
+void* __wrap_malloc(size_t size){
+  ++Allocs;
+  AllocBytes += size;
+  return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t nmemb, size_t size){
+  ++Allocs;
+  AllocBytes += nmemb * size;
+  return __real_calloc(nmemb, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size){
+  ++Allocs;
+  AllocBytes += size;
+  return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void* ptr){
+  __real_free(ptr);
+}
+
+// results feed this, so the compiler can't discard any work
+static volatile uint64_t Sink;
+
+static uint32_t Seed = 0x2545f491u;
+
+static inline uint32_t
+xorshift(void){
+  Seed ^= Seed << 13;
+  Seed ^= Seed >> 17;
+  Seed ^= Seed << 5;
+  return Seed;
+}
+
+// a payload or topic without a NUL terminator, as MQTT hands them to us
+typedef struct msg {
+  const char* s;
+  size_t len;
+} msg;
+
+#define MSG(str) { str, sizeof(str) - 1 }
+#define MSGCOUNT(a) (sizeof(a) / sizeof(*(a)))
+
+static const msg DryReqs[] = {
+  MSG("65/28800"), MSG(" 80/3600 "), MSG("0/0"), MSG("50/86400"),
+};
+
+static const msg Bools[] = {
+  MSG("on"), MSG("OFF"), MSG("true"), MSG("0"),
+};
+
+static const msg PWMs[] = {
+  MSG("80"), MSG("fF"), MSG("00"), MSG("C0"),
+};
+
+// every channel, and one which is not ours
+static const msg Topics[] = {
+  MSG(DRY_CHANNEL), MSG(AUTOTUNE_CHANNEL), MSG(MOTOR_CHANNEL),
+  MSG(HEATER_CHANNEL), MSG(LPWM_CHANNEL), MSG(UPWM_CHANNEL),
+  MSG(TARE_CHANNEL), MSG(OTA_CHANNEL), MSG(CALIBRATE_CHANNEL),
+  MSG(FACTORYRESET_CHANNEL), MSG(TELEMETRY_CHANNEL),
+  MSG(HEARTBEAT_CHANNEL), MSG(RATES_CHANNEL), MSG(STREAM_CHANNEL),
+  MSG(CTLPERIOD_CHANNEL), MSG(LOADCELL_CHANNEL),
+  MSG("control/other/motor"),
+};
+
+static telemetry Telemetry;
+static histogram ExecHist, JitterHist;
+static batch_ring Ring;
+static batch Batch;
+
+static batch_sample
+make_sample(int64_t stamp){
+  batch_sample s = {
+    .stamp = stamp,
+    .utemp = q8_from_int(64) + xorshift() % 256,
+    .ltemp = q8_from_int(31) + xorshift() % 256,
+    .weight = q8_from_int(1040) + xorshift() % 1024,
+    .hduty = xorshift() % 1001,
+  };
+  return s;
+}
+
+// a mid-dry state with a completed autotune, and a publication's worth of
+// samples (one of them with an invalid reading), so that every field is
+// emitted
+static void
+setup_telemetry(telemetry* t){
+  memset(t, 0, sizeof(*t));
+  t->uptimeus = 123456789012ll;
+  t->epochms = 1760000000123ll;
+  t->boot = 17;
+  t->pubdropped = 3;
+  t->ltemp = q8_from_float(31.5);
+  t->utemp = q8_from_float(64.75);
+  t->weight = q8_from_float(1043.2);
+  t->tare = q8_from_float(211.7);
+  t->lrpm = 1187;
+  t->urpm = 2403;
+  t->smrpm = 5875;
+  t->lpwm = 128;
+  t->upwm = 255;
+  t->motor = true;
+  t->heater = true;
+  t->hduty = 412;
+  t->targtemp = 65;
+  t->dryendsus = 151234567890ll;
+  t->at.state = AUTOTUNE_DONE;
+  t->at.cycles = 4;
+  t->at.k = 0.4123;
+  t->at.l = 41.5;
+  t->at.t = 1312.25;
+  t->at.ku = 2.718;
+  t->at.tu = 301.5;
+  t->at.kp = q8_from_float(97.3);
+  t->at.ki = q8_from_float(0.21);
+  histogram_clear(&ExecHist);
+  histogram_clear(&JitterHist);
+  for(unsigned i = 0 ; i < 15 ; ++i){
+    histogram_record(&ExecHist, 40 + xorshift() % 80);
+    histogram_record(&JitterHist, xorshift() % 2000);
+  }
+  for(unsigned i = 0 ; i < 15 ; ++i){
+    batch_sample bs = make_sample(t->uptimeus - (15 - i) * 1000000ll + xorshift() % 5000);
+    if(i == 7){
+      bs.ltemp = q8_from_int(MIN_TEMP - 1);
+    }
+    batch_ring_push(&Ring, &bs);
+  }
+  batch_ring_drain(&Ring, &Batch);
+  t->samples = &Batch;
+  t->exech = &ExecHist;
+  t->jitterh = &JitterHist;
+}
+
+static void
+bench_dryreq(unsigned long n){
+  for(unsigned long i = 0 ; i < n ; ++i){
+    const msg* m = &DryReqs[i % MSGCOUNT(DryReqs)];
+    unsigned temp, seconds;
+    if(parse_dry_req(m->s, m->len, &temp, &seconds) == 0){
+      Sink += temp + seconds;
+    }
+  }
+}
+
+static void
+bench_extract_bool(unsigned long n){
+  for(unsigned long i = 0 ; i < n ; ++i){
+    const msg* m = &Bools[i % MSGCOUNT(Bools)];
+    bool b;
+    if(extract_bool(m->s, m->len, &b) == 0){
+      Sink += b;
+    }
+  }
+}
+
+static void
+bench_extract_pwm(unsigned long n){
+  for(unsigned long i = 0 ; i < n ; ++i){
+    const msg* m = &PWMs[i % MSGCOUNT(PWMs)];
+    Sink += extract_pwm(m->s, m->len);
+  }
+}
+
+static void
+bench_dispatch(unsigned long n){
+  for(unsigned long i = 0 ; i < n ; ++i){
+    const msg* m = &Topics[i % MSGCOUNT(Topics)];
+    Sink += ctlmsg_channel(m->s, m->len);
+  }
+}
+
+static void
+bench_weight(unsigned long n){
+  const q8_t tare = Telemetry.tare;
+  for(unsigned long i = 0 ; i < n ; ++i){
+    Sink += weight_from_raw(xorshift() & 0x3fffff, tare);
+  }
+}
+
+// as the sensor task does it, less the locking
+static void
+bench_batch_push(unsigned long n){
+  batch_sample bs = make_sample(0);
+  for(unsigned long i = 0 ; i < n ; ++i){
+    bs.stamp += 1000000;
+    batch_ring_push(&Ring, &bs);
+  }
+  Sink += Ring.count;
+}
+
+static void
+add_hist_cjson(cJSON* root, const char* pfx, const histogram* h){
+  char key[16];
+  snprintf(key, sizeof(key), "%sp50us", pfx);
+  cJSON_AddNumberToObject(root, key, histogram_quantile(h, 500));
+  snprintf(key, sizeof(key), "%sp99us", pfx);
+  cJSON_AddNumberToObject(root, key, histogram_quantile(h, 990));
+  snprintf(key, sizeof(key), "%smaxus", pfx);
+  cJSON_AddNumberToObject(root, key, h->max);
+}
+
+// the telemetry object as send_mqtt() used to build it
+static cJSON*
+telemetry_cjson(const telemetry* t){
+  cJSON* root = cJSON_CreateObject();
+  if(root == NULL){
+    return NULL;
+  }
+  cJSON_AddNumberToObject(root, "uptimesec", t->uptimeus / 1000000ll);
+  if(temp_valid_p(t->ltemp)){
+    cJSON_AddNumberToObject(root, "ltempC", q8_to_float(t->ltemp));
+  }
+  if(rpm_valid_p(t->lrpm)){
+    cJSON_AddNumberToObject(root, "lrpm", t->lrpm);
+  }
+  if(rpm_valid_p(t->urpm)){
+    cJSON_AddNumberToObject(root, "urpm", t->urpm);
+  }
+  if(spool_mrpm_valid_p(t->smrpm)){
+    cJSON_AddNumberToObject(root, "srpm", t->smrpm / 1000.0);
+  }
+  cJSON_AddNumberToObject(root, "lpwm", t->lpwm);
+  cJSON_AddNumberToObject(root, "upwm", t->upwm);
+  if(weight_valid_p(t->weight)){
+    cJSON_AddNumberToObject(root, "mass", q8_to_float(t->weight));
+  }
+  cJSON_AddNumberToObject(root, "tare", q8_to_float(t->tare));
+  cJSON_AddNumberToObject(root, "motor", t->motor);
+  cJSON_AddNumberToObject(root, "heater", t->heater);
+  cJSON_AddNumberToObject(root, "hduty", t->hduty);
+  const autotune* at = &t->at;
+  if(at->state != AUTOTUNE_IDLE){
+    cJSON_AddStringToObject(root, "atstate", autotune_state_str(at->state));
+    cJSON_AddNumberToObject(root, "atcycles", at->cycles);
+    if(at->state == AUTOTUNE_DONE){
+      cJSON_AddNumberToObject(root, "atK", at->k);
+      cJSON_AddNumberToObject(root, "atLsec", at->l);
+      cJSON_AddNumberToObject(root, "atTsec", at->t);
+      cJSON_AddNumberToObject(root, "atKu", at->ku);
+      cJSON_AddNumberToObject(root, "atTusec", at->tu);
+      cJSON_AddNumberToObject(root, "atkp", q8_to_float(at->kp));
+      cJSON_AddNumberToObject(root, "atki", q8_to_float(at->ki));
+    }
+  }
+  if(temp_valid_p(t->utemp)){
+    cJSON_AddNumberToObject(root, "utempC", q8_to_float(t->utemp));
+  }
+  cJSON_AddNumberToObject(root, "ttempC", t->targtemp);
+  cJSON_AddNumberToObject(root, "dryendsec", t->dryendsus);
+  add_hist_cjson(root, "ctl", t->exech);
+  add_hist_cjson(root, "jit", t->jitterh);
+  return root;
+}
+
+// as send_mqtt() used to do it, less the publication
+static void
+bench_telemetry_cjson(unsigned long n){
+  for(unsigned long i = 0 ; i < n ; ++i){
+    cJSON* root = telemetry_cjson(&Telemetry);
+    char* s = cJSON_Print(root);
+    Sink += strlen(s);
+    cJSON_free(s);
+    cJSON_Delete(root);
+  }
+}
+
+// as send_mqtt() does it, less the publication
+static void
+bench_telemetry_json(unsigned long n){
+  static char buf[TELEMETRY_JSON_MAX];
+  for(unsigned long i = 0 ; i < n ; ++i){
+    Sink += telemetry_json(&Telemetry, buf, sizeof(buf));
+  }
+}
+
+// copy the next key (a string followed by ':') at or after *s into k,
+// advancing *s past it. returns false if there are no more keys.
+static bool
+next_key(const char** s, char* k, size_t klen){
+  const char* q;
+  while((q = strchr(*s, '"'))){
+    const char* e = strchr(q + 1, '"');
+    if(e == NULL){
+      return false;
+    }
+    const char* c = e + 1;
+    while(*c == ' ' || *c == '\t'){
+      ++c;
+    }
+    *s = e + 1;
+    if(*c == ':' && (size_t)(e - q) <= klen){
+      memcpy(k, q + 1, e - q - 1);
+      k[e - q - 1] = '\0';
+      return true;
+    }
+  }
+  return false;
+}
+
+// verify that telemetry_json() emits the same keys as the old cJSON path,
+// which predates batches, wall clock timestamps, boot counts, and drop
+// counts
+static int
+check_keys(const telemetry* bt){
+  telemetry tcopy = *bt;
+  const telemetry* t = &tcopy;
+  tcopy.samples = NULL;
+  tcopy.epochms = 0;
+  tcopy.boot = 0;
+  tcopy.pubdropped = 0;
+  char buf[TELEMETRY_JSON_MAX];
+  if(telemetry_json(t, buf, sizeof(buf)) < 0){
+    fprintf(stderr, "telemetry exceeded %zuB\n", sizeof(buf));
+    return -1;
+  }
+  cJSON* root = telemetry_cjson(t);
+  char* ref = cJSON_PrintUnformatted(root);
+  int ret = 0;
+  const char* a = buf;
+  const char* b = ref;
+  char ka[32], kb[32];
+  bool ma, mb;
+  do{
+    ma = next_key(&a, ka, sizeof(ka));
+    mb = next_key(&b, kb, sizeof(kb));
+    if(ma != mb || (ma && strcmp(ka, kb))){
+      fprintf(stderr, "key mismatch: %s vs %s\n", ma ? ka : "(end)", mb ? kb : "(end)");
+      ret = -1;
+      break;
+    }
+  }while(ma);
+  if(ret){
+    fprintf(stderr, "jsonw: %s\ncjson: %s\n", buf, ref);
+  }
+  cJSON_free(ref);
+  cJSON_Delete(root);
+  return ret;
+}
+
+static void
+bench_telemetry_cbor(unsigned long n){
+  static uint8_t buf[TELEMETRY_CBOR_MAX];
+  for(unsigned long i = 0 ; i < n ; ++i){
+    Sink += telemetry_cbor(&Telemetry, buf, sizeof(buf));
+  }
+}
+
+// the JSON names of the CBOR keys
+static const char* const TKeyNames[TKEY_COUNT] = {
+  "schema", "uptimesec", "ltempC", "lrpm", "urpm", "srpm", "lpwm", "upwm",
+  "mass", "tare", "motor", "heater", "hduty", "atstate", "atcycles", "atK",
+  "atLsec", "atTsec", "atKu", "atTusec", "atkp", "atki", "utempC", "ttempC",
+  "dryendsec", "ctlp50us", "ctlp99us", "ctlmaxus", "jitp50us", "jitp99us",
+  "jitmaxus", "bt0ms", "bdtms", "butempdC", "bltempdC", "bmass", "bhduty",
+  "bdropped", "epochms", "pubdropped", "boot",
+};
+
+// a decoded member of the flat CBOR maps telemetry_cbor() writes. arrays
+// are of numbers, with NaN standing in for null.
+typedef struct cbor_member {
+  unsigned key;
+  bool text;
+  double num;
+  char str[16];
+  unsigned n;   // elements of arr, if an array
+  double arr[BATCH_MAX];
+} cbor_member;
+
+static uint64_t
+get_be(const uint8_t* p, unsigned bytes){
+  uint64_t v = 0;
+  while(bytes--){
+    v = (v << 8u) | *p++;
+  }
+  return v;
+}
+
+static int cbor_item(const uint8_t** p, const uint8_t* end, cbor_member* m, bool iskey);
+
+static int
+cbor_array(const uint8_t** p, const uint8_t* end, cbor_member* m, uint64_t n){
+  if(n > BATCH_MAX){
+    return -1;
+  }
+  m->n = n;
+  for(unsigned i = 0 ; i < n ; ++i){
+    cbor_member e;
+    if(**p == 0xf6){ // null
+      ++*p;
+      m->arr[i] = NAN;
+    }else if(cbor_item(p, end, &e, false) || e.text || e.n){
+      return -1;
+    }else{
+      m->arr[i] = e.num;
+    }
+  }
+  return 0;
+}
+
+// decode the data item at *p (within end), advancing *p past it. only the
+// types telemetry_cbor() uses are understood. returns -1 on error.
+static int
+cbor_item(const uint8_t** p, const uint8_t* end, cbor_member* m, bool iskey){
+  if(*p >= end){
+    return -1;
+  }
+  const unsigned major = **p >> 5u;
+  const unsigned info = **p & 0x1fu;
+  ++*p;
+  static const unsigned argbytes[] = { 1, 2, 4, 8 };
+  uint64_t arg = info;
+  if(info >= 24 && info <= 27){
+    const unsigned b = argbytes[info - 24];
+    if(end - *p < b){
+      return -1;
+    }
+    arg = get_be(*p, b);
+    *p += b;
+  }else if(info > 27){
+    return -1;
+  }
+  if(iskey){
+    if(major != 0 || arg >= TKEY_COUNT){
+      return -1;
+    }
+    m->key = arg;
+    return 0;
+  }
+  m->text = false;
+  m->n = 0;
+  switch(major){
+    case 0: m->num = arg; return 0;
+    case 1: m->num = -1.0 - arg; return 0;
+    case 3:
+      if(arg >= sizeof(m->str) || (uint64_t)(end - *p) < arg){
+        return -1;
+      }
+      memcpy(m->str, *p, arg);
+      m->str[arg] = '\0';
+      *p += arg;
+      m->text = true;
+      return 0;
+    case 4:
+      return cbor_array(p, end, m, arg);
+    case 7:
+      if(info == 25){ // half, per RFC 8949 appendix D
+        const int e = (arg >> 10u) & 0x1f;
+        const double mant = arg & 0x3ffu;
+        double v = e == 0 ? ldexp(mant, -24) :
+                   e == 31 ? (mant ? NAN : INFINITY) : ldexp(mant + 1024, e - 25);
+        m->num = arg & 0x8000u ? -v : v;
+        return 0;
+      }else if(info == 26){
+        uint32_t f = arg;
+        float v;
+        memcpy(&v, &f, sizeof(v));
+        m->num = v;
+        return 0;
+      }
+      return -1;
+  }
+  return -1;
+}
+
+// find the value for key k in the JSON object s, which must exist
+static const char*
+json_value(const char* s, const char* k){
+  char quoted[32];
+  snprintf(quoted, sizeof(quoted), "\"%s\":", k);
+  const char* v = strstr(s, quoted);
+  return v ? v + strlen(quoted) : NULL;
+}
+
+static bool
+num_match(double jv, double cv){
+  if(isnan(jv) || isnan(cv)){
+    return isnan(jv) && isnan(cv);
+  }
+  return fabs(jv - cv) <= fabs(jv) / 1024 + 1e-4;
+}
+
+// compare a JSON array of numbers (and nulls) with a decoded CBOR one
+static bool
+array_match(const char* v, const cbor_member* m){
+  if(v == NULL || *v++ != '['){
+    return false;
+  }
+  for(unsigned i = 0 ; i < m->n ; ++i){
+    double jv;
+    if(strncmp(v, "null", 4) == 0){
+      jv = NAN;
+      v += 4;
+    }else{
+      char* e;
+      jv = strtod(v, &e);
+      if(e == v){
+        return false;
+      }
+      v = e;
+    }
+    if(!num_match(jv, m->arr[i]) || *v++ != (i + 1 == m->n ? ']' : ',')){
+      return false;
+    }
+  }
+  return m->n || *v == ']';
+}
+
+// verify that telemetry_cbor() decodes to the members of telemetry_json(),
+// in the same order, with the schema version first. values must match to
+// within the precision of a half.
+static int
+check_cbor(const telemetry* t){
+  char json[TELEMETRY_JSON_MAX];
+  uint8_t cbor[TELEMETRY_CBOR_MAX];
+  const int clen = telemetry_cbor(t, cbor, sizeof(cbor));
+  if(clen < 0 || telemetry_json(t, json, sizeof(json)) < 0){
+    fprintf(stderr, "couldn't render telemetry\n");
+    return -1;
+  }
+  const uint8_t* p = cbor;
+  const uint8_t* end = cbor + clen;
+  if(*p++ != 0xbf){
+    fprintf(stderr, "cbor telemetry wasn't an indefinite map\n");
+    return -1;
+  }
+  const char* js = json;
+  char jk[32];
+  bool first = true;
+  while(p < end && *p != 0xff){
+    cbor_member m;
+    if(cbor_item(&p, end, &m, true) || cbor_item(&p, end, &m, false)){
+      fprintf(stderr, "invalid cbor at byte %td\n", p - cbor);
+      return -1;
+    }
+    if(first){
+      if(m.key != TKEY_SCHEMA || m.num != TELEMETRY_CBOR_SCHEMA){
+        fprintf(stderr, "cbor telemetry didn't lead with the schema\n");
+        return -1;
+      }
+      first = false;
+      continue;
+    }
+    const char* name = TKeyNames[m.key];
+    if(!next_key(&js, jk, sizeof(jk)) || strcmp(jk, name)){
+      fprintf(stderr, "cbor key %s where json had %s\n", name, jk);
+      return -1;
+    }
+    const char* v = json_value(json, name);
+    bool match;
+    if(m.text){
+      match = v && *v == '"' && !strncmp(v + 1, m.str, strlen(m.str))
+               && v[strlen(m.str) + 1] == '"';
+    }else if(m.n){
+      match = array_match(v, &m);
+    }else{
+      match = v && num_match(strtod(v, NULL), m.num);
+    }
+    if(!match){
+      fprintf(stderr, "cbor %s doesn't match json (%s)\n", name, v ? v : "missing");
+      return -1;
+    }
+  }
+  if(p + 1 != end){
+    fprintf(stderr, "cbor telemetry wasn't terminated\n");
+    return -1;
+  }
+  if(next_key(&js, jk, sizeof(jk))){
+    fprintf(stderr, "json key %s missing from cbor\n", jk);
+    return -1;
+  }
+  return 0;
+}
+
+// the common case on the device: a fresh snapshot, jittering within its
+// deadbands, compared against what we last published
+static void
+bench_telemetry_compare(unsigned long n){
+  const deadbands db = DEADBANDS_INITIALIZER;
+  telemetry cur = Telemetry;
+  for(unsigned long i = 0 ; i < n ; ++i){
+    cur.utemp = Telemetry.utemp + (q8_t)(xorshift() % 64) - 32;
+    cur.weight = Telemetry.weight + (q8_t)(xorshift() % 16) - 8;
+    cur.heater = xorshift() & 1;
+    Sink += telemetry_compare(&Telemetry, &cur, &db);
+  }
+}
+
+static int
+check_compare(const telemetry* t){
+  const deadbands db = DEADBANDS_INITIALIZER;
+  telemetry cur = *t;
+  telemetry_change c[7];
+  c[0] = telemetry_compare(t, &cur, &db);
+  cur.heater = !cur.heater; // under the dry's control
+  c[1] = telemetry_compare(t, &cur, &db);
+  cur.utemp += db.temp;
+  c[2] = telemetry_compare(t, &cur, &db);
+  cur.lrpm = UINT32_MAX;
+  c[3] = telemetry_compare(t, &cur, &db);
+  cur = *t;
+  cur.dryendsus = 0;
+  c[4] = telemetry_compare(t, &cur, &db);
+  // 0.05g is noise, and 0.1g is worth publishing
+  cur = *t;
+  cur.weight += q8_from_int(LOAD_CELL_UNITS_PER_G) / 20;
+  c[5] = telemetry_compare(t, &cur, &db);
+  cur.weight += q8_from_int(LOAD_CELL_UNITS_PER_G) / 20;
+  c[6] = telemetry_compare(t, &cur, &db);
+  const telemetry_change want[7] = {
+    TCHANGE_NONE, TCHANGE_NONE, TCHANGE_ANALOG, TCHANGE_DISCRETE, TCHANGE_DISCRETE,
+    TCHANGE_NONE, TCHANGE_ANALOG,
+  };
+  for(unsigned i = 0 ; i < sizeof(want) / sizeof(*want) ; ++i){
+    if(c[i] != want[i]){
+      fprintf(stderr, "telemetry_compare() case %u returned %d, not %d\n", i, c[i], want[i]);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static int
+check_rates(const telemetry* t){
+  const telemetry_rates r = TELEMETRY_RATES_INITIALIZER;
+  telemetry cur = *t;
+  telemetry_rate c[4];
+  c[0] = telemetry_rate_of(&cur, &r);
+  cur.utemp = q8_from_int(cur.targtemp) - TELEMETRY_RAMP_BAND - 1;
+  c[1] = telemetry_rate_of(&cur, &r);
+  cur = *t;
+  cur.dryendsus = cur.uptimeus + r.endingsec * 1000000ll;
+  c[2] = telemetry_rate_of(&cur, &r);
+  cur.dryendsus = 0;
+  c[3] = telemetry_rate_of(&cur, &r);
+  const telemetry_rate want[4] = { TRATE_ACTIVE, TRATE_FAST, TRATE_FAST, TRATE_IDLE, };
+  for(unsigned i = 0 ; i < sizeof(want) / sizeof(*want) ; ++i){
+    if(c[i] != want[i]){
+      fprintf(stderr, "telemetry_rate_of() case %u returned %d, not %d\n", i, c[i], want[i]);
+      return -1;
+    }
+  }
+  const char req[] = " 2/15/60/300 ";
+  telemetry_rates pr;
+  if(parse_rates_req(req, sizeof(req) - 1, &pr) || memcmp(&pr, &r, sizeof(r))
+      || !telemetry_rates_valid_p(&pr)){
+    fprintf(stderr, "couldn't parse rates [%s]\n", req);
+    return -1;
+  }
+  return 0;
+}
+
+// a record taken before the wall clock was set, rebased, must be exactly
+// what we'd have rendered with it set. records from another boot, or which
+// already have epochms, must be left alone.
+static int
+check_rebase(const telemetry* t){
+  static uint8_t want[TELEMETRY_JSON_MAX], got[TELEMETRY_JSON_MAX];
+  const int64_t bootms = t->epochms - t->uptimeus / 1000000ll * 1000;
+  const unsigned fmts[] = { TELEMETRY_FMT_JSON, TELEMETRY_FMT_CBOR, };
+  for(unsigned i = 0 ; i < sizeof(fmts) / sizeof(*fmts) ; ++i){
+    telemetry early = *t;
+    early.epochms = 0;
+    int wlen, glen;
+    if(fmts[i] == TELEMETRY_FMT_JSON){
+      wlen = telemetry_json(t, (char*)want, sizeof(want)) + 1;
+      glen = telemetry_json(&early, (char*)got, sizeof(got)) + 1;
+    }else{
+      wlen = telemetry_cbor(t, want, sizeof(want));
+      glen = telemetry_cbor(&early, got, sizeof(got));
+    }
+    if(telemetry_rebase(fmts[i], got, glen, sizeof(got), t->boot + 1, bootms) != glen
+        || telemetry_rebase(fmts[i], got, glen, glen, t->boot, bootms) != -1){
+      fprintf(stderr, "rebased a record it oughtn't have (fmt %u)\n", fmts[i]);
+      return -1;
+    }
+    glen = telemetry_rebase(fmts[i], got, glen, sizeof(got), t->boot, bootms);
+    if(glen != wlen || memcmp(got, want, wlen)){
+      fprintf(stderr, "rebased record differs (fmt %u, %d vs %dB)\n", fmts[i], glen, wlen);
+      return -1;
+    }
+    if(telemetry_rebase(fmts[i], got, glen, sizeof(got), t->boot, bootms) != glen){
+      fprintf(stderr, "rebased a record twice (fmt %u)\n", fmts[i]);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// the event must be exactly the JSON, framed, with its ID
+static int
+check_sse(const telemetry* t){
+  char json[TELEMETRY_JSON_MAX];
+  char sse[TELEMETRY_SSE_MAX];
+  const int jlen = telemetry_json(t, json, sizeof(json));
+  const int slen = telemetry_sse(t, 4294967295u, sse, sizeof(sse));
+  const char head[] = "id: 4294967295\ndata: ";
+  const size_t hlen = sizeof(head) - 1;
+  if(jlen < 0 || slen < 0 || (size_t)slen != hlen + jlen + 2
+      || memcmp(sse, head, hlen) || memcmp(sse + hlen, json, jlen)
+      || strcmp(sse + hlen + jlen, "\n\n")){
+    fprintf(stderr, "telemetry_sse() didn't frame telemetry_json()\n");
+    return -1;
+  }
+  return 0;
+}
+
+static history History;
+
+// as the control task does it, once per second
+static void
+bench_history(unsigned long n){
+  history_rollup rollups[HISTORY_TIERS];
+  telemetry t = Telemetry;
+  history_init(&History, 1);
+  for(unsigned long i = 0 ; i < n ; ++i){
+    t.uptimeus += 1000000ll;
+    t.utemp += (i & 1) ? Q8_ONE : -Q8_ONE;
+    Sink += history_push(&History, &t, rollups);
+  }
+}
+
+// the longest interval's worth of 1Hz samples ought be thinned to a
+// uniform stride, from the first sample to the last, and none dropped
+static int
+check_batch(void){
+  const unsigned secs = TELEMETRY_RATE_SEC_MAX;
+  for(unsigned i = 0 ; i < secs ; ++i){
+    batch_sample bs = make_sample(1000000ll + i * 1000000ll);
+    batch_ring_push(&Ring, &bs);
+  }
+  batch_ring_drain(&Ring, &Batch);
+  int64_t lastms = Batch.t0ms;
+  for(unsigned i = 1 ; i < Batch.n ; ++i){
+    if(Batch.dtms[i] != Batch.dtms[1]){
+      fprintf(stderr, "bad batch stride %d at %u (%d)\n", Batch.dtms[i], i, Batch.dtms[1]);
+      return -1;
+    }
+    lastms += Batch.dtms[i];
+  }
+  if(Batch.dropped || Batch.n < BATCH_MAX / 2 || Batch.t0ms != 1000
+      || lastms + Batch.dtms[1] <= secs * 1000ll){
+    fprintf(stderr, "bad batch of %u seconds (%u samples from %lld to %lld, %u dropped)\n",
+            secs, Batch.n, (long long)Batch.t0ms, (long long)lastms, Batch.dropped);
+    return -1;
+  }
+  return 0;
+}
+
+// a ramp across two minutes, less one skipped second, and the minute
+// rollup it closes
+static int
+check_history(const telemetry* t){
+  history_rollup rollups[HISTORY_TIERS];
+  telemetry cur = *t;
+  cur.ltemp = q8_from_int(MIN_TEMP - 1);
+  history_init(&History, 7);
+  unsigned closed = 0;
+  for(unsigned i = 0 ; i <= 60 ; ++i){
+    if(i == 10){
+      continue;
+    }
+    cur.uptimeus = (60 + i) * 1000000ll + 250000;
+    cur.epochms = 1760000000000ll + i * 1000;
+    cur.utemp = q8_from_int(20 + i);
+    closed |= history_push(&History, &cur, rollups);
+    // a second snapshot within the same second is ignored
+    closed |= history_push(&History, &cur, rollups);
+  }
+  const history_rollup* r = &rollups[HISTORY_MINUTE];
+  if(closed != (1u << HISTORY_MINUTE) || r->count != 59 || r->boot != 7
+      || r->epoch != 1760000000 || r->utemp[HISTORY_MIN] != 200
+      || r->utemp[HISTORY_MAX] != 790 || r->utemp[HISTORY_MEAN] != 498
+      || r->ltemp[HISTORY_MEAN] != HISTORY_TEMP_INVALID
+      || r->hduty[HISTORY_MEAN] != (int)t->hduty){
+    fprintf(stderr, "bad history rollup (%u seconds)\n", r->count);
+    return -1;
+  }
+  history_sample s[HISTORY_SECS];
+  uint32_t sec0 = 0;
+  const unsigned n = history_samples(&History, &sec0, s, HISTORY_SECS);
+  char json[HISTORY_SAMPLE_JSON_MAX];
+  if(n != 61 || sec0 != 60 || !(s[10].flags & HISTORY_GAP) || s[11].utemp != 310
+      || history_sample_json(&s[0], json, sizeof(json)) < 0
+      || strcmp(json, "[200,null,1043,412,3]")){
+    fprintf(stderr, "bad history samples (%u from %u)\n", n, sec0);
+    return -1;
+  }
+  return 0;
+}
+
+static pubq Queue;
+static pubq_msg QueueMsg;
+
+// a rendering of telemetry in and out, as send_mqtt() and the publisher
+// task do it
+static void
+bench_pubq(unsigned long n){
+  char json[TELEMETRY_JSON_MAX];
+  const int jlen = telemetry_json(&Telemetry, json, sizeof(json));
+  for(unsigned long i = 0 ; i < n ; ++i){
+    pubq_push(&Queue, 0, json, jlen + 1, NULL);
+    if(pubq_pop(&Queue, &QueueMsg) == 0){
+      Sink += QueueMsg.len;
+    }
+  }
+}
+
+static int
+check_pubq(void){
+  pubq_init(&Queue);
+  for(unsigned i = 0 ; i <= PUBQ_DEPTH ; ++i){
+    unsigned v;
+    if(pubq_push(&Queue, i, &i, sizeof(i), &QueueMsg)){
+      fprintf(stderr, "couldn't queue message %u\n", i);
+      return -1;
+    }
+    // only the last push ought have evicted anything, and that the first
+    memcpy(&v, QueueMsg.buf, sizeof(v));
+    if(i < PUBQ_DEPTH ? QueueMsg.len != 0
+        : QueueMsg.len != sizeof(v) || QueueMsg.kind != 0 || v != 0){
+      fprintf(stderr, "bad eviction queueing message %u\n", i);
+      return -1;
+    }
+  }
+  unsigned want = 1;
+  while(pubq_pop(&Queue, &QueueMsg) == 0){
+    unsigned v;
+    memcpy(&v, QueueMsg.buf, sizeof(v));
+    if(QueueMsg.kind != want || v != want || QueueMsg.len != sizeof(v)){
+      fprintf(stderr, "dequeued message %u, wanted %u\n", v, want);
+      return -1;
+    }
+    ++want;
+  }
+  if(want != PUBQ_DEPTH + 1 || pubq_dropped(&Queue) != 1){
+    fprintf(stderr, "queue held %u messages, dropped %u\n", want - 1, pubq_dropped(&Queue));
+    return -1;
+  }
+  return 0;
+}
+
+// several producers hammer a consumer through the queue, as the telemetry,
+// spool, and MQTT event tasks do the publisher, but truly in parallel. each
+// message is its producer and a sequence number. every message must come
+// out of the queue intact, exactly once (popped by the consumer or evicted
+// by a producer) unless its push failed, and each producer's messages must
+// be popped in order.
+#define STRESS_PRODUCERS 3
+#define STRESS_MSGS 20000u
+
+typedef struct stress_msg {
+  uint32_t producer, seq;
+} stress_msg;
+
+static pubq StressQueue;
+static _Atomic(bool) StressDone;
+static _Atomic(unsigned long) StressOut, StressFailed;
+static _Atomic(bool) StressBad;
+// each thread's working copy (not on their stacks, being a few KB)
+static pubq_msg StressEvicted[STRESS_PRODUCERS], StressPopped;
+
+static void
+stress_account(const pubq_msg* m){
+  stress_msg sm;
+  memcpy(&sm, m->buf, sizeof(sm));
+  if(m->len != sizeof(sm) || m->kind != sm.producer || sm.producer >= STRESS_PRODUCERS
+      || sm.seq >= STRESS_MSGS){
+    atomic_store(&StressBad, true);
+  }
+  atomic_fetch_add(&StressOut, 1);
+}
+
+static void*
+stress_producer(void* arg){
+  const uint32_t id = (uintptr_t)arg;
+  pubq_msg* ev = &StressEvicted[id];
+  for(uint32_t i = 0 ; i < STRESS_MSGS ; ++i){
+    const stress_msg sm = { .producer = id, .seq = i, };
+    if(pubq_push(&StressQueue, id, &sm, sizeof(sm), ev)){
+      atomic_fetch_add(&StressFailed, 1);
+    }
+    if(ev->len){
+      stress_account(ev);
+    }
+    if(i % 8 == 0){
+      sched_yield();
+    }
+  }
+  return NULL;
+}
+
+static void*
+stress_consumer(void* arg){
+  (void)arg;
+  pubq_msg* m = &StressPopped;
+  uint32_t next[STRESS_PRODUCERS] = { 0 };
+  while(1){
+    const bool done = atomic_load(&StressDone);
+    if(pubq_pop(&StressQueue, m)){
+      if(done){
+        break;
+      }
+      sched_yield();
+      continue;
+    }
+    stress_msg sm;
+    memcpy(&sm, m->buf, sizeof(sm));
+    if(sm.producer < STRESS_PRODUCERS){
+      if(sm.seq < next[sm.producer]){
+        atomic_store(&StressBad, true);
+      }
+      next[sm.producer] = sm.seq + 1;
+    }
+    stress_account(m);
+  }
+  return NULL;
+}
+
+static int
+check_pubq_stress(void){
+  pubq_init(&StressQueue);
+  pthread_t prod[STRESS_PRODUCERS], cons;
+  if(pthread_create(&cons, NULL, stress_consumer, NULL)){
+    fprintf(stderr, "couldn't launch consumer\n");
+    return -1;
+  }
+  for(uintptr_t i = 0 ; i < STRESS_PRODUCERS ; ++i){
+    if(pthread_create(&prod[i], NULL, stress_producer, (void*)i)){
+      fprintf(stderr, "couldn't launch producer\n");
+      return -1;
+    }
+  }
+  for(unsigned i = 0 ; i < STRESS_PRODUCERS ; ++i){
+    pthread_join(prod[i], NULL);
+  }
+  atomic_store(&StressDone, true);
+  pthread_join(cons, NULL);
+  const unsigned long out = atomic_load(&StressOut);
+  const unsigned long failed = atomic_load(&StressFailed);
+  if(atomic_load(&StressBad) || out + failed != STRESS_PRODUCERS * (unsigned long)STRESS_MSGS){
+    fprintf(stderr, "pubq lost or corrupted messages (%lu out, %lu failed of %lu)\n",
+            out, failed, STRESS_PRODUCERS * (unsigned long)STRESS_MSGS);
+    return -1;
+  }
+  return 0;
+}
+
+static devstate State;
+
+// a writer publishes as fast as it can while readers copy, checking that
+// every snapshot is whole: its members must agree with one another and
+// with its generation, and generations mustn't go backwards.
+#define STATE_STRESS_PUBS 2000000u
+#define STATE_STRESS_READERS 2
+
+static devstate StressState;
+static _Atomic(bool) StateStressDone;
+static _Atomic(unsigned long) StateStressTorn;
+
+static void*
+state_stress_writer(void* arg){
+  (void)arg;
+  telemetry t;
+  memset(&t, 0, sizeof(t));
+  for(uint32_t i = 1 ; i <= STATE_STRESS_PUBS ; ++i){
+    t.uptimeus = i;
+    t.epochms = i * 3ll;
+    t.dryendsus = i * 7ll + (1ll << 40); // both halves change
+    t.lrpm = i;
+    devstate_publish(&StressState, &t);
+  }
+  atomic_store(&StateStressDone, true);
+  return NULL;
+}
+
+static void*
+state_stress_reader(void* arg){
+  (void)arg;
+  uint32_t last = 0;
+  telemetry t;
+  while(!atomic_load(&StateStressDone)){
+    const uint32_t gen = devstate_read(&StressState, &t);
+    if(gen == 0){
+      continue;
+    }
+    if(gen < last || t.uptimeus != gen || t.epochms != gen * 3ll
+        || t.dryendsus != gen * 7ll + (1ll << 40) || t.lrpm != gen){
+      atomic_fetch_add(&StateStressTorn, 1);
+    }
+    last = gen;
+  }
+  return NULL;
+}
+
+static int
+check_state_stress(void){
+  pthread_t readers[STATE_STRESS_READERS], writer;
+  for(unsigned i = 0 ; i < STATE_STRESS_READERS ; ++i){
+    if(pthread_create(&readers[i], NULL, state_stress_reader, NULL)){
+      fprintf(stderr, "couldn't launch reader\n");
+      return -1;
+    }
+  }
+  if(pthread_create(&writer, NULL, state_stress_writer, NULL)){
+    fprintf(stderr, "couldn't launch writer\n");
+    return -1;
+  }
+  pthread_join(writer, NULL);
+  for(unsigned i = 0 ; i < STATE_STRESS_READERS ; ++i){
+    pthread_join(readers[i], NULL);
+  }
+  telemetry t;
+  const uint32_t gen = devstate_read(&StressState, &t);
+  if(atomic_load(&StateStressTorn) || gen != STATE_STRESS_PUBS){
+    fprintf(stderr, "state read torn %lu times (generation %" PRIu32 ")\n",
+            atomic_load(&StateStressTorn), gen);
+    return -1;
+  }
+  return 0;
+}
+
+// the control task's publication, and one reader's copy
+static void
+bench_state(unsigned long n){
+  telemetry t;
+  for(unsigned long i = 0 ; i < n ; ++i){
+    devstate_publish(&State, &Telemetry);
+    Sink += devstate_read(&State, &t);
+  }
+}
+
+// as the /api/v1/state handler does it
+static void
+bench_state_json(unsigned long n){
+  char buf[TELEMETRY_JSON_MAX];
+  telemetry t;
+  devstate_publish(&State, &Telemetry);
+  for(unsigned long i = 0 ; i < n ; ++i){
+    Sink += devstate_read(&State, &t);
+    Sink += telemetry_json(&t, buf, sizeof(buf));
+  }
+}
+
+// as the stream task does it for each new snapshot, however many subscribe
+static void
+bench_state_sse(unsigned long n){
+  char buf[TELEMETRY_SSE_MAX];
+  telemetry t;
+  devstate_publish(&State, &Telemetry);
+  for(unsigned long i = 0 ; i < n ; ++i){
+    const uint32_t gen = devstate_read(&State, &t);
+    Sink += telemetry_sse(&t, gen, buf, sizeof(buf));
+  }
+}
+
+static void
+bench_status_html(unsigned long n){
+  char buf[HTML_BYTES];
+  const time_t now = 1760000000;
+  for(unsigned long i = 0 ; i < n ; ++i){
+    Sink += telemetry_html(buf, sizeof(buf), &Telemetry, now);
+  }
+}
+
+typedef struct bench {
+  const char* name;
+  void (*fxn)(unsigned long n);
+} bench;
+
+static const bench Benches[] = {
+  { "DryReq", bench_dryreq, },
+  { "ExtractBool", bench_extract_bool, },
+  { "ExtractPWM", bench_extract_pwm, },
+  { "TopicDispatch", bench_dispatch, },
+  { "WeightScale", bench_weight, },
+  { "BatchPush", bench_batch_push, },
+  { "TelemetryCJSON", bench_telemetry_cjson, },
+  { "TelemetryJSON", bench_telemetry_json, },
+  { "TelemetryCBOR", bench_telemetry_cbor, },
+  { "TelemetryCompare", bench_telemetry_compare, },
+  { "PubQueue", bench_pubq, },
+  { "StateSnapshot", bench_state, },
+  { "StateJSON", bench_state_json, },
+  { "StateSSE", bench_state_sse, },
+  { "HistoryPush", bench_history, },
+  { "StatusHTML", bench_status_html, },
+};
+
+static inline uint64_t
+nsecs(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// grow the iteration count until a run takes at least benchns, and report
+// that run.
+static void
+run(const bench* b, uint64_t benchns){
+  unsigned long n = 1;
+  while(1){
+    Allocs = AllocBytes = 0;
+    const uint64_t start = nsecs();
+    b->fxn(n);
+    const uint64_t ns = nsecs() - start;
+    if(ns >= benchns || n >= 1000000000ul){
+      printf("Benchmark%s\t%10lu\t%12.2f ns/op\t%8.1f B/op\t%6.2f allocs/op\n",
+             b->name, n, (double)ns / n, (double)AllocBytes / n, (double)Allocs / n);
+      return;
+    }
+    // aim for benchns, from what we've seen so far, growing at least 2x
+    unsigned long next = ns ? benchns * 1.2 * n / ns : n * 100;
+    n = next > n * 2 ? next : n * 2;
+  }
+}
+
+// thermo.c wants to know the board. we test both tables directly.
+bool electronics_use_lm35(void){
+  return false;
+}
+
+// the interpolated reading at mv must be within tol tenths of c
+static int
+check_thermo_point(const thermo_table* t, int32_t mv, double c, double tol){
+  const double got = q8_to_float(thermo_mv_to_q8(t, mv));
+  if(fabs(got - c) > tol / 10){
+    fprintf(stderr, "%s: %" PRId32 "mV gave %.2fC, wanted %.2f+-%.1fC\n",
+            t->name, mv, got, c, tol / 10);
+    return -1;
+  }
+  return 0;
+}
+
+// each table must be sorted by voltage, and reproduce its sensor's transfer
+// function between the points it holds, not only at them
+static int
+check_thermo(void){
+  const thermo_table* tables[] = { &LM35Table, &LMT87Table, };
+  for(unsigned i = 0 ; i < sizeof(tables) / sizeof(*tables) ; ++i){
+    for(unsigned p = 1 ; p < tables[i]->count ; ++p){
+      if(tables[i]->pts[p].mv <= tables[i]->pts[p - 1].mv){
+        fprintf(stderr, "%s: point %u is out of order\n", tables[i]->name, p);
+        return -1;
+      }
+    }
+  }
+  // LM35: 10mV/C
+  for(int32_t mv = 20 ; mv <= 1500 ; mv += 25){
+    if(check_thermo_point(&LM35Table, mv, mv / 10.0, 0.1)){
+      return -1;
+    }
+  }
+  // LMT87: the datasheet's transfer function every 5C, rounded to the mV
+  for(int c = -50 ; c <= 150 ; c += 5){
+    if(check_thermo_point(&LMT87Table, lround(lmt87_mv(c)), c, 1)){
+      return -1;
+    }
+  }
+  // and the ends of its table of typical voltages, which the transfer
+  // function (and thus our table) misses by up to 13mV
+  if(check_thermo_point(&LMT87Table, 3277, -50, 10)
+      || check_thermo_point(&LMT87Table, 538, 150, 10)){
+    return -1;
+  }
+  return 0;
+}
+
+static void
+usage(const char* argv0){
+  fprintf(stderr, "usage: %s [ -t ms ] [ -c count ] [ filter ]\n", argv0);
+  fprintf(stderr, " -t: minimum time per benchmark (default 500)\n");
+  fprintf(stderr, " -c: runs of each benchmark (default 1)\n");
+  fprintf(stderr, " filter: only run benchmarks whose names contain this\n");
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char** argv){
+  unsigned ms = 500;
+  unsigned count = 1;
+  int c;
+  while((c = getopt(argc, argv, "t:c:")) != -1){
+    switch(c){
+      case 't': ms = strtoul(optarg, NULL, 10); break;
+      case 'c': count = strtoul(optarg, NULL, 10); break;
+      default: usage(argv[0]);
+    }
+  }
+  if(argc - optind > 1 || ms == 0 || count == 0){
+    usage(argv[0]);
+  }
+  const char* filter = optind < argc ? argv[optind] : NULL;
+  setup_telemetry(&Telemetry);
+  if(check_keys(&Telemetry) || check_cbor(&Telemetry)
+      || check_compare(&Telemetry) || check_rates(&Telemetry) || check_sse(&Telemetry)
+      || check_rebase(&Telemetry)
+      || check_batch() || check_history(&Telemetry) || check_pubq() || check_pubq_stress()
+      || check_state_stress() || check_thermo()){
+    return EXIT_FAILURE;
+  }
+  for(unsigned i = 0 ; i < sizeof(Benches) / sizeof(*Benches) ; ++i){
+    if(filter && !strstr(Benches[i].name, filter)){
+      continue;
+    }
+    for(unsigned r = 0 ; r < count ; ++r){
+      run(&Benches[i], ms * 1000000ull);
+    }
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,7 @@
+#ifndef DANKDRYER_HOST_ESP_ATTR
+#define DANKDRYER_HOST_ESP_ATTR
+
+// there's no IRAM on the host
+#define IRAM_ATTR
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef DANKDRYER_HOST_ESP_ERR
+#define DANKDRYER_HOST_ESP_ERR
+
+// the subset of ESP-IDF's esp_err.h used by the HAL-based modules, for
+// host builds (see hal.h).
+
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_NO_MEM 0x101
+#define ESP_ERR_INVALID_ARG 0x102
+
+const char* esp_err_to_name(esp_err_t e);
+
+#endif
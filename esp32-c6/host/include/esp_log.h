@@ -0,0 +1,42 @@
+#ifndef DANKDRYER_HOST_ESP_LOG
+#define DANKDRYER_HOST_ESP_LOG
+
+// ESP-IDF's logging macros for host builds, writing to stderr in the same
+// format. as with the device, the level can be set at runtime with
+// esp_log_level_set() (though only globally). debug output is compiled out
+// (but still type-checked).
+
+#include <stdio.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef enum {
+  ESP_LOG_NONE,
+  ESP_LOG_ERROR,
+  ESP_LOG_WARN,
+  ESP_LOG_INFO,
+  ESP_LOG_DEBUG,
+  ESP_LOG_VERBOSE,
+} esp_log_level_t;
+
+extern esp_log_level_t esp_log_host_level;
+
+void esp_log_level_set(const char* tag, esp_log_level_t level);
+
+// milliseconds of the simulated clock, for log lines
+uint32_t esp_log_timestamp(void);
+
+#define ESP_HOST_LOG(lvl, l, tag, fmt, ...) \
+  do{ \
+    if(esp_log_host_level >= (lvl)){ \
+      fprintf(stderr, l " (%u) %s: " fmt "\n", (unsigned)esp_log_timestamp(), tag, ##__VA_ARGS__); \
+    } \
+  }while(0)
+
+#define ESP_LOGE(tag, fmt, ...) ESP_HOST_LOG(ESP_LOG_ERROR, "E", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) ESP_HOST_LOG(ESP_LOG_WARN, "W", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) ESP_HOST_LOG(ESP_LOG_INFO, "I", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGD(tag, fmt, ...) \
+  do{ if(0){ ESP_HOST_LOG(ESP_LOG_DEBUG, "D", tag, fmt, ##__VA_ARGS__); } }while(0)
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef DANKDRYER_PLANT
+#define DANKDRYER_PLANT
+
+// the simulated hot chamber and its thermometer, shared by the host tools.
+// the chamber is two lumped masses: the ceramic element, whose output falls
+// off as it approaches its 230C ceiling, and the chamber (air, walls, and
+// spool), which leaks to ambient. the thermometer is an LMT87, which sees
+// the chamber through a first-order lag. plantsim.c builds a finer chamber
+// atop the same element and thermometer.
+
+#include <stdbool.h>
+
+#define HEATER_WATTS 200.0
+#define HEATER_CEILING 230.0 // self-limiting element temperature
+#define ELEMENT_JK 250.0     // element heat capacity, J/K
+#define ELEMENT_WK 5.0       // element->chamber conductance, W/K
+#define CHAMBER_JK 2500.0    // chamber+spool heat capacity, J/K
+#define CHAMBER_WK 0.9       // chamber->ambient conductance, W/K
+#define SENSOR_TAU 30.0      // thermometer lag, s
+
+typedef struct plant {
+  double ambient;
+  double element, chamber;
+  double sensor;           // what the thermometer sees
+  double joules;           // delivered by the element
+} plant;
+
+// the element's output at temperature 'element' while switched on
+static inline double
+heater_watts(double element, double ambient){
+  if(element >= HEATER_CEILING){
+    return 0;
+  }
+  return HEATER_WATTS * (HEATER_CEILING - element) / (HEATER_CEILING - ambient);
+}
+
+// the thermometer's lag over dt seconds
+static inline void
+sensor_step(double* sensor, double actual, double dt){
+  *sensor += (actual - *sensor) / SENSOR_TAU * dt;
+}
+
+// LMT87 typical transfer function (mV at c degrees C)
+static inline double
+lmt87_mv(double c){
+  const double d = c - 30;
+  return 2230.8 - 13.582 * d - 0.00433 * d * d;
+}
+
+// everything at ambient, with the element off
+static inline void
+plant_init(plant* p, double ambient){
+  p->ambient = ambient;
+  p->element = p->chamber = p->sensor = ambient;
+  p->joules = 0;
+}
+
+// advance dt seconds, with the element on or off
+static inline void
+plant_step(plant* p, bool on, double dt){
+  const double pin = on ? heater_watts(p->element, p->ambient) : 0;
+  const double toch = (p->element - p->chamber) * ELEMENT_WK;
+  const double toamb = (p->chamber - p->ambient) * CHAMBER_WK;
+  p->element += (pin - toch) / ELEMENT_JK * dt;
+  p->chamber += (toch - toamb) / CHAMBER_JK * dt;
+  sensor_step(&p->sensor, p->chamber, dt);
+  p->joules += pin * dt;
+}
+
+#endif
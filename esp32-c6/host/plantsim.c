@@ -0,0 +1,280 @@
+// host-side simulation of whole drying runs, faster than real time. the
+// firmware's control code (dry scheduling, heatctl with its PID/SSR window
+// and autotuner, and the LMT87 conversion table) is linked in unchanged,
+// and driven once per control period by a simulated plant, finer than the
+// chamber of plant.h (whose element and thermometer it shares):
+//
+//  * the ceramic element, whose output falls off towards its 230C ceiling,
+//    heating the chamber air by convection that grows with upper fan PWM
+//  * the chamber air (and walls), leaking to ambient, more so with the
+//    lower fan pulling air through the electronics
+//  * the spool, a large thermal mass coupled to the air (better when the
+//    motor turns it), holding water which desorbs at a rate doubling every
+//    10C, taking its latent heat with it
+//  * the LMT87 seen through its thermal lag and ADC noise, and the load
+//    cell seeing the spool plus its remaining water
+//
+// each scenario is a single dry request (setpoint, duration) from a cold
+// chamber at some ambient temperature, optionally preceded by an autotune.
+// we report time to setpoint, overshoot, energy, and water removed, and
+// the simulated hours per wall-clock minute.
+#include "dry.h"
+#include "thermo.h"
+#include "heatctl.h"
+#include "plant.h"
+#include <math.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define DT 0.25           // integration step, s
+#define CONTROL_MS 1000   // firmware control period
+
+#define ELEMENT_WK_STILL 1.0  // element->air with the upper fan off
+#define ELEMENT_WK_FAN 4.0    // additional at full upper fan
+#define AIR_JK 600.0          // air plus the inner walls
+#define AIR_WK_STILL 0.6      // air->ambient with the lower fan off
+#define AIR_WK_FAN 0.6        // additional at full lower fan
+#define SPOOL_JK 1800.0       // 1kg of PLA
+#define SPOOL_WK_STILL 1.5    // air->spool, stationary
+#define SPOOL_WK_TURNING 1.5  // additional with the motor on
+#define SENSOR_NOISE_MV 2.0   // after decimation
+
+#define SPOOL_GRAMS 1000.0
+#define WATER_GRAMS 4.0       // a wet 1kg spool
+#define DESORB_TAU_50C (3 * 3600.0) // water time constant at 50C
+#define LATENT_JG 2260.0
+
+// the firmware only ever runs on PCB 2.2.0+ in simulation
+bool electronics_use_lm35(void){
+  return false;
+}
+
+typedef struct dryplant {
+  double ambient;
+  double element, air, spool;
+  double sensor;          // what the thermometer sees
+  double water;           // grams
+  double joules;
+  unsigned upwm, lpwm;    // 0..255
+  bool motor;
+} dryplant;
+
+typedef struct scenario {
+  unsigned setpoint;
+  unsigned hours;
+  double ambient;
+  unsigned upwm, lpwm;
+  bool autotune;
+} scenario;
+
+typedef struct results {
+  double reached;   // s from dry start, -1 if never
+  double overshoot; // peak air temp beyond setpoint
+  double wh;
+  double water;     // grams removed, per the load cell
+  unsigned switches;
+  int32_t kp, ki;
+} results;
+
+// xorshift-based normal deviates, so runs are reproducible
+static uint64_t Seed = 0x9e3779b97f4a7c15ull;
+
+static double
+uniform(void){
+  Seed ^= Seed << 13;
+  Seed ^= Seed >> 7;
+  Seed ^= Seed << 17;
+  return (Seed >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double
+gaussian(void){
+  double u = uniform();
+  double v = uniform();
+  return sqrt(-2 * log(u + 1e-300)) * cos(2 * M_PI * v);
+}
+
+static void
+dryplant_init(dryplant* p, const scenario* s){
+  memset(p, 0, sizeof(*p));
+  p->ambient = s->ambient;
+  p->element = p->air = p->spool = p->sensor = s->ambient;
+  p->water = WATER_GRAMS;
+  p->upwm = s->upwm;
+  p->lpwm = s->lpwm;
+}
+
+static void
+dryplant_step(dryplant* p, bool heater){
+  const double pin = heater ? heater_watts(p->element, p->ambient) : 0;
+  const double gea = ELEMENT_WK_STILL + ELEMENT_WK_FAN * p->upwm / 255.0;
+  const double gamb = AIR_WK_STILL + AIR_WK_FAN * p->lpwm / 255.0;
+  const double gas = SPOOL_WK_STILL + (p->motor ? SPOOL_WK_TURNING : 0);
+  const double toair = (p->element - p->air) * gea;
+  const double tospool = (p->air - p->spool) * gas;
+  const double toamb = (p->air - p->ambient) * gamb;
+  const double tau = DESORB_TAU_50C / pow(2, (p->spool - 50) / 10);
+  const double dwater = p->water / tau * DT;
+  p->water -= dwater;
+  p->element += (pin - toair) / ELEMENT_JK * DT;
+  p->air += (toair - tospool - toamb) / AIR_JK * DT;
+  p->spool += (tospool * DT - dwater * LATENT_JG) / SPOOL_JK;
+  sensor_step(&p->sensor, p->air, DT);
+  p->joules += pin * DT;
+}
+
+// the LMT87, plus noise, through the firmware's table
+static q8_t
+read_thermometer(const dryplant* p){
+  const double mv = lmt87_mv(p->sensor) + gaussian() * SENSOR_NOISE_MV;
+  return thermo_mv_to_q8(&LMT87Table, lrint(mv));
+}
+
+// run the autotuner to completion from the current (cold) state, leaving
+// the new gains in hc. returns the simulated time taken.
+static double
+run_autotune(dryplant* p, heatctl* hc, unsigned setpoint, int64_t* nowms){
+  const unsigned ctlsteps = CONTROL_MS / 1000.0 / DT;
+  const int64_t startms = *nowms;
+  bool on = false;
+  heatctl_autotune(hc, setpoint, read_thermometer(p), *nowms);
+  for(unsigned s = 0 ; autotune_active_p(&hc->at) ; ++s){
+    if(s % ctlsteps == 0){
+      *nowms += CONTROL_MS;
+      on = heatctl_step(hc, read_thermometer(p), false, 0, *nowms);
+    }
+    dryplant_step(p, on);
+  }
+  // let the chamber cool back down to ambient before drying
+  while(p->air - p->ambient > 1 || p->element - p->ambient > 1){
+    for(unsigned s = 0 ; s < ctlsteps ; ++s){
+      dryplant_step(p, false);
+    }
+    *nowms += CONTROL_MS;
+  }
+  hc->tuned = false;
+  return (*nowms - startms) / 1000.0;
+}
+
+static results
+simulate(const scenario* sc){
+  dryplant p;
+  dryplant_init(&p, sc);
+  results r = { .reached = -1, };
+  heatctl hc;
+  heatctl_init(&hc);
+  drysched dry = { 0, 0 };
+  // as on the device, the clock is never 0
+  int64_t nowms = CONTROL_MS;
+  const unsigned ctlsteps = CONTROL_MS / 1000.0 / DT;
+  if(sc->autotune){
+    run_autotune(&p, &hc, sc->setpoint, &nowms);
+    p.joules = 0;
+  }
+  r.kp = hc.pid.kp;
+  r.ki = hc.pid.ki;
+  if(dry_schedule(&dry, sc->hours * 3600, sc->setpoint, nowms * 1000)){
+    fprintf(stderr, "invalid dry temperature %u\n", sc->setpoint);
+    exit(EXIT_FAILURE);
+  }
+  const int64_t startms = nowms;
+  const double startwater = p.water;
+  double peak = 0;
+  bool on = false;
+  p.motor = true;
+  while(dry_active_p(&dry)){
+    nowms += CONTROL_MS;
+    if(dry_expired(&dry, nowms * 1000)){
+      p.motor = false;
+    }
+    q8_t meas = read_thermometer(&p);
+    bool was = on;
+    on = heatctl_step(&hc, meas, dry_active_p(&dry), dry.targtemp, nowms);
+    r.switches += was != on;
+    for(unsigned s = 0 ; s < ctlsteps ; ++s){
+      dryplant_step(&p, on);
+    }
+    if(r.reached < 0){
+      if(p.air >= sc->setpoint){
+        r.reached = (nowms - startms) / 1000.0;
+      }
+    }else if(p.air > peak){
+      peak = p.air;
+    }
+  }
+  r.overshoot = r.reached < 0 ? 0 : peak - sc->setpoint;
+  r.wh = p.joules / 3600;
+  r.water = startwater - p.water;
+  return r;
+}
+
+static double
+wallclock(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+usage(const char* argv0){
+  fprintf(stderr, "usage: %s [ -a ] [ -h hours ] [ -r repeats ]\n", argv0);
+  fprintf(stderr, " -a: autotune before each dry\n");
+  fprintf(stderr, " -h: hours per dry (default 8)\n");
+  fprintf(stderr, " -r: repeat the scenario grid (default 1), for throughput\n");
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char** argv){
+  bool autotune = false;
+  unsigned hours = 8;
+  unsigned repeats = 1;
+  int c;
+  while((c = getopt(argc, argv, "ah:r:")) != -1){
+    switch(c){
+      case 'a': autotune = true; break;
+      case 'h': hours = strtoul(optarg, NULL, 10); break;
+      case 'r': repeats = strtoul(optarg, NULL, 10); break;
+      default: usage(argv[0]);
+    }
+  }
+  if(optind != argc || hours == 0 || repeats == 0){
+    usage(argv[0]);
+  }
+  const unsigned setpoints[] = { 50, 65, 80 };
+  const double ambients[] = { 15, 25, 35 };
+  const unsigned fans[][2] = { { 255, 64 }, { 128, 128 } }; // upper, lower
+  double simhours = 0;
+  const double start = wallclock();
+  printf("  set  amb upwm lpwm   reached overshoot       Wh  water(g)  kp       ki\n");
+  for(unsigned rep = 0 ; rep < repeats ; ++rep){
+    for(unsigned i = 0 ; i < sizeof(setpoints) / sizeof(*setpoints) ; ++i){
+      for(unsigned j = 0 ; j < sizeof(ambients) / sizeof(*ambients) ; ++j){
+        for(unsigned k = 0 ; k < sizeof(fans) / sizeof(*fans) ; ++k){
+          scenario sc = {
+            .setpoint = setpoints[i],
+            .hours = hours,
+            .ambient = ambients[j],
+            .upwm = fans[k][0],
+            .lpwm = fans[k][1],
+            .autotune = autotune,
+          };
+          results r = simulate(&sc);
+          simhours += hours;
+          if(rep == 0){
+            printf("%4uC %3.0fC %4u %4u %8.0fs %8.2fC %8.1f %9.2f %7.2f %7.3f\n",
+                   sc.setpoint, sc.ambient, sc.upwm, sc.lpwm, r.reached,
+                   r.overshoot, r.wh, r.water, q8_to_float(r.kp), q8_to_float(r.ki));
+          }
+        }
+      }
+    }
+  }
+  const double elapsed = wallclock() - start;
+  printf("simulated %.0f drying hours in %.3fs (%.0f hours/minute)\n",
+         simhours, elapsed, simhours / elapsed * 60);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,131 @@
+#include "autotune.h"
+#include <math.h>
+
+#define RELAY_HYSTERESIS (Q8_ONE / 2) // beyond our thermometer's noise
+#define RELAY_SKIP 1                  // cycles discarded as transient
+#define RELAY_MEASURE 3               // cycles measured
+#define RELAY_HALF_DUTY 500.0f        // half the permille output swing
+#define MAX_OVERSHOOT (15 * Q8_ONE)   // abort if we go this far over
+#define MAX_DURATION_MS (4 * 3600 * 1000ll)
+
+void autotune_start(autotune* at, q8_t setpoint, q8_t baseline, int64_t nowms){
+  *at = (autotune){
+    .state = AUTOTUNE_HEATING,
+    .setpoint = setpoint,
+    .baseline = baseline,
+    .on = true,
+    .startms = nowms,
+    .lastms = nowms,
+  };
+}
+
+void autotune_abort(autotune* at){
+  at->state = AUTOTUNE_FAILED;
+  at->on = false;
+}
+
+bool autotune_active_p(const autotune* at){
+  return at->state == AUTOTUNE_HEATING || at->state == AUTOTUNE_RELAY;
+}
+
+const char* autotune_state_str(autotune_state s){
+  switch(s){
+    case AUTOTUNE_IDLE: return "idle";
+    case AUTOTUNE_HEATING: return "heating";
+    case AUTOTUNE_RELAY: return "relay";
+    case AUTOTUNE_DONE: return "done";
+    case AUTOTUNE_FAILED: return "failed";
+  }
+  return "unknown";
+}
+
+// fit the FOPDT model to the measured limit cycle, and derive gains
+static void
+autotune_finish(autotune* at){
+  const float amp = at->sumamp / (float)RELAY_MEASURE / Q8_ONE;
+  const float tu = at->sumperiodms / (float)RELAY_MEASURE / 1000;
+  if(amp <= 0 || tu <= 0 || at->integu <= 0){
+    autotune_abort(at);
+    return;
+  }
+  // describing function of an ideal relay
+  const float ku = 4 * RELAY_HALF_DUTY / (M_PI * amp);
+  const float w = 2 * M_PI / tu;
+  const float k = at->integy / (float)Q8_ONE / at->integu;
+  if(k * ku <= 1){
+    autotune_abort(at);
+    return;
+  }
+  // |G(jw)| = K / sqrt(1 + (wT)^2) = 1 / Ku, arg G(jw) = -wL - atan(wT) = -pi
+  const float t = sqrtf(k * ku * k * ku - 1) / w;
+  const float l = (M_PI - atanf(w * t)) / w;
+  if(l <= 0){
+    autotune_abort(at);
+    return;
+  }
+  // SIMC PI with the closed loop time constant equal to the dead time
+  const float kc = t / (k * 2 * l);
+  const float ti = t < 8 * l ? t : 8 * l;
+  at->k = k;
+  at->l = l;
+  at->t = t;
+  at->ku = ku;
+  at->tu = tu;
+  at->kp = q8_from_float(kc);
+  at->ki = q8_from_float(kc / ti);
+  at->on = false;
+  at->state = AUTOTUNE_DONE;
+}
+
+bool autotune_update(autotune* at, q8_t temp, int64_t nowms){
+  if(!autotune_active_p(at)){
+    return false;
+  }
+  if(temp > at->setpoint + MAX_OVERSHOOT || nowms - at->startms > MAX_DURATION_MS){
+    autotune_abort(at);
+    return false;
+  }
+  const int64_t dt = nowms - at->lastms;
+  at->lastms = nowms;
+  if(at->state == AUTOTUNE_HEATING){
+    if(temp > at->setpoint + RELAY_HYSTERESIS){
+      at->state = AUTOTUNE_RELAY;
+      at->on = false;
+      at->cyclems = 0;
+    }
+    return at->on;
+  }
+  // the integrals cover only the measured cycles
+  if(at->cycles >= RELAY_SKIP && at->cyclems){
+    at->integy += (int64_t)(temp - at->baseline) * dt;
+    at->integu += at->on ? 1000 * dt : 0;
+  }
+  if(temp > at->hi){
+    at->hi = temp;
+  }
+  if(temp < at->lo){
+    at->lo = temp;
+  }
+  if(at->on){
+    if(temp > at->setpoint + RELAY_HYSTERESIS){
+      at->on = false;
+    }
+  }else if(temp < at->setpoint - RELAY_HYSTERESIS){
+    // an on transition completes one cycle and starts the next
+    at->on = true;
+    if(at->cyclems){
+      if(at->cycles++ >= RELAY_SKIP){
+        at->sumperiodms += nowms - at->cyclems;
+        at->sumamp += (at->hi - at->lo) / 2;
+        if(at->cycles == RELAY_SKIP + RELAY_MEASURE){
+          autotune_finish(at);
+          return at->on;
+        }
+      }
+    }
+    at->cyclems = nowms;
+    at->hi = temp;
+    at->lo = temp;
+  }
+  return at->on;
+}
@@ -0,0 +1,59 @@
+#ifndef DANKDRYER_AUTOTUNE
+#define DANKDRYER_AUTOTUNE
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "fixedpoint.h"
+
+// relay-feedback (Astrom-Hagglund) autotuning of the heater. starting from
+// a chamber at equilibrium with the heater off, we heat to the setpoint,
+// then switch the heater fully on below setpoint - hysteresis and fully off
+// above setpoint + hysteresis. this drives the chamber into a limit cycle
+// whose period and amplitude give the ultimate gain Ku and period Tu. the
+// ratio of mean temperature rise to mean duty over the measured cycles
+// gives the static gain K. from these we fit a first-order-plus-dead-time
+// model (K, L, T), and derive PI gains from it using the SIMC rules.
+typedef enum {
+  AUTOTUNE_IDLE,
+  AUTOTUNE_HEATING,  // initial heating to setpoint
+  AUTOTUNE_RELAY,    // relay oscillation
+  AUTOTUNE_DONE,     // results are valid
+  AUTOTUNE_FAILED,
+} autotune_state;
+
+typedef struct autotune {
+  autotune_state state;
+  q8_t setpoint, baseline;
+  bool on;
+  int64_t startms, lastms;
+  int64_t cyclems;      // start of the current cycle (last on transition)
+  unsigned cycles;      // relay cycles completed
+  q8_t hi, lo;          // extrema within the current cycle
+  // accumulated over measured cycles
+  int64_t sumperiodms;
+  int64_t sumamp;       // Q8 C
+  int64_t integy;       // Q8 C * ms, relative to baseline
+  int64_t integu;       // permille * ms
+  // results, valid in AUTOTUNE_DONE. floats are fine here; this is done
+  // once, not in the loop.
+  float k;              // C per permille of duty
+  float l, t;           // dead time and time constant, seconds
+  float ku, tu;         // ultimate gain (permille per C) and period (s)
+  int32_t kp, ki;       // Q8 PI gains, in pid.h units
+} autotune;
+
+// begin tuning around setpoint. baseline is the current (equilibrium)
+// chamber temperature.
+void autotune_start(autotune* at, q8_t setpoint, q8_t baseline, int64_t nowms);
+
+// stop tuning, leaving the state FAILED
+void autotune_abort(autotune* at);
+
+// feed a new measurement. returns whether the heater ought be on.
+bool autotune_update(autotune* at, q8_t temp, int64_t nowms);
+
+bool autotune_active_p(const autotune* at);
+
+const char* autotune_state_str(autotune_state s);
+
+#endif
@@ -0,0 +1,72 @@
+#include "batch.h"
+#include "heater.h"
+#include "weight.h"
+
+// invalid temperatures, in the ring
+#define RING_INVALID INT16_MIN
+
+// keep every other sample of a full ring, starting with the oldest, so
+// that the one about to be pushed follows the newest kept at the new
+// stride
+static void
+thin(batch_ring* r){
+  for(unsigned i = 0 ; i < BATCH_MAX / 2 ; ++i){
+    r->s[(r->head + i) % BATCH_MAX] = r->s[(r->head + i * 2) % BATCH_MAX];
+  }
+  r->count = BATCH_MAX / 2;
+  ++r->shift;
+}
+
+void batch_ring_push(batch_ring* r, const batch_sample* s){
+  if(++r->skipped < (1u << r->shift)){
+    return;
+  }
+  r->skipped = 0;
+  if(r->count == BATCH_MAX && r->shift < BATCH_MAX_SHIFT){
+    thin(r);
+  }
+  const unsigned idx = (r->head + r->count) % BATCH_MAX;
+  if(r->count == BATCH_MAX){
+    r->head = (r->head + 1) % BATCH_MAX;
+    ++r->dropped;
+  }else{
+    ++r->count;
+  }
+  r->s[idx].ms = s->stamp / 1000;
+  r->s[idx].utemp = temp_valid_p(s->utemp) ? q8_to_tenths(s->utemp) : RING_INVALID;
+  r->s[idx].ltemp = temp_valid_p(s->ltemp) ? q8_to_tenths(s->ltemp) : RING_INVALID;
+  r->s[idx].weight = weight_valid_p(s->weight) ? q8_round(s->weight) : BATCH_INVALID;
+  r->s[idx].hduty = s->hduty;
+  r->lastus = s->stamp;
+}
+
+static inline int32_t
+widen_temp(int16_t t){
+  return t == RING_INVALID ? BATCH_INVALID : t;
+}
+
+void batch_ring_drain(batch_ring* r, batch* b){
+  b->n = r->count;
+  b->dropped = r->dropped;
+  b->t0ms = 0;
+  uint32_t prevms = 0;
+  for(unsigned i = 0 ; i < r->count ; ++i){
+    const unsigned idx = (r->head + i) % BATCH_MAX;
+    // the millisecond stamps wrap every ~49 days; their differences don't
+    b->dtms[i] = i ? (int32_t)(r->s[idx].ms - prevms) : 0;
+    prevms = r->s[idx].ms;
+    b->utemp[i] = widen_temp(r->s[idx].utemp);
+    b->ltemp[i] = widen_temp(r->s[idx].ltemp);
+    b->mass[i] = r->s[idx].weight;
+    b->hduty[i] = r->s[idx].hduty;
+  }
+  if(r->count){
+    const uint32_t spanms = prevms - r->s[r->head].ms;
+    b->t0ms = r->lastus / 1000 - spanms;
+  }
+  r->head = 0;
+  r->count = 0;
+  r->shift = 0;
+  r->skipped = 0;
+  r->dropped = 0;
+}
@@ -0,0 +1,70 @@
+#ifndef DANKDRYER_BATCH
+#define DANKDRYER_BATCH
+
+// 1Hz samples of the chamber, accumulated between publications so that
+// each one carries the full curves rather than a single snapshot. samples
+// are kept compactly in a ring, and drained into columns (a base timestamp
+// and per-sample deltas, plus one array per quantity) for rendering. the
+// sampler and the publisher share a ring, so callers provide the locking.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "fixedpoint.h"
+
+// samples held between publications. this is less than the longer
+// publication intervals (IDLE and the heartbeat can run to an hour), so
+// rather than overwriting its oldest samples, a full ring is thinned to
+// every other one, and thereafter keeps every other sample pushed. each
+// publication thus carries the whole interval since the last, at 1Hz for
+// short intervals and more coarsely for long ones. after BATCH_MAX_SHIFT
+// thinnings, the ring spans BATCH_MAX << BATCH_MAX_SHIFT pushes (more than
+// the longest interval), and only then are samples overwritten.
+#define BATCH_MAX 32
+#define BATCH_MAX_SHIFT 7
+
+// column values which were invalid when sampled
+#define BATCH_INVALID INT32_MIN
+
+typedef struct batch_sample {
+  int64_t stamp;      // hal_now_us()
+  q8_t utemp, ltemp;  // MIN_TEMP - 1 if invalid
+  q8_t weight;        // negative if invalid
+  uint32_t hduty;     // permille
+} batch_sample;
+
+// the ring as stored, 16 bytes per sample. a zeroed ring is empty.
+typedef struct batch_ring {
+  struct {
+    uint32_t ms;      // low bits of the timestamp; only deltas are used
+    int16_t utemp, ltemp;
+    int32_t weight;
+    uint16_t hduty;
+  } s[BATCH_MAX];
+  int64_t lastus;     // stamp of the newest sample
+  unsigned head, count;
+  unsigned shift;     // every (1 << shift)th sample pushed is kept
+  unsigned skipped;   // pushes since the last one kept
+  uint32_t dropped;   // overwritten before being drained
+} batch_ring;
+
+// a drained ring. temperatures are in tenths of a degree, and mass in the
+// units of the load cell, rounded.
+typedef struct batch {
+  unsigned n;
+  uint32_t dropped;
+  int64_t t0ms;               // of the first sample
+  int32_t dtms[BATCH_MAX];    // from the previous sample (0 for the first)
+  int32_t utemp[BATCH_MAX];
+  int32_t ltemp[BATCH_MAX];
+  int32_t mass[BATCH_MAX];
+  int32_t hduty[BATCH_MAX];
+} batch;
+
+// append a sample, thinning the ring if it's full (or overwriting the
+// oldest, if it's been thinned BATCH_MAX_SHIFT times)
+void batch_ring_push(batch_ring* r, const batch_sample* s);
+
+// move all samples into b, in order, emptying the ring
+void batch_ring_drain(batch_ring* r, batch* b);
+
+#endif
@@ -0,0 +1,226 @@
+#include "cborw.h"
+#include <string.h>
+
+// major types
+#define CBOR_UINT 0u
+#define CBOR_NINT 1u
+#define CBOR_TEXT 3u
+#define CBOR_ARRAY 4u
+#define CBOR_MAP 5u
+#define CBOR_SIMPLE 7u
+
+#define CBOR_INDEFINITE 31u
+#define CBOR_HALF 25u
+#define CBOR_SINGLE 26u
+#define CBOR_NULL 22u
+
+static void
+put(cborw* c, const void* s, size_t slen){
+  if(c->overflow){
+    return;
+  }
+  if(c->len - c->used < slen){
+    c->overflow = true;
+    return;
+  }
+  memcpy(c->buf + c->used, s, slen);
+  c->used += slen;
+}
+
+static inline void
+put_byte(cborw* c, uint8_t b){
+  put(c, &b, 1);
+}
+
+// big-endian, as CBOR requires
+static void
+put_be(cborw* c, uint64_t v, unsigned bytes){
+  uint8_t b[8];
+  for(unsigned i = 0 ; i < bytes ; ++i){
+    b[i] = v >> (8 * (bytes - 1 - i));
+  }
+  put(c, b, bytes);
+}
+
+// the initial byte and argument of a data item, in the shortest form
+static void
+head(cborw* c, unsigned major, uint64_t arg){
+  const uint8_t m = major << 5u;
+  if(arg < 24){
+    put_byte(c, m | arg);
+  }else if(arg <= UINT8_MAX){
+    put_byte(c, m | 24u);
+    put_be(c, arg, 1);
+  }else if(arg <= UINT16_MAX){
+    put_byte(c, m | 25u);
+    put_be(c, arg, 2);
+  }else if(arg <= UINT32_MAX){
+    put_byte(c, m | 26u);
+    put_be(c, arg, 4);
+  }else{
+    put_byte(c, m | 27u);
+    put_be(c, arg, 8);
+  }
+}
+
+// round v right by 'shift' bits, to nearest, ties to even
+static uint32_t
+round_shift(uint32_t v, unsigned shift){
+  if(shift == 0){
+    return v;
+  }
+  if(shift > 31){
+    return 0;
+  }
+  const uint32_t r = v >> shift;
+  const uint32_t rem = v & ((1u << shift) - 1);
+  const uint32_t half = 1u << (shift - 1);
+  return r + (rem > half || (rem == half && (r & 1u)));
+}
+
+// IEEE 754 binary32 to binary16, rounding to nearest even. rounding can
+// carry into the exponent, which does the right thing (including overflow
+// to infinity).
+static uint16_t
+single_to_half(uint32_t f){
+  const uint16_t sign = (f >> 16) & 0x8000u;
+  const int exp = (f >> 23) & 0xff;
+  const uint32_t mant = f & 0x7fffffu;
+  if(exp == 0xff){
+    return sign | 0x7c00u | (mant ? 0x200u : 0);
+  }
+  const int e = exp - 127 + 15;
+  if(e >= 0x1f){
+    return sign | 0x7c00u;
+  }
+  if(e <= 0){ // subnormal, or zero
+    if(exp == 0){
+      return sign;
+    }
+    return sign | round_shift(mant | 0x800000u, 14 - e);
+  }
+  return sign | round_shift(((uint32_t)e << 23) | mant, 13);
+}
+
+static uint32_t
+half_to_single(uint16_t h){
+  const uint32_t sign = (uint32_t)(h & 0x8000u) << 16;
+  int exp = (h >> 10) & 0x1f;
+  uint32_t mant = h & 0x3ffu;
+  if(exp == 0x1f){
+    return sign | 0x7f800000u | (mant << 13);
+  }
+  if(exp == 0){
+    if(mant == 0){
+      return sign;
+    }
+    exp = 1;
+    while(!(mant & 0x400u)){
+      mant <<= 1;
+      --exp;
+    }
+    mant &= 0x3ffu;
+  }
+  return sign | ((uint32_t)(exp + 112) << 23) | (mant << 13);
+}
+
+// a Q8 value as binary32 bits, rounding to nearest even past 24 bits
+static uint32_t
+q8_to_single(q8_t v){
+  const uint32_t sign = v < 0 ? 0x80000000u : 0;
+  uint32_t a = v < 0 ? -(uint32_t)v : (uint32_t)v;
+  if(a == 0){
+    return 0;
+  }
+  int msb = 31 - __builtin_clz(a);
+  if(msb > 23){
+    a = round_shift(a, msb - 23);
+    if(a >> 24){
+      a >>= 1;
+      ++msb;
+    }
+  }else{
+    a <<= 23 - msb;
+  }
+  // the leading bit is implicit; the value is scaled by 2^-8
+  return sign | ((uint32_t)(msb - 8 + 127) << 23) | (a & 0x7fffffu);
+}
+
+static void
+put_single(cborw* c, uint32_t f, bool lossyhalf){
+  const uint16_t h = single_to_half(f);
+  if(lossyhalf || half_to_single(h) == f){
+    put_byte(c, (CBOR_SIMPLE << 5u) | CBOR_HALF);
+    put_be(c, h, 2);
+  }else{
+    put_byte(c, (CBOR_SIMPLE << 5u) | CBOR_SINGLE);
+    put_be(c, f, 4);
+  }
+}
+
+void cborw_begin(cborw* c, void* buf, size_t len){
+  c->buf = buf;
+  c->len = len;
+  c->used = 0;
+  c->overflow = false;
+  put_byte(c, (CBOR_MAP << 5u) | CBOR_INDEFINITE);
+}
+
+static void
+put_int(cborw* c, int64_t v){
+  if(v < 0){
+    head(c, CBOR_NINT, -(uint64_t)(v + 1));
+  }else{
+    head(c, CBOR_UINT, v);
+  }
+}
+
+void cborw_int(cborw* c, unsigned key, int64_t v){
+  head(c, CBOR_UINT, key);
+  put_int(c, v);
+}
+
+void cborw_float(cborw* c, unsigned key, float v){
+  uint32_t f;
+  memcpy(&f, &v, sizeof(f));
+  head(c, CBOR_UINT, key);
+  put_single(c, f, false);
+}
+
+void cborw_q8(cborw* c, unsigned key, q8_t v){
+  head(c, CBOR_UINT, key);
+  put_single(c, q8_to_single(v), false);
+}
+
+void cborw_q8_half(cborw* c, unsigned key, q8_t v){
+  head(c, CBOR_UINT, key);
+  put_single(c, q8_to_single(v), true);
+}
+
+void cborw_str(cborw* c, unsigned key, const char* s){
+  const size_t slen = strlen(s);
+  head(c, CBOR_UINT, key);
+  head(c, CBOR_TEXT, slen);
+  put(c, s, slen);
+}
+
+void cborw_ints(cborw* c, unsigned key, const int32_t* v, size_t n,
+                int32_t nullval){
+  head(c, CBOR_UINT, key);
+  head(c, CBOR_ARRAY, n);
+  for(size_t i = 0 ; i < n ; ++i){
+    if(v[i] == nullval){
+      put_byte(c, (CBOR_SIMPLE << 5u) | CBOR_NULL);
+    }else{
+      put_int(c, v[i]);
+    }
+  }
+}
+
+int cborw_end(cborw* c){
+  put_byte(c, 0xffu); // break
+  if(c->overflow){
+    return -1;
+  }
+  return c->used;
+}
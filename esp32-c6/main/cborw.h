@@ -0,0 +1,43 @@
+#ifndef DANKDRYER_CBORW
+#define DANKDRYER_CBORW
+
+// a streaming writer of CBOR (RFC 8949) maps into a caller-supplied buffer,
+// the binary sibling of jsonw. it never allocates, and never touches
+// floating point arithmetic (we have no FPU). only flat maps with small
+// unsigned integer keys (whose values may be arrays of integers) are
+// supported, which is all we publish. the map is
+// of indefinite length, so members needn't be counted ahead of time. once
+// the buffer is exhausted, further writes are dropped, and cborw_end()
+// reports the failure.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "fixedpoint.h"
+
+typedef struct cborw {
+  uint8_t* buf;
+  size_t len;       // bytes available in buf
+  size_t used;      // bytes written
+  bool overflow;
+} cborw;
+
+void cborw_begin(cborw* c, void* buf, size_t len);
+void cborw_int(cborw* c, unsigned key, int64_t v);
+// v as a half-precision float if that is exact, otherwise single precision
+void cborw_float(cborw* c, unsigned key, float v);
+// a Q8 value as a half-precision float if that is exact, otherwise single
+// precision (exact for magnitudes below 65536)
+void cborw_q8(cborw* c, unsigned key, q8_t v);
+// a Q8 value rounded to half precision (a resolution of 1/16 up to 128,
+// and 1/8 up to 256), for when that is all the precision it has
+void cborw_q8_half(cborw* c, unsigned key, q8_t v);
+void cborw_str(cborw* c, unsigned key, const char* s);
+// an array of n integers, where any equal to nullval are written as null
+void cborw_ints(cborw* c, unsigned key, const int32_t* v, size_t n,
+                int32_t nullval);
+
+// close the map. returns its length, or -1 if buf was too small.
+int cborw_end(cborw* c);
+
+#endif
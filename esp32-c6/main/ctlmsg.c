@@ -0,0 +1,292 @@
+#include "ctlmsg.h"
+#include "telemetry.h"
+#include <ctype.h>
+#include <string.h>
+#include <strings.h>
+#include <esp_log.h>
+
+#define TAG "ctlmsg"
+
+// indexed by ctlchan; checked in this order, as we always have
+static const struct {
+  const char* topic;
+  size_t len;
+} Channels[CTLCHAN_UNKNOWN] = {
+#define CHAN(t) { t, sizeof(t) - 1 }
+  CHAN(DRY_CHANNEL),
+  CHAN(AUTOTUNE_CHANNEL),
+  CHAN(MOTOR_CHANNEL),
+  CHAN(HEATER_CHANNEL),
+  CHAN(LPWM_CHANNEL),
+  CHAN(UPWM_CHANNEL),
+  CHAN(TARE_CHANNEL),
+  CHAN(OTA_CHANNEL),
+  CHAN(CALIBRATE_CHANNEL),
+  CHAN(FACTORYRESET_CHANNEL),
+  CHAN(TELEMETRY_CHANNEL),
+  CHAN(HEARTBEAT_CHANNEL),
+  CHAN(RATES_CHANNEL),
+  CHAN(STREAM_CHANNEL),
+  CHAN(CTLPERIOD_CHANNEL),
+  CHAN(LOADCELL_CHANNEL),
+#undef CHAN
+};
+
+ctlchan ctlmsg_channel(const char* topic, size_t tlen){
+  for(unsigned c = 0 ; c < CTLCHAN_UNKNOWN ; ++c){
+    if(tlen == Channels[c].len && memcmp(topic, Channels[c].topic, tlen) == 0){
+      return c;
+    }
+  }
+  return CTLCHAN_UNKNOWN;
+}
+
+// precondition: isxdigit(c) is true
+static inline char
+get_hex(char c){
+  if(isdigit(c)){
+    return c - '0';
+  }
+  c = tolower(c);
+  return c - 'a' + 10;
+}
+
+// FIXME ignore whitespace
+// check if data (dlen bytes, no terminator) equals n, returning true
+// if it does, and false otherwise.
+static bool
+strarg_match_p(const char* data, size_t dlen, const char* n){
+  if(dlen != strlen(n)){
+    return false;
+  }
+  return strncasecmp(data, n, dlen) ? false : true;
+}
+
+int extract_bool(const char* data, size_t dlen, bool* val){
+  if(strarg_match_p(data, dlen, "on") || strarg_match_p(data, dlen, "yes") ||
+      strarg_match_p(data, dlen, "true") || strarg_match_p(data, dlen, "1")){
+    *val = true;
+    return 0;
+  }
+  if(strarg_match_p(data, dlen, "off") || strarg_match_p(data, dlen, "no") ||
+      strarg_match_p(data, dlen, "false") || strarg_match_p(data, dlen, "0")){
+    *val = false;
+    return 0;
+  }
+  ESP_LOGE(TAG, "not a bool: [%.*s]", (int)dlen, data);
+  return -1;
+}
+
+// FIXME handle base 10 numbers as well (can we use strtoul?)
+int extract_pwm(const char* data, size_t dlen){
+  if(dlen != 2){
+    ESP_LOGE(TAG, "pwm wasn't 2 characters");
+    return -1;
+  }
+  char h = data[0];
+  char l = data[1];
+  if(!isxdigit(h) || !isxdigit(l)){
+    ESP_LOGE(TAG, "invalid hex character");
+    return -1;
+  }
+  char hb = get_hex(h);
+  char lb = get_hex(l);
+  // everything was valid
+  int pwm = hb * 16 + lb;
+  ESP_LOGD(TAG, "got pwm value: %d", pwm);
+  return pwm;
+}
+
+int parse_dry_req(const char* payload, size_t plen, unsigned* temp,
+                  unsigned* seconds){
+  size_t idx = 0;
+  enum {
+    PRESPACE,
+    TEMP,
+    SLASH,
+    SECONDS,
+    POSTSPACE
+  } state = PRESPACE;
+  *seconds = 0;
+  *temp = 0;
+  // FIXME need address wrapping of temp and/or seconds
+  while(idx < plen){
+    ESP_LOGD(TAG, "payload[%zu] = 0x%02x state: %d temp: %u", idx, payload[idx], state, *temp);
+    unsigned char c = payload[idx];
+    if(c >= 0x80 || c == 0){ // invalid character
+      goto err;
+    }
+    switch(state){
+      case PRESPACE:
+        if(!isspace(c)){
+          if(isdigit(c)){
+            state = TEMP;
+            *temp = c - '0';
+          }else{
+            goto err;
+          }
+        }
+        break;
+      case TEMP:
+        if(isdigit(c)){
+          *temp *= 10;
+          *temp += c - '0';
+        }else if(c == '/'){
+          state = SLASH;
+        }else{
+          goto err;
+        }
+        break;
+      case SLASH:
+        if(isdigit(c)){
+          *seconds = c - '0';
+          state = SECONDS;
+        }else{
+          goto err;
+        }
+        break;
+      case SECONDS:
+        if(isdigit(c)){
+          *seconds *= 10;
+          *seconds += c - '0';
+        }else if(isspace(c)){
+          state = POSTSPACE;
+        }else{
+          goto err;
+        }
+        break;
+      case POSTSPACE:
+        if(!isspace(c)){
+          goto err;
+        }
+        break;
+    }
+    ++idx;
+  }
+  return 0;
+
+err:
+  ESP_LOGE(TAG, "invalid dry payload [%.*s]", (int)plen, payload);
+  return -1;
+}
+
+// up to maxdigits digits at *idx, advancing it past them
+static int
+take_uint(const char* payload, size_t plen, size_t* idx, unsigned maxdigits, unsigned* val){
+  size_t digits = 0;
+  *val = 0;
+  while(*idx < plen && isdigit((unsigned char)payload[*idx]) && digits < maxdigits){
+    *val = *val * 10 + payload[*idx] - '0';
+    ++digits;
+    ++*idx;
+  }
+  return digits ? 0 : -1;
+}
+
+// an unsigned integer of up to maxdigits digits, with optional leading and
+// trailing space
+static int
+parse_padded_uint(const char* payload, size_t plen, unsigned maxdigits, unsigned* val){
+  size_t idx = 0;
+  while(idx < plen && isspace((unsigned char)payload[idx])){
+    ++idx;
+  }
+  if(take_uint(payload, plen, &idx, maxdigits, val)){
+    return -1;
+  }
+  while(idx < plen && isspace((unsigned char)payload[idx])){
+    ++idx;
+  }
+  return idx == plen ? 0 : -1;
+}
+
+int parse_autotune_req(const char* payload, size_t plen, unsigned* temp){
+  if(parse_padded_uint(payload, plen, 4, temp)){
+    ESP_LOGE(TAG, "invalid autotune payload [%.*s]", (int)plen, payload);
+    return -1;
+  }
+  return 0;
+}
+
+int parse_telemetry_fmt(const char* payload, size_t plen){
+  if(strarg_match_p(payload, plen, "json")){
+    return TELEMETRY_FMT_JSON;
+  }
+  if(strarg_match_p(payload, plen, "cbor")){
+    return TELEMETRY_FMT_CBOR;
+  }
+  if(strarg_match_p(payload, plen, "both")){
+    return TELEMETRY_FMT_JSON | TELEMETRY_FMT_CBOR;
+  }
+  ESP_LOGE(TAG, "invalid telemetry format [%.*s]", (int)plen, payload);
+  return -1;
+}
+
+int parse_heartbeat_req(const char* payload, size_t plen, unsigned* seconds){
+  if(parse_padded_uint(payload, plen, 5, seconds)){
+    ESP_LOGE(TAG, "invalid heartbeat payload [%.*s]", (int)plen, payload);
+    return -1;
+  }
+  return 0;
+}
+
+// fcount slash-separated fields of up to maxdigits digits, with optional
+// leading and trailing space
+static int
+parse_uint_fields(const char* payload, size_t plen, unsigned* const* fields,
+                  size_t fcount, unsigned maxdigits){
+  size_t idx = 0;
+  while(idx < plen && isspace((unsigned char)payload[idx])){
+    ++idx;
+  }
+  for(size_t f = 0 ; f < fcount ; ++f){
+    if(take_uint(payload, plen, &idx, maxdigits, fields[f])){
+      return -1;
+    }
+    if(f + 1 < fcount){
+      if(idx == plen || payload[idx] != '/'){
+        return -1;
+      }
+      ++idx;
+    }
+  }
+  while(idx < plen && isspace((unsigned char)payload[idx])){
+    ++idx;
+  }
+  return idx == plen ? 0 : -1;
+}
+
+int parse_rates_req(const char* payload, size_t plen, telemetry_rates* r){
+  unsigned* const fields[] = { &r->fastsec, &r->activesec, &r->idlesec, &r->endingsec, };
+  if(parse_uint_fields(payload, plen, fields, sizeof(fields) / sizeof(*fields), 5)){
+    ESP_LOGE(TAG, "invalid rates payload [%.*s]", (int)plen, payload);
+    return -1;
+  }
+  return 0;
+}
+
+int parse_stream_req(const char* payload, size_t plen, unsigned* maxsubs){
+  if(parse_padded_uint(payload, plen, 2, maxsubs)){
+    ESP_LOGE(TAG, "invalid stream payload [%.*s]", (int)plen, payload);
+    return -1;
+  }
+  return 0;
+}
+
+int parse_ctlperiod_req(const char* payload, size_t plen, unsigned* ms){
+  if(parse_padded_uint(payload, plen, 5, ms)){
+    ESP_LOGE(TAG, "invalid control period payload [%.*s]", (int)plen, payload);
+    return -1;
+  }
+  return 0;
+}
+
+int parse_loadcell_req(const char* payload, size_t plen, unsigned* sps,
+                       unsigned* gain, unsigned* median, unsigned* ema){
+  unsigned* const fields[] = { sps, gain, median, ema, };
+  if(parse_uint_fields(payload, plen, fields, sizeof(fields) / sizeof(*fields), 3)){
+    ESP_LOGE(TAG, "invalid loadcell payload [%.*s]", (int)plen, payload);
+    return -1;
+  }
+  return 0;
+}
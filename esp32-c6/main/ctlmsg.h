@@ -0,0 +1,94 @@
+#ifndef DANKDRYER_CTLMSG
+#define DANKDRYER_CTLMSG
+
+// the MQTT control topics, and parsing of their payloads. the MQTT event
+// handler dispatches on ctlmsg_channel(), and acts on the parsed values.
+// payloads are not NUL-terminated.
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "version.h"
+#include "telemetry.h"
+
+#define CCHAN "control/"
+#define MOTOR_CHANNEL CCHAN DEVICE "/motor"
+#define HEATER_CHANNEL CCHAN DEVICE "/heater"
+#define LPWM_CHANNEL CCHAN DEVICE "/lpwm"
+#define UPWM_CHANNEL CCHAN DEVICE "/upwm"
+#define OTA_CHANNEL CCHAN DEVICE "/ota"
+#define DRY_CHANNEL CCHAN DEVICE "/dry"
+#define AUTOTUNE_CHANNEL CCHAN DEVICE "/autotune"
+#define TARE_CHANNEL CCHAN DEVICE "/tare"
+#define CALIBRATE_CHANNEL CCHAN DEVICE "/calibrate"
+#define FACTORYRESET_CHANNEL CCHAN DEVICE "/factoryreset"
+#define TELEMETRY_CHANNEL CCHAN DEVICE "/telemetry"
+#define HEARTBEAT_CHANNEL CCHAN DEVICE "/heartbeat"
+#define RATES_CHANNEL CCHAN DEVICE "/rates"
+#define STREAM_CHANNEL CCHAN DEVICE "/stream"
+#define CTLPERIOD_CHANNEL CCHAN DEVICE "/ctlperiod"
+#define LOADCELL_CHANNEL CCHAN DEVICE "/loadcell"
+
+typedef enum {
+  CTLCHAN_DRY,
+  CTLCHAN_AUTOTUNE,
+  CTLCHAN_MOTOR,
+  CTLCHAN_HEATER,
+  CTLCHAN_LPWM,
+  CTLCHAN_UPWM,
+  CTLCHAN_TARE,
+  CTLCHAN_OTA,
+  CTLCHAN_CALIBRATE,
+  CTLCHAN_FACTORYRESET,
+  CTLCHAN_TELEMETRY,
+  CTLCHAN_HEARTBEAT,
+  CTLCHAN_RATES,
+  CTLCHAN_STREAM,
+  CTLCHAN_CTLPERIOD,
+  CTLCHAN_LOADCELL,
+  CTLCHAN_UNKNOWN
+} ctlchan;
+
+// map a topic (tlen bytes) to its control channel
+ctlchan ctlmsg_channel(const char* topic, size_t tlen);
+
+// on, yes, true, or 1; off, no, false, or 0 (case-insensitive)
+int extract_bool(const char* data, size_t dlen, bool* val);
+
+// exactly two hex digits. returns the pwm (0..255), or -1 on error.
+int extract_pwm(const char* data, size_t dlen);
+
+// TEMP/SECONDS, with optional leading and trailing space. the temperature
+// is not range-checked here.
+int parse_dry_req(const char* payload, size_t plen, unsigned* temp,
+                  unsigned* seconds);
+
+// a temperature of up to four digits, with optional leading and trailing
+// space. the temperature is not range-checked here.
+int parse_autotune_req(const char* payload, size_t plen, unsigned* temp);
+
+// json, cbor, or both (case-insensitive). returns a mask of
+// TELEMETRY_FMT_* bits, or -1 on error.
+int parse_telemetry_fmt(const char* payload, size_t plen);
+
+// a number of seconds of up to five digits, with optional leading and
+// trailing space. not range-checked here.
+int parse_heartbeat_req(const char* payload, size_t plen, unsigned* seconds);
+
+// FAST/ACTIVE/IDLE/ENDING, each a number of seconds of up to five digits,
+// with optional leading and trailing space. not validated here.
+int parse_rates_req(const char* payload, size_t plen, telemetry_rates* r);
+
+// a maximum count of stream subscribers of up to two digits, with optional
+// leading and trailing space. not range-checked here.
+int parse_stream_req(const char* payload, size_t plen, unsigned* maxsubs);
+
+// a control period in milliseconds of up to five digits, with optional
+// leading and trailing space. not range-checked here.
+int parse_ctlperiod_req(const char* payload, size_t plen, unsigned* ms);
+
+// SPS/GAIN/MEDIAN/EMA, each of up to three digits, with optional leading
+// and trailing space. not validated here.
+int parse_loadcell_req(const char* payload, size_t plen, unsigned* sps,
+                       unsigned* gain, unsigned* median, unsigned* ema);
+
+#endif
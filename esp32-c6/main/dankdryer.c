@@ -1,46 +1,77 @@
 // intended for use on an ESP32-S3-WROOM-1
 #include "networking.h"
 #include "dankdryer.h"
+#include "dry.h"
+#include "ctlmsg.h"
+#include "weight.h"
+#include "telemetry.h"
 #include "version.h"
-#include "nau7802.h"
+#include "histogram.h"
+#include "batch.h"
+#include "fixedpoint.h"
+#include "loadcell.h"
 #include "heater.h"
 #include "efuse.h"
 #include "reset.h"
 #include "pins.h"
+#include "hal.h"
 #include "fans.h"
+#include "tach.h"
 #include "ota.h"
+#include "spool.h"
+#include "state.h"
+#include "sse.h"
+#include "history.h"
+#include "histstore.h"
 #include <nvs.h>
 #include <time.h>
 #include <math.h>
 #include <ctype.h>
-#include <cJSON.h>
 #include <string.h>
+#include <limits.h>
+#include <sys/time.h>
 #include <esp_log.h>
 #include <stdatomic.h>
 #include <led_strip.h>
 #include <nvs_flash.h>
-#include <esp_timer.h>
 #include <esp_system.h>
 #include <driver/ledc.h>
 #include <driver/gpio.h>
 #include <esp_app_desc.h>
 #include <hal/ledc_types.h>
 #include <esp_idf_version.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
 //#include <esp32c6/rom/rtc.h>
 #include <esp_adc/adc_cali.h>
 #include <driver/i2c_master.h>
-#include <driver/gpio_filter.h>
 #include <driver/temperature_sensor.h>
 
 #define TAG "main"
 
 #define UUIDLEN 16
-#define MAX_DRYREQ_TMP 150
-#define MIN_DRYREQ_TMP 50
-// minimum of 15s between mqtt publications
-#define MQTT_PUBLISH_QUANTUM_USEC 15000000ul
-// give tachs a 5s period to smooth them out
-#define TACH_SAMPLE_QUANTUM_USEC 5000000ul
+// publish at least this often, even if nothing has changed. configurable
+// via HEARTBEAT_CHANNEL. how often we publish changes depends on the
+// control state, and is configurable via RATES_CHANNEL.
+#define HEARTBEAT_SEC_DEFAULT 300
+#define HEARTBEAT_SEC_MIN 15
+#define HEARTBEAT_SEC_MAX 3600
+// any earlier wall clock time means we've not yet heard from SNTP
+#define EPOCH_SANE_SEC 1704067200ll // 2024-01-01
+
+// task priorities. app_main() runs at priority 1. the control task must
+// preempt sensor acquisition (which can block on I2C) and telemetry (which
+// can block on the network), so that heater decisions are made on time.
+#define CONTROL_TASK_PRIO 10
+#define SENSOR_TASK_PRIO 6
+#define TELEMETRY_TASK_PRIO 2
+#define TASK_STACK_BYTES 4096
+#define SENSOR_PERIOD_MS 1000
+// the control loop runs at a fixed rate, configurable via nvs
+#define CONTROL_PERIOD_MS_DEFAULT 1000
+#define CONTROL_PERIOD_MS_MIN 100
+#define CONTROL_PERIOD_MS_MAX 10000
 
 #define BOOTCOUNT_RECNAME "bootcount"
 #define TAREOFFSET_RECNAME "tare"
@@ -51,126 +82,95 @@
 #define MQTTTOPIC_RECNAME "mqtttopic"
 #define MQTTUSER_RECNAME "mqttuser"
 #define MQTTPASS_RECNAME "mqttpass"
-#define LOAD_CELL_MAX 500000 // 5kg capable, at 10mg
+#define CTLPERIOD_RECNAME "ctlperiod"
+#define TELEFMT_RECNAME "telefmt"
+#define HEARTBEAT_RECNAME "heartbeat"
+#define RATEFAST_RECNAME "ratefast"
+#define RATEACTIVE_RECNAME "rateactive"
+#define RATEIDLE_RECNAME "rateidle"
+#define RATEENDING_RECNAME "rateending"
+#define STREAMMAX_RECNAME "streammax"
 
 static bool MotorState;
 static bool StartupFailure;
-static float LastWeight = -1.0;
-static float TareWeight = -1.0;
-static time_t DryEndsAt; // dry stop time in seconds since epoch
+static q8_t LastWeight = -Q8_ONE;
+static q8_t TareWeight = -Q8_ONE;
+// written by the MQTT task, and read (and expired) by the control task.
+// it's wider than our word, so both take DryLock.
+static drysched Dry;
+static portMUX_TYPE DryLock = portMUX_INITIALIZER_UNLOCKED;
 static uint32_t Bootcount;  // preserved across factory reset
-static float LastLowerTemp;
-static uint32_t TargetTemp; // meaningful iff DryEndsAt != 0
-static uint32_t LastSpoolRPM;
-static i2c_master_dev_handle_t NAU7802;
+static uint32_t LastSpoolMRPM;
 static i2c_master_bus_handle_t I2CMaster;
 static uint32_t LastLowerRPM, LastUpperRPM;
 
-// variables manipulated by interrupts
-static _Atomic(uint32_t) HallPulses;
+// hall sensor pulses, timestamped per edge
+static tach HallTach;
 
-// ESP-IDF objects
-static bool NAUAvailable;
-static temperature_sensor_handle_t temp;
+// the most recent set of readings taken by the sensor task. published through
+// SensorMailbox (a single-element queue written with xQueueOverwrite()), so
+// consumers always see a complete sample without blocking the producer.
+typedef struct sensor_sample {
+  int64_t stamp;    // hal_now_us() at acquisition
+  q8_t ambient;     // MIN_TEMP - 1 if invalid
+  q8_t weight;      // negative if invalid
+  uint32_t lrpm, urpm;
+  uint32_t smrpm;   // spool milli-RPM
+} sensor_sample;
 
-static void
-pulse_isr(void* pulsecount){
-  _Atomic(uint32_t)* pc = pulsecount;
-  ++*pc;
-}
+static QueueHandle_t SensorMailbox;
 
-static inline bool
-rpm_valid_p(unsigned rpm){
-  return rpm < 3000;
-}
+// set from the control channel, and picked up by the control task at the
+// start of its next period
+static _Atomic(uint32_t) ControlPeriodMS = CONTROL_PERIOD_MS_DEFAULT;
 
-static inline bool
-weight_valid_p(float weight){
-  return weight >= 0 && weight <= LOAD_CELL_MAX;
-}
+// execution time and wakeup lateness of each control loop iteration, in
+// microseconds. written by the control task, and snapshotted+cleared by the
+// telemetry task, so each publication covers the preceding interval.
+static histogram ControlExecHist, ControlJitterHist;
+static portMUX_TYPE ControlHistLock = portMUX_INITIALIZER_UNLOCKED;
 
-int setup_intr(gpio_num_t pin, _Atomic(uint32_t)* arg){
-  if(gpio_set_input(pin)){
-    return -1;
-  }
-  esp_err_t e;
-  gpio_pin_glitch_filter_config_t fconf = {
-    .clk_src = SOC_MOD_CLK_XTAL,
-    .gpio_num = pin,
-  };
-  gpio_glitch_filter_handle_t gfilter;
-  if((e = gpio_new_pin_glitch_filter(&fconf, &gfilter)) != ESP_OK){
-    ESP_LOGE(TAG, "error (%s) creating glitch filter on %d", esp_err_to_name(e), pin);
-    return -1;
-  }
-  if((e = gpio_glitch_filter_enable(gfilter)) != ESP_OK){
-    ESP_LOGE(TAG, "error (%s) enabling glitch filter on %d", esp_err_to_name(e), pin);
-    return -1;
-  }
-  if((e = gpio_pullup_dis(pin)) != ESP_OK){
-    ESP_LOGE(TAG, "error (%s) disabling pullup on %d", esp_err_to_name(e), pin);
-    return -1;
-  }
-  if((e = gpio_pulldown_en(pin)) != ESP_OK){
-    ESP_LOGE(TAG, "error (%s) enabling pulldown on %d", esp_err_to_name(e), pin);
-    return -1;
-  }
-  if((e = gpio_set_intr_type(pin, GPIO_INTR_NEGEDGE)) != ESP_OK){
-    ESP_LOGE(TAG, "failure (%s) installing %d interrupt", esp_err_to_name(e), pin);
-    return -1;
-  }
-  if((e = gpio_isr_handler_add(pin, pulse_isr, arg)) != ESP_OK){
-    ESP_LOGE(TAG, "failure (%s) setting %d isr", esp_err_to_name(e), pin);
-    return -1;
-  }
-  if((e = gpio_intr_enable(pin)) != ESP_OK){
-    ESP_LOGE(TAG, "failure (%s) enabling %d interrupt", esp_err_to_name(e), pin);
-    return -1;
-  }
-  return 0;
-}
+// 1Hz samples, appended by the sensor task and drained by the telemetry
+// task into SampleBatch for each publication
+static batch_ring SampleRing;
+static portMUX_TYPE SampleRingLock = portMUX_INITIALIZER_UNLOCKED;
+static batch SampleBatch;
 
-// precondition: isxdigit(c) is true
-static inline char
-get_hex(char c){
-  if(isdigit(c)){
-    return c - '0';
-  }
-  c = tolower(c);
-  return c - 'a' + 10;
-}
-
-float get_tare(void){
-  return TareWeight;
-}
+// the live state, published by the control task each iteration, and read
+// by the telemetry task and the HTTP server
+static devstate State;
 
-float get_lower_temp(void){
-  return LastLowerTemp;
-}
+// the last minutes at 1Hz, and the open minute and hour rollups. written
+// by the control task, and read by the HTTP server.
+static history History;
+static portMUX_TYPE HistoryLock = portMUX_INITIALIZER_UNLOCKED;
 
-unsigned long long get_dry_ends_at(void){
-  return DryEndsAt;
-}
+// serialized telemetry, written only by the telemetry task
+static char TelemetryJSON[TELEMETRY_JSON_MAX];
+static uint8_t TelemetryCBOR[TELEMETRY_CBOR_MAX];
 
-unsigned long get_target_temp(void){
-  return TargetTemp;
-}
+// which renderings of telemetry we publish (TELEMETRY_FMT_* bits), set
+// from MQTT and read by the telemetry task
+static _Atomic(uint32_t) TelemetryFormats = TELEMETRY_FMT_JSON;
 
-float get_weight(void){
-  return LastWeight;
-}
+// maximum seconds between publications, set from MQTT and read by the
+// telemetry task
+static _Atomic(uint32_t) HeartbeatSec = HEARTBEAT_SEC_DEFAULT;
 
-uint32_t get_spool_rpm(void){
-  return LastSpoolRPM;
-}
+// publication intervals by control state, set from MQTT and read by the
+// telemetry task
+static telemetry_rates Rates = TELEMETRY_RATES_INITIALIZER;
+static portMUX_TYPE RatesLock = portMUX_INITIALIZER_UNLOCKED;
 
-unsigned get_lower_rpm(void){
-  return LastLowerRPM;
-}
+// what we last published (or spooled), against which each new snapshot
+// is compared. owned by the telemetry task.
+static telemetry LastPublished;
+static int64_t LastPublishedUs;
+static bool Published;
+static const deadbands Deadbands = DEADBANDS_INITIALIZER;
 
-unsigned get_upper_rpm(void){
-  return LastUpperRPM;
-}
+// ESP-IDF objects
+static temperature_sensor_handle_t temp;
 
 // if record is not present, set *str to NULL and *len to 0, and return ESP_OK.
 // if we encounter an error, same deal but with an error code. otherwise, *str
@@ -399,123 +399,224 @@ write_tare_offset(float tare){
   return 0;
 }
 
-void set_tare(void){
-  if(weight_valid_p(LastWeight)){
-    TareWeight = LastWeight;
-    write_tare_offset(TareWeight);
-    ESP_LOGI(TAG, "tared at %f", TareWeight);
-  }else{
-    ESP_LOGE(TAG, "requested tare, but no valid measurements yet");
+// update NVS with a u32 configuration value
+static int
+write_u32_record(const char* recname, uint32_t val){
+  nvs_handle_t nvsh;
+  esp_err_t err = nvs_open(NVS_HANDLE_NAME, NVS_READWRITE, &nvsh);
+  if(err){
+    ESP_LOGE(TAG, "error (%s) opening nvs:" NVS_HANDLE_NAME, esp_err_to_name(err));
+    return -1;
   }
+  err = nvs_set_u32(nvsh, recname, val);
+  if(err){
+    ESP_LOGE(TAG, "error (%s) writing " NVS_HANDLE_NAME ":%s", esp_err_to_name(err), recname);
+    nvs_close(nvsh);
+    return -1;
+  }
+  err = nvs_commit(nvsh);
+  if(err){
+    ESP_LOGE(TAG, "error (%s) committing nvs:" NVS_HANDLE_NAME, esp_err_to_name(err));
+    nvs_close(nvsh);
+    return -1;
+  }
+  nvs_close(nvsh);
+  return 0;
 }
 
-// FIXME ignore whitespace
-// check if data (dlen bytes, no terminator) equals n, returning true
-// if it does, and false otherwise.
-static bool
-strarg_match_p(const char* data, size_t dlen, const char* n){
-  if(dlen != strlen(n)){
-    return false;
+// the argument is json, cbor, or both
+static int
+handle_telemetry_req(const char* payload, size_t plen){
+  int fmts = parse_telemetry_fmt(payload, plen);
+  if(fmts < 0){
+    return -1;
   }
-  return strncasecmp(data, n, dlen) ? false : true;
+  if(atomic_exchange(&TelemetryFormats, fmts) != (uint32_t)fmts){
+    write_u32_record(TELEFMT_RECNAME, fmts);
+  }
+  return 0;
 }
 
-int extract_bool(const char* data, size_t dlen, bool* val){
-  if(strarg_match_p(data, dlen, "on") || strarg_match_p(data, dlen, "yes") ||
-      strarg_match_p(data, dlen, "true") || strarg_match_p(data, dlen, "1")){
-    *val = true;
-    return 0;
+// update NVS with the publication rates
+static int
+write_rates(const telemetry_rates* r){
+  nvs_handle_t nvsh;
+  esp_err_t err = nvs_open(NVS_HANDLE_NAME, NVS_READWRITE, &nvsh);
+  if(err){
+    ESP_LOGE(TAG, "error (%s) opening nvs:" NVS_HANDLE_NAME, esp_err_to_name(err));
+    return -1;
   }
-  if(strarg_match_p(data, dlen, "off") || strarg_match_p(data, dlen, "no") ||
-      strarg_match_p(data, dlen, "false") || strarg_match_p(data, dlen, "0")){
-    *val = false;
-    return 0;
+  if((err = nvs_set_u32(nvsh, RATEFAST_RECNAME, r->fastsec)) == ESP_OK){
+    if((err = nvs_set_u32(nvsh, RATEACTIVE_RECNAME, r->activesec)) == ESP_OK){
+      if((err = nvs_set_u32(nvsh, RATEIDLE_RECNAME, r->idlesec)) == ESP_OK){
+        if((err = nvs_set_u32(nvsh, RATEENDING_RECNAME, r->endingsec)) == ESP_OK){
+          err = nvs_commit(nvsh);
+        }
+      }
+    }
   }
-  printf("not a bool: [%s]\n", data);
-  return -1;
+  nvs_close(nvsh);
+  if(err){
+    ESP_LOGE(TAG, "error (%s) writing rates to nvs:" NVS_HANDLE_NAME, esp_err_to_name(err));
+    return -1;
+  }
+  return 0;
 }
 
-// FIXME handle base 10 numbers as well (can we use strtoul?)
-int extract_pwm(const char* data, size_t dlen){
-  if(dlen != 2){
-    printf("pwm wasn't 2 characters\n");
+// update NVS with the load cell parameters, which are read at boot
+static int
+write_loadcell(unsigned sps, unsigned gain, unsigned median, unsigned ema){
+  nvs_handle_t nvsh;
+  esp_err_t err = nvs_open(NVS_HANDLE_NAME, NVS_READWRITE, &nvsh);
+  if(err){
+    ESP_LOGE(TAG, "error (%s) opening nvs:" NVS_HANDLE_NAME, esp_err_to_name(err));
     return -1;
   }
-  char h = data[0];
-  char l = data[1];
-  if(!isxdigit(h) || !isxdigit(l)){
-    printf("invalid hex character\n");
+  if((err = nvs_set_u32(nvsh, LCSPS_RECNAME, sps)) == ESP_OK){
+    if((err = nvs_set_u32(nvsh, LCGAIN_RECNAME, gain)) == ESP_OK){
+      if((err = nvs_set_u32(nvsh, LCMEDIAN_RECNAME, median)) == ESP_OK){
+        if((err = nvs_set_u32(nvsh, LCEMA_RECNAME, ema)) == ESP_OK){
+          err = nvs_commit(nvsh);
+        }
+      }
+    }
+  }
+  nvs_close(nvsh);
+  if(err){
+    ESP_LOGE(TAG, "error (%s) writing loadcell to nvs:" NVS_HANDLE_NAME, esp_err_to_name(err));
     return -1;
   }
-  char hb = get_hex(h);
-  char lb = get_hex(l);
-  // everything was valid
-  int pwm = hb * 16 + lb;
-  printf("got pwm value: %d\n", pwm);
-  return pwm;
+  return 0;
 }
 
-// on error, returns MIN_TEMP - 1
-static float
-getAmbient(void){
-  float t;
-  if(temperature_sensor_get_celsius(temp, &t)){
-    ESP_LOGE(TAG, "failed acquiring temperature");
-    return MIN_TEMP - 1;
+static void
+get_rates(telemetry_rates* r){
+  taskENTER_CRITICAL(&RatesLock);
+  *r = Rates;
+  taskEXIT_CRITICAL(&RatesLock);
+}
+
+// the argument is FAST/ACTIVE/IDLE/ENDING, in seconds
+static int
+handle_rates_req(const char* payload, size_t plen){
+  telemetry_rates r;
+  if(parse_rates_req(payload, plen, &r)){
+    return -1;
+  }
+  if(!telemetry_rates_valid_p(&r)){
+    ESP_LOGE(TAG, "invalid rates (%u/%u/%u/%u)", r.fastsec, r.activesec, r.idlesec, r.endingsec);
+    return -1;
+  }
+  taskENTER_CRITICAL(&RatesLock);
+  const bool changed = memcmp(&Rates, &r, sizeof(r));
+  Rates = r;
+  taskEXIT_CRITICAL(&RatesLock);
+  if(changed){
+    write_rates(&r);
   }
-  return t;
+  return 0;
 }
 
+// the argument is the maximum number of seconds between publications
 static int
-setup_nau7802(i2c_master_bus_handle_t master){
-  if(nau7802_detect(master, &NAU7802)){
+handle_heartbeat_req(const char* payload, size_t plen){
+  unsigned secs;
+  if(parse_heartbeat_req(payload, plen, &secs)){
     return -1;
   }
-  if(nau7802_poweron(NAU7802)){
+  if(secs < HEARTBEAT_SEC_MIN || secs > HEARTBEAT_SEC_MAX){
+    ESP_LOGE(TAG, "invalid heartbeat (%u)", secs);
     return -1;
   }
-  if(nau7802_enable_ldo(NAU7802, NAU7802_LDO_30V, false)){
+  if(atomic_exchange(&HeartbeatSec, secs) != secs){
+    write_u32_record(HEARTBEAT_RECNAME, secs);
+  }
+  return 0;
+}
+
+// the argument is the maximum number of stream subscribers
+static int
+handle_stream_req(const char* payload, size_t plen){
+  unsigned maxsubs;
+  if(parse_stream_req(payload, plen, &maxsubs)){
     return -1;
   }
-  if(nau7802_set_bandgap_chop(NAU7802, false)){
+  if(maxsubs > SSE_SUBSCRIBERS_MAX){
+    ESP_LOGE(TAG, "invalid stream subscriber limit (%u)", maxsubs);
     return -1;
   }
-  if(nau7802_set_pga_cap(NAU7802, true)){
+  if(sse_set_max(maxsubs) != maxsubs){
+    write_u32_record(STREAMMAX_RECNAME, maxsubs);
+  }
+  return 0;
+}
+
+// the argument is the control period in milliseconds
+static int
+handle_ctlperiod_req(const char* payload, size_t plen){
+  unsigned ms;
+  if(parse_ctlperiod_req(payload, plen, &ms)){
     return -1;
   }
-  if(nau7802_set_gain(NAU7802, 32)){
+  if(ms < CONTROL_PERIOD_MS_MIN || ms > CONTROL_PERIOD_MS_MAX){
+    ESP_LOGE(TAG, "invalid control period (%u)", ms);
     return -1;
   }
-  NAUAvailable = true;
+  if(atomic_exchange(&ControlPeriodMS, ms) != ms){
+    write_u32_record(CTLPERIOD_RECNAME, ms);
+  }
   return 0;
 }
 
-float getWeight(void){
-  if(!NAUAvailable){
-    if(setup_nau7802(I2CMaster)){
-      return -1.0;
-    }
+// the argument is SPS/GAIN/MEDIAN/EMA. these are stored for the next boot;
+// the load cell is only configured at startup.
+static int
+handle_loadcell_req(const char* payload, size_t plen){
+  unsigned sps, gain, median, ema;
+  if(parse_loadcell_req(payload, plen, &sps, &gain, &median, &ema)){
+    return -1;
   }
-  int32_t v;
-  if(nau7802_read(NAU7802, &v)){
-    NAUAvailable = false;
-    // don't immediately retry setup, which might hide error
-    return -1.0;
-  }
-  if(v < 0){
-    ESP_LOGE(TAG, "bad nau7802 read %" PRId32, v);
-    return -1.0;
-  }
-  ESP_LOGI(TAG, "raw %" PRId32 " 0x%08x", v, v);
-  // we use a single-ended signal (not differential)
-  // and thus lose half of our range, yielding 1 << 22.
-  float sv = v * ((float)LOAD_CELL_MAX / (1u << 22u));
-  if(weight_valid_p(TareWeight)){
-    sv -= TareWeight;
-    ESP_LOGI(TAG, "tare (%f) %f", TareWeight, sv);
+  if(!loadcell_params_valid_p(sps, gain, median, ema)){
+    ESP_LOGE(TAG, "invalid loadcell parameters (%u/%u/%u/%u)", sps, gain, median, ema);
+    return -1;
+  }
+  if(write_loadcell(sps, gain, median, ema)){
+    return -1;
+  }
+  ESP_LOGI(TAG, "loadcell parameters %u/%u/%u/%u apply at next boot", sps, gain, median, ema);
+  return 0;
+}
+
+void set_tare(void){
+  if(weight_valid_p(LastWeight)){
+    TareWeight = LastWeight;
+    write_tare_offset(q8_to_float(TareWeight));
+    ESP_LOGI(TAG, "tared at %f", q8_to_float(TareWeight));
   }else{
-    ESP_LOGI(TAG, "no tare, returning %f", sv);
+    ESP_LOGE(TAG, "requested tare, but no valid measurements yet");
+  }
+}
+
+// on error, returns MIN_TEMP - 1. the driver only offers us a float.
+static q8_t
+getAmbient(void){
+  float t;
+  if(temperature_sensor_get_celsius(temp, &t)){
+    ESP_LOGE(TAG, "failed acquiring temperature");
+    return q8_from_int(MIN_TEMP - 1);
+  }
+  return q8_from_float(t);
+}
+
+// the filtered reading from the load cell acquisition engine, scaled and
+// tared, in Q8. returns -1 if there's no valid reading.
+q8_t getWeight(void){
+  int32_t v;
+  if(!loadcell_raw(&v)){
+    return -Q8_ONE;
   }
+  q8_t sv = weight_from_raw(v, TareWeight);
+  ESP_LOGD(TAG, "raw %" PRId32 " tare %" PRId32 " q8 %" PRId32, v, TareWeight, sv);
   return sv;
 }
 
@@ -538,21 +639,6 @@ init_pstore(void){
   return 0;
 }
 
-// check for an optional record in the nvs handle. if not defined, return 0.
-// if defined, load val and return 0. on other errors, return -1.
-int nvs_get_opt_u32(nvs_handle_t nh, const char* recname, uint32_t* val){
-  esp_err_t err = nvs_get_u32(nh, recname, val);
-  if(err == ESP_ERR_NVS_NOT_FOUND){
-    printf("no record '%s' in nvs\n", recname);
-    return 0;
-  }else if(err){
-    ESP_LOGE(TAG, "failure (%d) reading %s", err, recname);
-    return -1;
-  }
-  printf("read configured default %lu from nvs:%s\n", *val, recname);
-  return 0;
-}
-
 // NVS can't use floats directly. we instead write/read them as strings.
 static int
 nvs_get_opt_float(nvs_handle_t nh, const char* recname, float* val){
@@ -609,10 +695,60 @@ read_pstore(void){
     return -1;
   }
   read_fans_pstore(nvsh);
-  float tare = TareWeight; // if not present, don't change initialized value
+  read_loadcell_pstore(nvsh);
+  read_heater_pstore(nvsh);
+  uint32_t ctlperiod = ControlPeriodMS;
+  if(nvs_get_opt_u32(nvsh, CTLPERIOD_RECNAME, &ctlperiod) == 0){
+    if(ctlperiod >= CONTROL_PERIOD_MS_MIN && ctlperiod <= CONTROL_PERIOD_MS_MAX){
+      ControlPeriodMS = ctlperiod;
+    }else{
+      ESP_LOGE(TAG, "read invalid control period %" PRIu32, ctlperiod);
+    }
+  }
+  uint32_t telefmt;
+  if(nvs_get_opt_u32(nvsh, TELEFMT_RECNAME, &telefmt) == 0){
+    if(telefmt && !(telefmt & ~(TELEMETRY_FMT_JSON | TELEMETRY_FMT_CBOR))){
+      TelemetryFormats = telefmt;
+    }else{
+      ESP_LOGE(TAG, "read invalid telemetry formats 0x%" PRIx32, telefmt);
+    }
+  }
+  uint32_t heartbeat;
+  if(nvs_get_opt_u32(nvsh, HEARTBEAT_RECNAME, &heartbeat) == 0){
+    if(heartbeat >= HEARTBEAT_SEC_MIN && heartbeat <= HEARTBEAT_SEC_MAX){
+      HeartbeatSec = heartbeat;
+    }else{
+      ESP_LOGE(TAG, "read invalid heartbeat %" PRIu32, heartbeat);
+    }
+  }
+  uint32_t rates[4] = { Rates.fastsec, Rates.activesec, Rates.idlesec, Rates.endingsec, };
+  nvs_get_opt_u32(nvsh, RATEFAST_RECNAME, &rates[0]);
+  nvs_get_opt_u32(nvsh, RATEACTIVE_RECNAME, &rates[1]);
+  nvs_get_opt_u32(nvsh, RATEIDLE_RECNAME, &rates[2]);
+  nvs_get_opt_u32(nvsh, RATEENDING_RECNAME, &rates[3]);
+  const telemetry_rates r = {
+    .fastsec = rates[0],
+    .activesec = rates[1],
+    .idlesec = rates[2],
+    .endingsec = rates[3],
+  };
+  if(telemetry_rates_valid_p(&r)){
+    Rates = r;
+  }else{
+    ESP_LOGE(TAG, "read invalid rates %u/%u/%u/%u", r.fastsec, r.activesec, r.idlesec, r.endingsec);
+  }
+  uint32_t streammax;
+  if(nvs_get_opt_u32(nvsh, STREAMMAX_RECNAME, &streammax) == 0){
+    if(streammax <= SSE_SUBSCRIBERS_MAX){
+      sse_set_max(streammax);
+    }else{
+      ESP_LOGE(TAG, "read invalid stream subscriber limit %" PRIu32, streammax);
+    }
+  }
+  float tare = q8_to_float(TareWeight); // if not present, don't change initialized value
   if(nvs_get_opt_float(nvsh, TAREOFFSET_RECNAME, &tare) == 0){
-    if(weight_valid_p(tare)){
-      TareWeight = tare;
+    if(weight_valid_p(q8_from_float(tare))){
+      TareWeight = q8_from_float(tare);
     }else{
       ESP_LOGE(TAG, "read invalid tare offset %f", tare);
     }
@@ -642,20 +778,22 @@ bool get_motor_state(void){
 
 void set_motor(bool enabled){
   MotorState = enabled;
-  gpio_level(MOTOR_GATEPIN, enabled);
+  hal_gpio_level(MOTOR_GATEPIN, enabled);
   printf("set motor %s\n", motor_state());
 }
 
 int handle_dry(unsigned seconds, unsigned temp){
   printf("dry request for %us at %uC\n", seconds, temp);
-  if(temp > MAX_DRYREQ_TMP || temp < MIN_DRYREQ_TMP){
+  drysched d;
+  if(dry_schedule(&d, seconds, temp, hal_now_us())){
     ESP_LOGE(TAG, "invalid temp request (%u)", temp);
     return -1;
   }
-  DryEndsAt = esp_timer_get_time() + seconds * 1000000ull;
+  taskENTER_CRITICAL(&DryLock);
+  Dry = d;
+  taskEXIT_CRITICAL(&DryLock);
   set_motor(seconds != 0);
-  TargetTemp = temp;
-  manage_heater(SSR_GPIN, DryEndsAt, TargetTemp);
+  // the control task picks up the new parameters on its next iteration
   return 0;
 }
 
@@ -677,7 +815,7 @@ void factory_reset(void){
 
 static int
 setup_motor(gpio_num_t mrelaypin){
-  if(gpio_set_output(mrelaypin)){
+  if(hal_gpio_output(mrelaypin)){
     return -1;
   }
   set_motor(false);
@@ -686,7 +824,7 @@ setup_motor(gpio_num_t mrelaypin){
 
 static int
 setup_heater(gpio_num_t hrelaypin){
-  if(gpio_set_output(hrelaypin)){
+  if(hal_gpio_output(hrelaypin)){
     return -1;
   }
   set_heater(hrelaypin, false);
@@ -702,7 +840,7 @@ setup_i2c(i2c_master_bus_handle_t *master, gpio_num_t sda, gpio_num_t scl){
     .sda_io_num = sda,
     .glitch_ignore_cnt = 7, // recommended value from esp-idf docs
   };
-  if(gpio_set_inputoutput_opendrain(sda) || gpio_set_inputoutput_opendrain(scl)){
+  if(hal_gpio_opendrain(sda) || hal_gpio_opendrain(scl)){
     return -1;
   }
   esp_err_t e = i2c_new_master_bus(&i2ccnf, master);
@@ -734,13 +872,13 @@ setup(void){
     set_failure();
   }
   // install the ETS_GPIO_INTR_SOURCE interrupt handler, which demuxes
-  // to per-pin interrupt handlers.
+  // to per-pin interrupt handlers (tachs and hall sensor use PCNT instead).
   esp_err_t e = gpio_install_isr_service(0);
   if(e != ESP_OK){
     ESP_LOGE(TAG, "error (%s) installing isr service", esp_err_to_name(e));
     set_failure();
   }
-  if(setup_intr(HALL_DATAPIN, &HallPulses)){
+  if(setup_tach(&HallTach, HALL_DATAPIN, 1, HALL_PPR, HALL_STALL_USEC)){
     set_failure();
   }
   if(setup_factory_reset(FRESET_PIN)){
@@ -751,6 +889,8 @@ setup(void){
   }
   if(setup_i2c(&I2CMaster, SDA_PIN, SCL_PIN)){
     set_failure();
+  }else if(setup_loadcell(I2CMaster, &HallTach)){
+    set_failure();
   }
   /*if(setup_lcd(LCD_SDA_PIN, LCD_SCL_PIN, LCD_DC_PIN, LCD_CS_PIN, LCD_RST_PIN)){
     set_failure();
@@ -763,7 +903,7 @@ setup(void){
     ESP_LOGE(TAG, "failed to enable thermostat");
     set_failure();
   }
-  if(setup_temp(THERM_DATAPIN, ADC_UNIT_1)){
+  if(setup_temp(THERM_DATAPIN)){
     set_failure();
   }
   if(setup_heater(SSR_GPIN)){
@@ -772,6 +912,9 @@ setup(void){
   if(setup_motor(MOTOR_GATEPIN)){
     set_failure();
   }
+  spool_init(); // allow a failure; we just can't store-and-forward
+  history_init(&History, Bootcount);
+  histstore_init(); // allow a failure; we keep only the recent history
   if(setup_network()){
     set_failure();
   }
@@ -779,33 +922,12 @@ setup(void){
   ESP_LOGI(TAG, "initialization %ssuccessful v" VERSION, StartupFailure ? "un" : "");
 }
 
-static uint32_t
-get_hall_count(void){
-  uint32_t r = HallPulses;
-  HallPulses = 0;
-  return r;
-}
-
-// we don't try to measure the first iteration, as we don't yet have a
-// timestamp (and the fans are spinning up, anyway).
+// update *lastrpm with rpm if it's a valid reading
 static void
-getPulseCount(float scale, uint32_t(*getcount)(void), uint32_t *lastpcount){
-  unsigned rpm;
-  rpm = getcount();
-  float scaled = rpm * scale;
-  scaled /= 2; // two pulses for each rotation
-  printf("raw: %u scale: %f rpm: %f\n", rpm, scale, scaled);
-  if(rpm_valid_p(scaled)){
-    *lastpcount = scaled;
-  }
-}
-
-static inline bool
-topic_matches(const esp_mqtt_event_t* e, const char* chan){
-  if(strncmp(e->topic, chan, e->topic_len) == 0 && e->topic_len == strlen(chan)){
-    return true;
+update_rpm(uint32_t rpm, uint32_t* lastrpm){
+  if(rpm_valid_p(rpm)){
+    *lastrpm = rpm;
   }
-  return false;
 }
 
 // arguments to dry are a target temp and number of seconds in the form
@@ -813,160 +935,216 @@ topic_matches(const esp_mqtt_event_t* e, const char* chan){
 // cancelling it if SECONDS is 0. we allow leading and trailing space.
 static int
 handle_dry_req(const char* payload, size_t plen){
-  unsigned seconds = 0;
-  unsigned temp = 0;
-  size_t idx = 0;
-  enum {
-    PRESPACE,
-    TEMP,
-    SLASH,
-    SECONDS,
-    POSTSPACE
-  } state = PRESPACE;
-  // FIXME need address wrapping of temp and/or seconds
-  while(idx < plen){
-    printf("payload[%zu] = 0x%02x state: %d temp: %u\n", idx, payload[idx], state, temp);
-    if(payload[idx] >= 0x80 || payload[idx] <= 0){ // invalid character
-      goto err;
-    }
-    unsigned char c = payload[idx];
-    switch(state){
-      case PRESPACE:
-        if(!isspace(c)){
-          if(isdigit(c)){
-            state = TEMP;
-            temp = c - '0';
-          }else{
-            goto err;
-          }
-        }
-        break;
-      case TEMP:
-        if(isdigit(c)){
-          temp *= 10;
-          temp += c - '0';
-        }else if(c == '/'){
-          state = SLASH;
-        }else{
-          goto err;
-        }
-        break;
-      case SLASH:
-        if(isdigit(c)){
-          seconds = c - '0';
-          state = SECONDS;
-        }else{
-          goto err;
-        }
-        break;
-      case SECONDS:
-        if(isdigit(c)){
-          seconds *= 10;
-          seconds += c - '0';
-        }else if(isspace(c)){
-          state = POSTSPACE;
-        }else{
-          goto err;
-        }
-        break;
-      case POSTSPACE:
-        if(!isspace(c)){
-          goto err;
-        }
-        break;
-    }
-    ++idx;
+  unsigned temp, seconds;
+  if(parse_dry_req(payload, plen, &temp, &seconds)){
+    return -1;
   }
   return handle_dry(seconds, temp);
+}
 
-err:
-  ESP_LOGE(TAG, "invalid dry payload [%.*s]", plen, payload);
-  return -1;
+// the argument to autotune is a target temp, around which the relay
+// experiment is run. 0 aborts any autotune in progress. we allow leading
+// and trailing space.
+static int
+handle_autotune_req(const char* payload, size_t plen){
+  unsigned temp;
+  if(parse_autotune_req(payload, plen, &temp)){
+    return -1;
+  }
+  if(temp && (temp > MAX_DRYREQ_TMP || temp < MIN_DRYREQ_TMP)){
+    ESP_LOGE(TAG, "invalid autotune temp (%u)", temp);
+    return -1;
+  }
+  request_autotune(temp);
+  return 0;
 }
 
 void handle_mqtt_msg(const esp_mqtt_event_t* e){
   printf("control message [%.*s] [%.*s]\n", e->topic_len, e->topic, e->data_len, e->data);
-  if(topic_matches(e, DRY_CHANNEL)){
-    handle_dry_req(e->data, e->data_len);
-  }else if(topic_matches(e, MOTOR_CHANNEL)){
-    bool motor;
-    int ret = extract_bool(e->data, e->data_len, &motor);
-    if(ret == 0){
-      set_motor(motor);
-    }
-  }else if(topic_matches(e, HEATER_CHANNEL)){
-    bool heater;
-    int ret = extract_bool(e->data, e->data_len, &heater);
-    if(ret == 0){
-      set_heater(SSR_GPIN, heater);
-    }
-  }else if(topic_matches(e, LPWM_CHANNEL)){
-    int pwm = extract_pwm(e->data, e->data_len);
-    if(pwm >= 0){
-      set_lower_pwm(pwm);
-    }
-  }else if(topic_matches(e, UPWM_CHANNEL)){
-    int pwm = extract_pwm(e->data, e->data_len);
-    if(pwm >= 0){
-      set_upper_pwm(pwm);
-    }
-  }else if(topic_matches(e, TARE_CHANNEL)){
-    set_tare();
-  }else if(topic_matches(e, OTA_CHANNEL)){
-    attempt_ota();
-  }else if(topic_matches(e, CALIBRATE_CHANNEL)){
-    // FIXME get value, match against LastWeight - TareWeight
-  }else if(topic_matches(e, FACTORYRESET_CHANNEL)){
-    factory_reset();
-    // ought not reach here
-  }else{
-    ESP_LOGE(TAG, "unknown topic [%.*s]", e->topic_len, e->topic);
+  bool b;
+  int pwm;
+  switch(ctlmsg_channel(e->topic, e->topic_len)){
+    case CTLCHAN_DRY:
+      handle_dry_req(e->data, e->data_len);
+      break;
+    case CTLCHAN_AUTOTUNE:
+      handle_autotune_req(e->data, e->data_len);
+      break;
+    case CTLCHAN_MOTOR:
+      if(extract_bool(e->data, e->data_len, &b) == 0){
+        set_motor(b);
+      }
+      break;
+    case CTLCHAN_HEATER:
+      if(extract_bool(e->data, e->data_len, &b) == 0){
+        set_heater(SSR_GPIN, b);
+      }
+      break;
+    case CTLCHAN_LPWM:
+      if((pwm = extract_pwm(e->data, e->data_len)) >= 0){
+        set_lower_pwm(pwm);
+      }
+      break;
+    case CTLCHAN_UPWM:
+      if((pwm = extract_pwm(e->data, e->data_len)) >= 0){
+        set_upper_pwm(pwm);
+      }
+      break;
+    case CTLCHAN_TARE:
+      set_tare();
+      break;
+    case CTLCHAN_OTA:
+      attempt_ota();
+      break;
+    case CTLCHAN_CALIBRATE:
+      // FIXME get value, match against LastWeight - TareWeight
+      break;
+    case CTLCHAN_FACTORYRESET:
+      factory_reset();
+      // ought not reach here
+      break;
+    case CTLCHAN_TELEMETRY:
+      handle_telemetry_req(e->data, e->data_len);
+      break;
+    case CTLCHAN_HEARTBEAT:
+      handle_heartbeat_req(e->data, e->data_len);
+      break;
+    case CTLCHAN_RATES:
+      handle_rates_req(e->data, e->data_len);
+      break;
+    case CTLCHAN_STREAM:
+      handle_stream_req(e->data, e->data_len);
+      break;
+    case CTLCHAN_CTLPERIOD:
+      handle_ctlperiod_req(e->data, e->data_len);
+      break;
+    case CTLCHAN_LOADCELL:
+      handle_loadcell_req(e->data, e->data_len);
+      break;
+    case CTLCHAN_UNKNOWN:
+      ESP_LOGE(TAG, "unknown topic [%.*s]", e->topic_len, e->topic);
+      break;
   }
 }
 
-void send_mqtt(int64_t curtime){
-  cJSON* root = cJSON_CreateObject();
-  if(root == NULL){
-    ESP_LOGE(TAG, "couldn't create JSON object\n");
-    return;
-  }
-  cJSON_AddNumberToObject(root, "uptimesec", curtime / 1000000ll);
-  if(temp_valid_p(LastLowerTemp)){
-    cJSON_AddNumberToObject(root, "ltempC", LastLowerTemp);
+// take a consistent copy of the control loop histograms, and reset them
+static void
+take_control_hists(histogram* exec, histogram* jitter){
+  taskENTER_CRITICAL(&ControlHistLock);
+  *exec = ControlExecHist;
+  *jitter = ControlJitterHist;
+  histogram_clear(&ControlExecHist);
+  histogram_clear(&ControlJitterHist);
+  taskEXIT_CRITICAL(&ControlHistLock);
+}
+
+// the wall clock in milliseconds, or 0 if SNTP hasn't yet set it
+static int64_t
+epoch_ms(void){
+  struct timeval tv;
+  if(gettimeofday(&tv, NULL) || tv.tv_sec < EPOCH_SANE_SEC){
+    return 0;
   }
-  // UINT_MAX is sentinel for known bad reading, but anything over 3KRPM on
-  // these Noctua NF-A8 fans is indicative of error; they max out at 2500.
-  if(rpm_valid_p(LastLowerRPM)){
-    cJSON_AddNumberToObject(root, "lrpm", LastLowerRPM);
+  return tv.tv_sec * 1000ll + tv.tv_usec / 1000;
+}
+
+// the state shared by MQTT and HTTP, assembled by the control task. the
+// slow sensors come from the most recent sample, invalid readings and all.
+static void
+fill_telemetry(telemetry* t, int64_t curtime, const drysched* dry){
+  sensor_sample ss = {
+    .ambient = q8_from_int(MIN_TEMP - 1),
+    .weight = -Q8_ONE,
+    .lrpm = UINT_MAX,
+    .urpm = UINT_MAX,
+    .smrpm = UINT_MAX,
+  };
+  xQueuePeek(SensorMailbox, &ss, 0);
+  memset(t, 0, sizeof(*t));
+  t->uptimeus = curtime;
+  t->epochms = epoch_ms();
+  t->boot = Bootcount;
+  t->ltemp = ss.ambient;
+  t->utemp = get_upper_temp_q8();
+  t->weight = ss.weight;
+  t->tare = TareWeight;
+  t->lrpm = ss.lrpm;
+  t->urpm = ss.urpm;
+  t->smrpm = ss.smrpm;
+  t->lpwm = get_lower_pwm();
+  t->upwm = get_upper_pwm();
+  t->motor = MotorState;
+  t->heater = get_heater_state();
+  t->hduty = get_heater_duty();
+  t->targtemp = dry->targtemp;
+  t->dryendsus = dry->endsus;
+  get_autotune(&t->at);
+}
+
+uint32_t get_telemetry(telemetry* t){
+  return devstate_read(&State, t);
+}
+
+unsigned get_history(uint32_t* sec0, history_sample* out, unsigned max){
+  taskENTER_CRITICAL(&HistoryLock);
+  const unsigned n = history_samples(&History, sec0, out, max);
+  taskEXIT_CRITICAL(&HistoryLock);
+  return n;
+}
+
+// fold t into the history, and queue any rollups it closed for flash
+static void
+record_history(const telemetry* t){
+  history_rollup rollups[HISTORY_TIERS];
+  taskENTER_CRITICAL(&HistoryLock);
+  const unsigned closed = history_push(&History, t, rollups);
+  taskEXIT_CRITICAL(&HistoryLock);
+  for(unsigned tier = 0 ; tier < HISTORY_TIERS ; ++tier){
+    if((closed & (1u << tier)) && histstore_append(tier, &rollups[tier])){
+      ESP_LOGW(TAG, "couldn't store %" PRIu32 "s rollup", HistoryPeriodSec[tier]);
+    }
   }
-  if(rpm_valid_p(LastUpperRPM)){
-    cJSON_AddNumberToObject(root, "urpm", LastUpperRPM);
+}
+
+// publish t (a snapshot from get_telemetry()) along with the control loop
+// timings and samples accumulated since the last publication. anything we
+// can't publish is spooled.
+static void
+send_mqtt(telemetry* t){
+  static histogram exech, jitterh;
+  take_control_hists(&exech, &jitterh);
+  t->exech = &exech;
+  t->jitterh = &jitterh;
+  t->pubdropped = mqtt_publish_drops();
+  taskENTER_CRITICAL(&SampleRingLock);
+  batch_ring_drain(&SampleRing, &SampleBatch);
+  taskEXIT_CRITICAL(&SampleRingLock);
+  t->samples = &SampleBatch;
+  const uint32_t fmts = TelemetryFormats;
+  int jlen = -1, clen = -1;
+  bool failed = false;
+  if(fmts & TELEMETRY_FMT_JSON){
+    if((jlen = telemetry_json(t, TelemetryJSON, sizeof(TelemetryJSON))) < 0){
+      ESP_LOGE(TAG, "telemetry exceeded %zuB", sizeof(TelemetryJSON));
+    }else if(mqtt_publish(TelemetryJSON)){
+      failed = true;
+    }
   }
-  if(rpm_valid_p(LastSpoolRPM)){
-    cJSON_AddNumberToObject(root, "srpm", LastSpoolRPM);
+  if(fmts & TELEMETRY_FMT_CBOR){
+    if((clen = telemetry_cbor(t, TelemetryCBOR, sizeof(TelemetryCBOR))) < 0){
+      ESP_LOGE(TAG, "cbor telemetry exceeded %zuB", sizeof(TelemetryCBOR));
+    }else if(mqtt_publish_cbor(TelemetryCBOR, clen)){
+      failed = true;
+    }
   }
-  cJSON_AddNumberToObject(root, "lpwm", get_lower_pwm());
-  cJSON_AddNumberToObject(root, "upwm", get_upper_pwm());
-  if(weight_valid_p(LastWeight)){
-    cJSON_AddNumberToObject(root, "mass", LastWeight);
-  }
-  cJSON_AddNumberToObject(root, "tare", TareWeight);
-  cJSON_AddNumberToObject(root, "motor", MotorState);
-  cJSON_AddNumberToObject(root, "heater", get_heater_state());
-  float utemp = get_upper_temp();
-  if(temp_valid_p(utemp)){
-    cJSON_AddNumberToObject(root, "utempC", utemp);
-  }
-  cJSON_AddNumberToObject(root, "ttempC", TargetTemp);
-  cJSON_AddNumberToObject(root, "dryendsec", DryEndsAt);
-  char* s = cJSON_Print(root);
-  if(s){
-    mqtt_publish(s);
-    cJSON_free(s);
-  }else{
-    ESP_LOGE(TAG, "couldn't stringize JSON object");
+  // keep one rendering (the more compact, if we have both) for later
+  if(failed){
+    if(clen >= 0){
+      spool_append(TELEMETRY_FMT_CBOR, TelemetryCBOR, clen);
+    }else if(jlen >= 0){
+      spool_append(TELEMETRY_FMT_JSON, TelemetryJSON, jlen + 1);
+    }
   }
-  cJSON_Delete(root);
 }
 
 static void
@@ -978,49 +1156,220 @@ info(void){
   printf("\treported app %s version %s\n", appdesc->project_name, appdesc->version);
 }
 
-void app_main(void){
-  // FIXME turn off heater/motor as first thing
-  info();
-  load_device_id();
-  setup();
-  int64_t lastpub = esp_timer_get_time();
-  int64_t lasttachs = lastpub;
+// acquire the slow sensors (I2C load cell, tachometers, internal
+// thermometer), update the Last* values, and publish a sample to
+// SensorMailbox. this can block on I2C, which is why it's not done in the
+// control task.
+static void
+sensor_task(void* v){
+  sensor_sample ss = {
+    .ambient = q8_from_int(MIN_TEMP - 1),
+    .weight = -Q8_ONE,
+    .lrpm = UINT_MAX,
+    .urpm = UINT_MAX,
+    .smrpm = UINT_MAX,
+  };
   while(1){
-    vTaskDelay(pdMS_TO_TICKS(1000));
-    float ambient = getAmbient();
-    if(temp_valid_p(ambient)){
-      LastLowerTemp = ambient;
+    vTaskDelay(pdMS_TO_TICKS(SENSOR_PERIOD_MS));
+    ss.ambient = getAmbient();
+    ss.weight = getWeight();
+    if(weight_valid_p(ss.weight)){
+      LastWeight = ss.weight;
     }
-    float weight = getWeight();
-    if(weight_valid_p(weight)){
-      LastWeight = weight;
+    ESP_LOGD(TAG, "esp32 temp: %f weight: %f (%svalid)", q8_to_float(ss.ambient),
+             q8_to_float(ss.weight), weight_valid_p(ss.weight) ? "" : "in");
+    int64_t curtime = hal_now_us();
+    // speeds come from edge periods timestamped in ISR context, so they're
+    // fresh as of the most recent pulse, and no quantum is necessary.
+    const uint32_t smrpm = tach_mrpm(&HallTach, curtime);
+    if(spool_mrpm_valid_p(smrpm)){
+      LastSpoolMRPM = smrpm;
     }
-    printf("esp32 temp: %f weight: %f (%svalid)\n", ambient, weight,
-            weight_valid_p(weight) ? "" : "in");
-    printf("motor: %s heater: %s\n", motor_state(), heater_state_str());
-    int64_t curtime = esp_timer_get_time();
-    if(curtime - lasttachs > TACH_SAMPLE_QUANTUM_USEC){
-      const float diffu = curtime - lasttachs;
-      const float scale = 60.0 * 1000000u / diffu;
-			getPulseCount(scale, get_hall_count, &LastSpoolRPM);
-			getPulseCount(scale, get_lower_tach, &LastLowerRPM);
-			getPulseCount(scale, get_upper_tach, &LastUpperRPM);
-      lasttachs = curtime;
-      ESP_LOGI(TAG, "pwm-l: %u pwm-u: %u\n", get_lower_pwm(), get_upper_pwm());
+    update_rpm(get_lower_tach_rpm(curtime), &LastLowerRPM);
+    update_rpm(get_upper_tach_rpm(curtime), &LastUpperRPM);
+    ESP_LOGD(TAG, "mrpm-s: %" PRIu32 " rpm-l: %" PRIu32 " rpm-u: %" PRIu32 " pwm-l: %u pwm-u: %u",
+             LastSpoolMRPM, LastLowerRPM, LastUpperRPM, get_lower_pwm(), get_upper_pwm());
+    ss.lrpm = LastLowerRPM;
+    ss.urpm = LastUpperRPM;
+    ss.smrpm = LastSpoolMRPM;
+    ss.stamp = curtime;
+    xQueueOverwrite(SensorMailbox, &ss);
+    const batch_sample bs = {
+      .stamp = curtime,
+      .utemp = get_upper_temp_q8(),
+      .ltemp = ss.ambient,
+      .weight = ss.weight,
+      .hduty = get_heater_duty(),
+    };
+    taskENTER_CRITICAL(&SampleRingLock);
+    batch_ring_push(&SampleRing, &bs);
+    taskEXIT_CRITICAL(&SampleRingLock);
+  }
+}
+
+static void
+record_control_timing(int64_t exec, int64_t late){
+  if(late < 0){
+    late = -late;
+  }
+  taskENTER_CRITICAL(&ControlHistLock);
+  histogram_record(&ControlExecHist, exec > UINT32_MAX ? UINT32_MAX : exec);
+  histogram_record(&ControlJitterHist, late > UINT32_MAX ? UINT32_MAX : late);
+  taskEXIT_CRITICAL(&ControlHistLock);
+}
+
+// heater and motor management. this task has the highest priority of any
+// of ours, and never touches I2C or the network, so its latency is bounded
+// regardless of what the other tasks are doing. it is scheduled at a fixed
+// rate with xTaskDelayUntil(), so the period doesn't drift with the time
+// taken by each iteration. the period is reread each iteration, so a new
+// one applies from the next wakeup.
+static void
+control_task(void* v){
+  uint32_t periodms = ControlPeriodMS;
+  int64_t periodu = periodms * 1000ll;
+  ESP_LOGI(TAG, "running control loop every %" PRIu32 "ms", periodms);
+  TickType_t lastwake = xTaskGetTickCount();
+  int64_t expected = hal_now_us() + periodu;
+  while(1){
+    const uint32_t newms = ControlPeriodMS;
+    if(newms != periodms){
+      ESP_LOGI(TAG, "control period changed %" PRIu32 "->%" PRIu32 "ms", periodms, newms);
+      expected += (newms - (int64_t)periodms) * 1000;
+      periodms = newms;
+      periodu = periodms * 1000ll;
     }
-    //printf("dryends: %lld cursec: %lld\n", DryEndsAt, curtime);
-    if(DryEndsAt && curtime >= DryEndsAt){
-      printf("completed drying operation (%llu >= %llu)\n", curtime, DryEndsAt);
-      set_motor(false);
-      DryEndsAt = 0;
+    if(xTaskDelayUntil(&lastwake, pdMS_TO_TICKS(periodms)) == pdFALSE){
+      // we overran the period, and were not delayed at all
+      ESP_LOGW(TAG, "control loop overran %" PRIu32 "ms period", periodms);
     }
-    manage_heater(SSR_GPIN, DryEndsAt, TargetTemp);
-    if(curtime - lastpub > MQTT_PUBLISH_QUANTUM_USEC){
-      send_mqtt(curtime);
-      lastpub = curtime;
+    int64_t curtime = hal_now_us();
+    taskENTER_CRITICAL(&DryLock);
+    const bool expired = dry_expired(&Dry, curtime);
+    const drysched dry = Dry;
+    taskEXIT_CRITICAL(&DryLock);
+    if(expired){
+      printf("completed drying operation at %lld\n", curtime);
+      set_motor(false);
     }
+    manage_heater(SSR_GPIN, dry_active_p(&dry), dry.targtemp);
+    ESP_LOGD(TAG, "motor: %s heater: %s", motor_state(), heater_state_str());
     if(check_factory_reset(curtime)){
       factory_reset();
     }
+    telemetry t;
+    fill_telemetry(&t, curtime, &dry);
+    devstate_publish(&State, &t);
+    sse_kick();
+    record_history(&t);
+    record_control_timing(hal_now_us() - curtime, curtime - expected);
+    expected += periodu;
+    // if we fell more than a period behind, xTaskDelayUntil() will run us
+    // back-to-back to catch up; don't charge those as jitter forever.
+    if(curtime - expected > periodu){
+      expected = curtime + periodu;
+    }
+  }
+}
+
+// decide whether the snapshot t, taken at curtime, ought be published:
+// always if something discrete has changed (or we've never published),
+// every interval while the control state calls for the fast rate, if a
+// measurement has left its deadband and we've not published within the
+// state's interval, and otherwise once the heartbeat expires. SampleRing
+// thins itself to cover the longest of these, so it needn't force anything.
+static bool
+publish_due(const telemetry* t, int64_t curtime, bool* pending){
+  if(!Published){
+    return true;
+  }
+  const telemetry_change c = telemetry_compare(&LastPublished, t, &Deadbands);
+  if(c == TCHANGE_DISCRETE){
+    return true;
+  }
+  if(c == TCHANGE_ANALOG){
+    *pending = true;
+  }
+  telemetry_rates rates;
+  get_rates(&rates);
+  const telemetry_rate rate = telemetry_rate_of(t, &rates);
+  const int64_t since = curtime - LastPublishedUs;
+  if(since >= telemetry_rate_sec(rate, &rates) * 1000000ll){
+    if(*pending || rate == TRATE_FAST){
+      return true;
+    }
+  }
+  return since >= HeartbeatSec * 1000000ll;
+}
+
+// publish the most recent sensor sample along with the control state, as
+// dictated by publish_due(). we evaluate each time the sensors are read,
+// so that discrete changes go out within a sensor period. publishing can
+// block on the network for arbitrary periods, and thus this runs at our
+// lowest priority.
+static void
+telemetry_task(void* v){
+  // a measurement has left its deadband, but we're waiting out the quantum
+  bool pending = false;
+  while(1){
+    vTaskDelay(pdMS_TO_TICKS(SENSOR_PERIOD_MS));
+    persist_autotune();
+    // nothing worth publishing until the slow sensors have reported
+    if(uxQueueMessagesWaiting(SensorMailbox) == 0){
+      continue;
+    }
+    telemetry t;
+    if(get_telemetry(&t) == 0){
+      continue;
+    }
+    const int64_t curtime = hal_now_us();
+    if(!publish_due(&t, curtime, &pending)){
+      continue;
+    }
+    send_mqtt(&t);
+    t.exech = t.jitterh = NULL;
+    t.samples = NULL;
+    LastPublished = t;
+    LastPublishedUs = curtime;
+    Published = true;
+    pending = false;
+  }
+}
+
+static int
+start_tasks(void){
+  if((SensorMailbox = xQueueCreate(1, sizeof(sensor_sample))) == NULL){
+    ESP_LOGE(TAG, "error creating sensor mailbox");
+    return -1;
+  }
+  // start control first, so the heater is managed even if we fail to
+  // launch the others.
+  if(xTaskCreate(control_task, "control", TASK_STACK_BYTES, NULL,
+                 CONTROL_TASK_PRIO, NULL) != pdPASS){
+    ESP_LOGE(TAG, "error creating control task");
+    return -1;
+  }
+  if(xTaskCreate(sensor_task, "sensor", TASK_STACK_BYTES, NULL,
+                 SENSOR_TASK_PRIO, NULL) != pdPASS){
+    ESP_LOGE(TAG, "error creating sensor task");
+    return -1;
+  }
+  if(xTaskCreate(telemetry_task, "telemetry", TASK_STACK_BYTES, NULL,
+                 TELEMETRY_TASK_PRIO, NULL) != pdPASS){
+    ESP_LOGE(TAG, "error creating telemetry task");
+    return -1;
+  }
+  return 0;
+}
+
+void app_main(void){
+  // FIXME turn off heater/motor as first thing
+  info();
+  load_device_id();
+  setup();
+  if(start_tasks()){
+    // without a control task, we can't safely run the heater
+    set_heater(SSR_GPIN, false);
+    set_motor(false);
   }
 }
@@ -0,0 +1,18 @@
+#include "dry.h"
+
+int dry_schedule(drysched* d, unsigned seconds, unsigned temp, int64_t nowus){
+  if(temp > MAX_DRYREQ_TMP || temp < MIN_DRYREQ_TMP){
+    return -1;
+  }
+  d->endsus = seconds ? nowus + seconds * 1000000ll : 0;
+  d->targtemp = temp;
+  return 0;
+}
+
+bool dry_expired(drysched* d, int64_t nowus){
+  if(d->endsus && nowus >= d->endsus){
+    d->endsus = 0;
+    return true;
+  }
+  return false;
+}
@@ -0,0 +1,31 @@
+#ifndef DANKDRYER_DRY
+#define DANKDRYER_DRY
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// limits on requested drying temperatures
+#define MAX_DRYREQ_TMP 150
+#define MIN_DRYREQ_TMP 50
+
+// a drying schedule: heat to targtemp (with the spool turning) until endsus
+// on the esp_timer clock.
+typedef struct drysched {
+  int64_t endsus;     // 0 if no dry is scheduled
+  uint32_t targtemp;  // meaningful iff endsus != 0
+} drysched;
+
+// replace any existing schedule with a dry of seconds at temp, or cancel
+// it if seconds is 0. returns -1 (leaving the schedule untouched) on an
+// invalid temperature.
+int dry_schedule(drysched* d, unsigned seconds, unsigned temp, int64_t nowus);
+
+// returns true, clearing the schedule, iff a dry has run to completion.
+bool dry_expired(drysched* d, int64_t nowus);
+
+static inline bool
+dry_active_p(const drysched* d){
+  return d->endsus != 0;
+}
+
+#endif
@@ -1,23 +1,26 @@
 #include "dankdryer.h"
 #include "fans.h"
-#include "pins.h"
+#include "tach.h"
+#include "hal.h"
 #include <nvs.h>
-#include <string.h>
+#include <stdio.h>
+#include <inttypes.h>
 #include <esp_log.h>
-#include <driver/ledc.h>
-#include <driver/gpio.h>
 
 #define TAG "fans"
 
-#define FANPWM_BIT_NUM LEDC_TIMER_8_BIT
 #define RPMMAX (1u << 14u)
 #define LOWER_FANCHAN 0
 #define UPPER_FANCHAN 1
-#define LOWER_FANTIMER LEDC_TIMER_0
-#define UPPER_FANTIMER LEDC_TIMER_1
+// noctua fans emit two tach pulses per revolution. timestamping every
+// eight revolutions means ~5Hz of interrupts at their 2500 RPM maximum.
+#define FAN_PPR 2
+#define FAN_PULSES_PER_EVENT 16
+// slow enough to be useless for cooling
+#define FAN_STALL_USEC 5000000ll
 
-// variables manipulated by interrupts
-static _Atomic(uint32_t) LowerFanPulses, UpperFanPulses;
+// tachometers, timed in hardware
+static tach LowerTach, UpperTach;
 
 static uint32_t LowerPWM = 128;
 static uint32_t UpperPWM = 128;
@@ -28,12 +31,11 @@ pwm_valid_p(int pwm){
 }
 
 static int
-set_pwm(const ledc_channel_t channel, unsigned pwm){
-  if(ledc_set_duty_and_update(LEDCMODE, channel, pwm, MAXPWMDUTY) != ESP_OK){
-    ESP_LOGE(TAG, "error setting pwm!");
+set_pwm(unsigned channel, unsigned pwm){
+  if(hal_pwm_set(channel, pwm)){
     return -1;
   }
-  printf("set pwm to %u on channel %d\n", pwm, channel);
+  printf("set pwm to %u on channel %u\n", pwm, channel);
   return 0;
 }
 
@@ -87,7 +89,7 @@ int read_fans_pstore(nvs_handle_t nvsh){
     if(pwm_valid_p(lpwm)){
       LowerPWM = lpwm;
     }else{
-      ESP_LOGE(TAG, "read invalid lower pwm %lu", lpwm);
+      ESP_LOGE(TAG, "read invalid lower pwm %" PRIu32, lpwm);
     }
   }
   uint32_t upwm = get_upper_pwm();
@@ -95,81 +97,41 @@ int read_fans_pstore(nvs_handle_t nvsh){
     if(pwm_valid_p(upwm)){
       UpperPWM = upwm;
     }else{
-      ESP_LOGE(TAG, "read invalid upper pwm %lu", upwm);
+      ESP_LOGE(TAG, "read invalid upper pwm %" PRIu32, upwm);
     }
   }
   return 0;
 }
 
 static int
-initialize_pwm(ledc_channel_t channel, gpio_num_t pin, int freq, ledc_timer_t timer){
-  if(gpio_set_output(pin)){
-    return -1;
-  }
-  ledc_timer_config_t ledc_timer;
-  memset(&ledc_timer, 0, sizeof(ledc_timer));
-  ledc_timer.speed_mode = LEDCMODE;
-  ledc_timer.duty_resolution = FANPWM_BIT_NUM;
-  ledc_timer.timer_num = timer;
-  ledc_timer.freq_hz = freq;
-  if(ledc_timer_config(&ledc_timer) != ESP_OK){
-    ESP_LOGE(TAG, "error (timer config)!\n");
-    return -1;
-  }
-  ledc_channel_config_t conf;
-  memset(&conf, 0, sizeof(conf));
-  conf.gpio_num = pin;
-  conf.speed_mode = LEDCMODE;
-  conf.intr_type = LEDC_INTR_DISABLE;
-  conf.timer_sel = timer;
-  conf.duty = FANPWM_BIT_NUM;
-  conf.channel = channel;
-  printf("setting up pin %d for %dHz PWM\n", pin, freq);
-  if(ledc_channel_config(&conf) != ESP_OK){
-    ESP_LOGE(TAG, "error (channel config)!\n");
-    return -1;
-  }
-  return 0;
-}
-
-static int
-initialize_25k_pwm(ledc_channel_t channel, gpio_num_t pin, ledc_timer_t timer){
-  return initialize_pwm(channel, pin, 25000, timer);
+initialize_25k_pwm(unsigned channel, gpio_num_t pin){
+  return hal_pwm_setup(channel, pin, 25000);
 }
 
 int setup_fans(gpio_num_t lowerppin, gpio_num_t upperppin,
                gpio_num_t lowertpin, gpio_num_t uppertpin){
   int ret = 0;
-  esp_err_t e;
-  if((e = ledc_fade_func_install(0)) != ESP_OK){
-    ESP_LOGE(TAG, "error (%s) installing ledc interrupt", esp_err_to_name(e));
-    ret = -1;
-  }
-  if(setup_intr(lowertpin, &LowerFanPulses)){
+  if(setup_tach(&LowerTach, lowertpin, FAN_PULSES_PER_EVENT, FAN_PPR, FAN_STALL_USEC)){
     ret = -1;
   }
-  if(initialize_25k_pwm(LOWER_FANCHAN, lowerppin, LOWER_FANTIMER)
+  if(initialize_25k_pwm(LOWER_FANCHAN, lowerppin)
       || set_pwm(LOWER_FANCHAN, LowerPWM)){
     ret = -1;
   }
-  if(setup_intr(uppertpin, &UpperFanPulses)){
+  if(setup_tach(&UpperTach, uppertpin, FAN_PULSES_PER_EVENT, FAN_PPR, FAN_STALL_USEC)){
     ret = -1;
   }
-  if(initialize_25k_pwm(UPPER_FANCHAN, upperppin, UPPER_FANTIMER)
+  if(initialize_25k_pwm(UPPER_FANCHAN, upperppin)
       || set_pwm(UPPER_FANCHAN, UpperPWM)){
     ret = -1;
   }
   return ret;
 }
 
-uint32_t get_lower_tach(void){
-  uint32_t r = LowerFanPulses;
-  LowerFanPulses = 0;
-  return r;
+uint32_t get_lower_tach_rpm(int64_t now){
+  return tach_rpm(&LowerTach, now);
 }
 
-uint32_t get_upper_tach(void){
-  uint32_t r = UpperFanPulses;
-  UpperFanPulses = 0;
-  return r;
+uint32_t get_upper_tach_rpm(int64_t now){
+  return tach_rpm(&UpperTach, now);
 }
@@ -5,11 +5,6 @@
 #include <stdint.h>
 #include <soc/gpio_num.h>
 
-#ifdef LEDC_HIGH_SPEED_MODE
-#define LEDCMODE LEDC_HIGH_SPEED_MODE
-#else
-#define LEDCMODE LEDC_LOW_SPEED_MODE
-#endif
 #define MAXPWMDUTY 255
 #define LOWERPWM_RECNAME "lpwm"
 #define UPPERPWM_RECNAME "upwm"
@@ -21,7 +16,9 @@ void set_lower_pwm(unsigned pwm);
 void set_upper_pwm(unsigned pwm);
 unsigned get_lower_pwm(void);
 unsigned get_upper_pwm(void);
-uint32_t get_lower_tach(void);
-uint32_t get_upper_tach(void);
+
+// fan speeds as of 'now', derived from tach periods. see tach_rpm().
+uint32_t get_lower_tach_rpm(int64_t now);
+uint32_t get_upper_tach_rpm(int64_t now);
 
 #endif
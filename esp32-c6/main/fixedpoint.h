@@ -0,0 +1,67 @@
+#ifndef DANKDRYER_FIXEDPOINT
+#define DANKDRYER_FIXEDPOINT
+
+#include <math.h>
+#include <stdint.h>
+
+// the esp32-c6's RISC-V core has no FPU, so every float operation is a
+// libgcc call. the acquisition->filter->control path instead works in Q8
+// fixed point (signed, 8 fractional bits): temperatures in 1/256 C and
+// masses in 1/256 load cell units. this gives us +-8M integral range,
+// enough for either. floats appear only at the telemetry and HTTP
+// boundaries (and when reading the float-valued internal thermometer).
+typedef int32_t q8_t;
+
+#define Q8_FRACBITS 8
+#define Q8_ONE (1 << Q8_FRACBITS)
+
+static inline q8_t
+q8_from_int(int32_t i){
+  return i * Q8_ONE;
+}
+
+// rounds towards negative infinity
+static inline int32_t
+q8_to_int(q8_t q){
+  return q >> Q8_FRACBITS;
+}
+
+// for use only at boundaries
+static inline q8_t
+q8_from_float(float f){
+  return lrintf(f * Q8_ONE);
+}
+
+// for use only at boundaries
+static inline float
+q8_to_float(q8_t q){
+  return q / (float)Q8_ONE;
+}
+
+// rounded to the nearest integer
+static inline int32_t
+q8_round(q8_t q){
+  return ((int64_t)q + Q8_ONE / 2) >> Q8_FRACBITS;
+}
+
+// rounded to the nearest tenth, in tenths
+static inline int32_t
+q8_to_tenths(q8_t q){
+  return ((int64_t)q * 10 + Q8_ONE / 2) >> Q8_FRACBITS;
+}
+
+// num / den as Q8. when den is a compile-time constant (as it is everywhere
+// we use this), the division becomes a multiply.
+static inline q8_t
+q8_ratio(int32_t num, int32_t den){
+  return ((int64_t)num * Q8_ONE) / den;
+}
+
+// scale a 'bits'-bit unsigned ADC reading against its full-scale value,
+// yielding Q8 units of fullscale. requires bits >= Q8_FRACBITS.
+static inline q8_t
+q8_scale(int32_t raw, int32_t fullscale, unsigned bits){
+  return ((int64_t)raw * fullscale) >> (bits - Q8_FRACBITS);
+}
+
+#endif
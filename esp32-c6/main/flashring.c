@@ -0,0 +1,116 @@
+#include "flashring.h"
+#include <stdbool.h>
+#include <esp_log.h>
+#include <inttypes.h>
+#include <esp_rom_crc.h>
+
+#define TAG "flashring"
+
+void flashring_init(flashring* r, const char* name, const esp_partition_t* part,
+                    uint32_t magic, unsigned first, unsigned sectors){
+  r->name = name;
+  r->part = part;
+  r->magic = magic;
+  r->sectorbytes = part->erase_size;
+  r->first = first;
+  r->sectors = sectors;
+  r->head = 0;
+  r->seq = 0;
+}
+
+static uint32_t
+hdr_crc(const flashring_hdr* sh){
+  return esp_rom_crc32_le(0, (const uint8_t*)sh, offsetof(flashring_hdr, crc));
+}
+
+int flashring_read_hdr(const flashring* r, unsigned sector, flashring_hdr* sh){
+  esp_err_t e = esp_partition_read(r->part, flashring_addr(r, sector), sh, sizeof(*sh));
+  if(e != ESP_OK){
+    ESP_LOGE(TAG, "error (%s) reading %s sector %u", esp_err_to_name(e), r->name, sector);
+    return -1;
+  }
+  if(sh->magic != r->magic || sh->crc != hdr_crc(sh)){
+    return -1;
+  }
+  return 0;
+}
+
+int flashring_claim(flashring* r, unsigned sector){
+  flashring_hdr sh;
+  uint32_t erases = 0;
+  if(flashring_read_hdr(r, sector, &sh) == 0){
+    erases = sh.erases;
+  }
+  const size_t addr = flashring_addr(r, sector);
+  esp_err_t e = esp_partition_erase_range(r->part, addr, r->sectorbytes);
+  if(e != ESP_OK){
+    ESP_LOGE(TAG, "error (%s) erasing %s sector %u", esp_err_to_name(e), r->name, sector);
+    return -1;
+  }
+  sh.magic = r->magic;
+  sh.seq = ++r->seq;
+  sh.erases = erases + 1;
+  sh.crc = hdr_crc(&sh);
+  e = esp_partition_write(r->part, addr, &sh, sizeof(sh));
+  if(e != ESP_OK){
+    ESP_LOGE(TAG, "error (%s) writing %s sector %u", esp_err_to_name(e), r->name, sector);
+    return -1;
+  }
+  r->head = sector;
+  return 0;
+}
+
+int flashring_mount(flashring* r){
+  bool found = false;
+  uint32_t maxerases = 0;
+  for(unsigned s = 0 ; s < r->sectors ; ++s){
+    flashring_hdr sh;
+    if(flashring_read_hdr(r, s, &sh)){
+      continue;
+    }
+    if(!found || sh.seq > r->seq){
+      r->seq = sh.seq;
+      r->head = s;
+      found = true;
+    }
+    if(sh.erases > maxerases){
+      maxerases = sh.erases;
+    }
+  }
+  if(!found){
+    ESP_LOGI(TAG, "formatting %s (%u sectors)", r->name, r->sectors);
+    r->seq = 0;
+    return flashring_claim(r, 0) ? -1 : 1;
+  }
+  ESP_LOGI(TAG, "%s: %u sectors, head %u (seq %" PRIu32 "), max erases %" PRIu32,
+           r->name, r->sectors, r->head, r->seq, maxerases);
+  return 0;
+}
+
+// sectors are claimed in ring order, so the oldest is the first valid one
+// following the head
+unsigned flashring_oldest(const flashring* r, uint32_t* seq){
+  for(unsigned i = 1 ; i < r->sectors ; ++i){
+    flashring_hdr sh;
+    const unsigned s = (r->head + i) % r->sectors;
+    if(flashring_read_hdr(r, s, &sh) == 0){
+      *seq = sh.seq;
+      return s;
+    }
+  }
+  *seq = r->seq;
+  return r->head;
+}
+
+int flashring_find(const flashring* r, uint32_t seq){
+  const uint32_t age = r->seq - seq;
+  if(age >= r->sectors){
+    return -1;
+  }
+  const unsigned s = (r->head + r->sectors - age) % r->sectors;
+  flashring_hdr sh;
+  if(flashring_read_hdr(r, s, &sh) || sh.seq != seq){
+    return -1;
+  }
+  return s;
+}
@@ -0,0 +1,64 @@
+#ifndef DANKDRYER_FLASHRING
+#define DANKDRYER_FLASHRING
+
+// a ring of flash sectors within a partition, as used by the spool and
+// histstore for their logs. each sector begins with a header carrying a
+// sequence number; the sector with the highest is the head (the one being
+// written), and the others follow it around the ring in sequence order.
+// the head moves on by erasing the next sector, so every sector is erased
+// once per trip around the ring, and wear is level. what follows each
+// header is up to the user, as is any locking.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <esp_partition.h>
+
+typedef struct flashring_hdr {
+  uint32_t magic;
+  uint32_t seq;
+  uint32_t erases;  // for diagnostics
+  uint32_t crc;     // of the preceding fields
+} flashring_hdr;
+
+typedef struct flashring {
+  const char* name;             // for diagnostics
+  const esp_partition_t* part;
+  uint32_t magic;               // distinguishes users of the ring
+  size_t sectorbytes;
+  unsigned first, sectors;      // within the partition
+  unsigned head;                // the sector being written, within the ring
+  uint32_t seq;                 // of head
+} flashring;
+
+// describe a ring of sectors sectors of part, starting at its first'th.
+// nothing is read until flashring_mount().
+void flashring_init(flashring* r, const char* name, const esp_partition_t* part,
+                    uint32_t magic, unsigned first, unsigned sectors);
+
+// find the head. if no sector has a valid header, the ring is formatted
+// (with sector 0 claimed as the head), and 1 is returned. otherwise,
+// returns 0, or -1 on error.
+int flashring_mount(flashring* r);
+
+// the offset of sector within the partition
+static inline size_t
+flashring_addr(const flashring* r, unsigned sector){
+  return (r->first + sector) * r->sectorbytes;
+}
+
+// returns 0 and fills in sh if sector holds a valid header
+int flashring_read_hdr(const flashring* r, unsigned sector, flashring_hdr* sh);
+
+// erase sector and make it the head, with the next sequence number. its
+// erase count is carried over (we keep nothing else of it).
+int flashring_claim(flashring* r, unsigned sector);
+
+// the oldest sector with a valid header (the head, if there are no others),
+// and its sequence number
+unsigned flashring_oldest(const flashring* r, uint32_t* seq);
+
+// the sector with sequence number seq, or -1 if it's been reclaimed (or
+// never existed)
+int flashring_find(const flashring* r, uint32_t seq);
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef DANKDRYER_HAL
+#define DANKDRYER_HAL
+
+// the thin hardware abstraction through which the control modules (heater,
+// fans, reset, tach, and the relays in dankdryer.c) reach peripherals.
+// hal_esp.c implements it with ESP-IDF drivers. host/hal_linux.c implements
+// it with simulated peripherals, so that those modules build and run as a
+// Linux executable (host/dryerhost.c). logging and NVS keep their ESP-IDF
+// APIs; the host build supplies them from host/include.
+//
+// unless otherwise noted, functions return 0 on success, and -1 on error
+// (having logged it).
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <soc/gpio_num.h>
+
+// monotonic microseconds since boot. safe to call from interrupts.
+#ifdef ESP_PLATFORM
+#include <esp_timer.h>
+static inline int64_t
+hal_now_us(void){
+  return esp_timer_get_time();
+}
+#else
+int64_t hal_now_us(void);
+#endif
+
+// interrupt-context callback
+typedef void (*hal_isr_fn)(void* arg);
+
+int hal_gpio_output(gpio_num_t pin);
+int hal_gpio_input(gpio_num_t pin, bool pullup, bool pulldown);
+int hal_gpio_opendrain(gpio_num_t pin);
+// set the level of an output pin
+int hal_gpio_level(gpio_num_t pin, bool level);
+// read the level of an input pin
+int hal_gpio_get(gpio_num_t pin);
+// call fn(arg) on every edge of an input pin
+int hal_gpio_on_edge(gpio_num_t pin, hal_isr_fn fn, void* arg);
+
+// 8-bit PWM at freq Hz on pin. each channel gets its own timer.
+int hal_pwm_setup(unsigned channel, gpio_num_t pin, unsigned freq);
+int hal_pwm_set(unsigned channel, unsigned duty);
+
+// count (glitch-filtered) falling edges on pin, calling fn(arg) every
+// 'pulses' of them.
+int hal_pulse_counter(gpio_num_t pin, unsigned pulses, hal_isr_fn fn, void* arg);
+
+// continuously sample the analog thermometer on pin, decimating in the
+// background.
+int hal_therm_start(gpio_num_t pin);
+// get the most recent decimated reading in mV, and the hal_now_us() at
+// which it was taken. returns -1 if we have no reading.
+int hal_therm_read(int32_t* mv, int64_t* stampus);
+
+// short critical sections, safe against other tasks (and on the esp32, the
+// other core and ISRs).
+#ifdef ESP_PLATFORM
+#include <freertos/FreeRTOS.h>
+typedef portMUX_TYPE hal_lock;
+#define HAL_LOCK_INITIALIZER portMUX_INITIALIZER_UNLOCKED
+#define hal_lock_enter(l) taskENTER_CRITICAL(l)
+#define hal_lock_exit(l) taskEXIT_CRITICAL(l)
+#else
+#include <pthread.h>
+typedef pthread_mutex_t hal_lock;
+#define HAL_LOCK_INITIALIZER PTHREAD_MUTEX_INITIALIZER
+#define hal_lock_enter(l) pthread_mutex_lock(l)
+#define hal_lock_exit(l) pthread_mutex_unlock(l)
+#endif
+
+#endif
@@ -0,0 +1,408 @@
+#include "hal.h"
+#include "pins.h"
+#include <string.h>
+#include <esp_log.h>
+#include <esp_attr.h>
+#include <stdatomic.h>
+#include <driver/gpio.h>
+#include <driver/ledc.h>
+#include <freertos/task.h>
+#include <driver/pulse_cnt.h>
+#include <esp_adc/adc_cali_scheme.h>
+#include <esp_adc/adc_continuous.h>
+
+#define TAG "hal"
+
+// gpio_reset_pin() disables input and output, selects for GPIO, enables
+// pullup, and disables pulldown.
+static int
+gpio_setup(gpio_num_t pin, gpio_mode_t mode, const char *mstr){
+  gpio_reset_pin(pin);
+  esp_err_t err;
+  if((err = gpio_set_direction(pin, mode)) != ESP_OK){
+    ESP_LOGE(TAG, "failure (%s) setting %d to %s", esp_err_to_name(err), pin, mstr);
+    return -1;
+  }
+  return 0;
+}
+
+int hal_gpio_output(gpio_num_t pin){
+  return gpio_setup(pin, GPIO_MODE_OUTPUT, "output");
+}
+
+int hal_gpio_opendrain(gpio_num_t pin){
+  return gpio_setup(pin, GPIO_MODE_INPUT_OUTPUT_OD, "input+output(od)");
+}
+
+static int
+gpio_pulls(gpio_num_t pin, bool pullup, bool pulldown){
+  esp_err_t e;
+  if((e = pullup ? gpio_pullup_en(pin) : gpio_pullup_dis(pin)) != ESP_OK){
+    ESP_LOGE(TAG, "error (%s) setting pullup on %d", esp_err_to_name(e), pin);
+    return -1;
+  }
+  if((e = pulldown ? gpio_pulldown_en(pin) : gpio_pulldown_dis(pin)) != ESP_OK){
+    ESP_LOGE(TAG, "error (%s) setting pulldown on %d", esp_err_to_name(e), pin);
+    return -1;
+  }
+  return 0;
+}
+
+int hal_gpio_input(gpio_num_t pin, bool pullup, bool pulldown){
+  if(gpio_setup(pin, GPIO_MODE_INPUT, "input")){
+    return -1;
+  }
+  return gpio_pulls(pin, pullup, pulldown);
+}
+
+int hal_gpio_level(gpio_num_t pin, bool level){
+  esp_err_t e = gpio_set_level(pin, level);
+  if(e != ESP_OK){
+    ESP_LOGE(TAG, "error (%s) setting pin %d to %u", esp_err_to_name(e), pin, level);
+    return -1;
+  }
+  return 0;
+}
+
+int hal_gpio_get(gpio_num_t pin){
+  return gpio_get_level(pin);
+}
+
+// requires that gpio_install_isr_service() has been called
+int hal_gpio_on_edge(gpio_num_t pin, hal_isr_fn fn, void* arg){
+  esp_err_t e;
+  if((e = gpio_set_intr_type(pin, GPIO_INTR_ANYEDGE)) != ESP_OK){
+    ESP_LOGE(TAG, "failure (%s) installing %d interrupt", esp_err_to_name(e), pin);
+    return -1;
+  }
+  if((e = gpio_isr_handler_add(pin, fn, arg)) != ESP_OK){
+    ESP_LOGE(TAG, "failure (%s) setting %d isr", esp_err_to_name(e), pin);
+    return -1;
+  }
+  if((e = gpio_intr_enable(pin)) != ESP_OK){
+    ESP_LOGE(TAG, "failure (%s) enabling %d interrupt", esp_err_to_name(e), pin);
+    return -1;
+  }
+  return 0;
+}
+
+#ifdef LEDC_HIGH_SPEED_MODE
+#define LEDCMODE LEDC_HIGH_SPEED_MODE
+#else
+#define LEDCMODE LEDC_LOW_SPEED_MODE
+#endif
+#define PWM_BIT_NUM LEDC_TIMER_8_BIT
+#define PWM_MAXDUTY 255
+
+int hal_pwm_setup(unsigned channel, gpio_num_t pin, unsigned freq){
+  static bool fadeinstalled;
+  esp_err_t e;
+  if(!fadeinstalled){
+    if((e = ledc_fade_func_install(0)) != ESP_OK){
+      ESP_LOGE(TAG, "error (%s) installing ledc interrupt", esp_err_to_name(e));
+      return -1;
+    }
+    fadeinstalled = true;
+  }
+  if(hal_gpio_output(pin)){
+    return -1;
+  }
+  ledc_timer_config_t ledc_timer;
+  memset(&ledc_timer, 0, sizeof(ledc_timer));
+  ledc_timer.speed_mode = LEDCMODE;
+  ledc_timer.duty_resolution = PWM_BIT_NUM;
+  ledc_timer.timer_num = channel;
+  ledc_timer.freq_hz = freq;
+  if(ledc_timer_config(&ledc_timer) != ESP_OK){
+    ESP_LOGE(TAG, "error (timer config)!");
+    return -1;
+  }
+  ledc_channel_config_t conf;
+  memset(&conf, 0, sizeof(conf));
+  conf.gpio_num = pin;
+  conf.speed_mode = LEDCMODE;
+  conf.intr_type = LEDC_INTR_DISABLE;
+  conf.timer_sel = channel;
+  conf.duty = PWM_BIT_NUM;
+  conf.channel = channel;
+  printf("setting up pin %d for %uHz PWM\n", pin, freq);
+  if(ledc_channel_config(&conf) != ESP_OK){
+    ESP_LOGE(TAG, "error (channel config)!");
+    return -1;
+  }
+  return 0;
+}
+
+int hal_pwm_set(unsigned channel, unsigned duty){
+  if(ledc_set_duty_and_update(LEDCMODE, channel, duty, PWM_MAXDUTY) != ESP_OK){
+    ESP_LOGE(TAG, "error setting pwm!");
+    return -1;
+  }
+  return 0;
+}
+
+// pulse timing via the PCNT peripheral (the esp32-c6 has four units).
+// edges are counted and glitch-filtered in hardware. every 'pulses' edges,
+// the unit reaches its limit and resets, and we call back.
+// reject pulses shorter than this. the PCNT filter is limited to 1023 APB
+// cycles (~12.7us at 80MHz); the fastest tach we see is ~83Hz.
+#define PCNT_GLITCH_NS 10000
+#define PCNT_UNITS 4
+
+typedef struct pulse_counter {
+  hal_isr_fn fn;
+  void* arg;
+} pulse_counter;
+
+static pulse_counter Counters[PCNT_UNITS];
+static unsigned CounterCount;
+
+// runs in ISR context each time the unit reaches its limit (and resets)
+static bool IRAM_ATTR
+pcnt_reach_cb(pcnt_unit_handle_t unit, const pcnt_watch_event_data_t* edata,
+              void* arg){
+  const pulse_counter* pc = arg;
+  pc->fn(pc->arg);
+  return false;
+}
+
+int hal_pulse_counter(gpio_num_t pin, unsigned pulses, hal_isr_fn fn, void* arg){
+  if(CounterCount == PCNT_UNITS){
+    ESP_LOGE(TAG, "no pcnt unit available for %d", pin);
+    return -1;
+  }
+  pulse_counter* pc = &Counters[CounterCount];
+  pc->fn = fn;
+  pc->arg = arg;
+  pcnt_unit_config_t uconf = {
+    .high_limit = pulses,
+    .low_limit = -1,
+  };
+  pcnt_unit_handle_t unit;
+  esp_err_t e;
+  if((e = pcnt_new_unit(&uconf, &unit)) != ESP_OK){
+    ESP_LOGE(TAG, "error (%s) creating pcnt unit for %d", esp_err_to_name(e), pin);
+    return -1;
+  }
+  pcnt_glitch_filter_config_t fconf = {
+    .max_glitch_ns = PCNT_GLITCH_NS,
+  };
+  if((e = pcnt_unit_set_glitch_filter(unit, &fconf)) != ESP_OK){
+    ESP_LOGE(TAG, "error (%s) setting glitch filter on %d", esp_err_to_name(e), pin);
+    return -1;
+  }
+  pcnt_chan_config_t cconf = {
+    .edge_gpio_num = pin,
+    .level_gpio_num = -1,
+  };
+  pcnt_channel_handle_t chan;
+  if((e = pcnt_new_channel(unit, &cconf, &chan)) != ESP_OK){
+    ESP_LOGE(TAG, "error (%s) creating pcnt channel on %d", esp_err_to_name(e), pin);
+    return -1;
+  }
+  // count only falling edges
+  if((e = pcnt_channel_set_edge_action(chan, PCNT_CHANNEL_EDGE_ACTION_HOLD,
+                                       PCNT_CHANNEL_EDGE_ACTION_INCREASE)) != ESP_OK){
+    ESP_LOGE(TAG, "error (%s) setting edge action on %d", esp_err_to_name(e), pin);
+    return -1;
+  }
+  // reaching the high limit resets the count; that's our event
+  if((e = pcnt_unit_add_watch_point(unit, pulses)) != ESP_OK){
+    ESP_LOGE(TAG, "error (%s) adding watch point on %d", esp_err_to_name(e), pin);
+    return -1;
+  }
+  pcnt_event_callbacks_t cbs = {
+    .on_reach = pcnt_reach_cb,
+  };
+  if((e = pcnt_unit_register_event_callbacks(unit, &cbs, pc)) != ESP_OK){
+    ESP_LOGE(TAG, "error (%s) registering callback on %d", esp_err_to_name(e), pin);
+    return -1;
+  }
+  // the channel configures the pin as an input; restore our pulls
+  if(gpio_pulls(pin, false, true)){
+    return -1;
+  }
+  if((e = pcnt_unit_enable(unit)) != ESP_OK){
+    ESP_LOGE(TAG, "error (%s) enabling pcnt unit on %d", esp_err_to_name(e), pin);
+    return -1;
+  }
+  if((e = pcnt_unit_clear_count(unit)) != ESP_OK){
+    ESP_LOGE(TAG, "error (%s) clearing pcnt unit on %d", esp_err_to_name(e), pin);
+    return -1;
+  }
+  if((e = pcnt_unit_start(unit)) != ESP_OK){
+    ESP_LOGE(TAG, "error (%s) starting pcnt unit on %d", esp_err_to_name(e), pin);
+    return -1;
+  }
+  // deleting a unit requires its channels to be deleted first, so on the
+  // failure paths above we leak them; we're going to flag a startup
+  // failure regardless.
+  ++CounterCount;
+  return 0;
+}
+
+// the thermometer is sampled continuously by the ADC's DMA engine at
+// THERM_SAMPLE_HZ, and decimated by a background task into a mean over
+// THERM_DECIMATE samples. the control path only ever reads the latest
+// decimated value, never the ADC itself.
+#define THERM_SAMPLE_HZ 4000
+#define THERM_DECIMATE 1024 // ~256ms per output
+#define THERM_FRAME_BYTES (64 * SOC_ADC_DIGI_RESULT_BYTES)
+#define THERM_TASK_PRIO 9   // just below the control task
+#define THERM_STACK_BYTES 3072
+// give up on a read after this long
+#define THERM_TIMEOUT_MS 2000
+
+static bool ADC1Calibrated;
+static adc_channel_t Thermchan;
+static adc_continuous_handle_t ADC1;
+static adc_cali_handle_t ADC1Calibration;
+
+// most recent decimated reading, published by the decimation task
+static _Atomic(int32_t) ThermMV;
+static _Atomic(int64_t) ThermStampUs;
+static _Atomic(bool) ThermValid;
+
+// initialize and calibrate continuous sampling of Thermchan on an ADC unit
+// (the esp32-c6 has only ADC1, which supports GPIO 0--6).
+static int
+setup_adc_continuous(adc_unit_t unit, adc_continuous_handle_t* handle,
+                     adc_cali_handle_t* cali, bool* calibrated){
+  *calibrated = false;
+  adc_continuous_handle_cfg_t hcfg = {
+    .max_store_buf_size = THERM_FRAME_BYTES * 4,
+    .conv_frame_size = THERM_FRAME_BYTES,
+  };
+  esp_err_t e;
+  if((e = adc_continuous_new_handle(&hcfg, handle)) != ESP_OK){
+    ESP_LOGE(TAG, "error (%s) getting adc unit", esp_err_to_name(e));
+    return -1;
+  }
+  // the ADC is designed around a 1100mV maximum input value. the LMT87 send
+  // a value between 3277 mV (-50C) and 538 mV (150C). to handle such values,
+  // we need attenuate the input signal. 12dB gives us up to 2450 mV, the
+  // furthest we can go. to get the full range, we'd need a voltage divider
+  // (something like 1000 + 470 ought work well). we don't really care about
+  // such low values, so 12dB it is.
+  adc_digi_pattern_config_t pattern = {
+    .atten = ADC_ATTEN_DB_12,
+    .channel = Thermchan,
+    .unit = unit,
+    .bit_width = SOC_ADC_DIGI_MAX_BITWIDTH,
+  };
+  adc_continuous_config_t ccfg = {
+    .pattern_num = 1,
+    .adc_pattern = &pattern,
+    .sample_freq_hz = THERM_SAMPLE_HZ,
+    .conv_mode = ADC_CONV_SINGLE_UNIT_1,
+    .format = ADC_DIGI_OUTPUT_FORMAT_TYPE2,
+  };
+  if((e = adc_continuous_config(*handle, &ccfg)) != ESP_OK){
+    ESP_LOGE(TAG, "error (%s) configuring adc channel", esp_err_to_name(e));
+    adc_continuous_deinit(*handle);
+    return -1;
+  }
+  adc_cali_curve_fitting_config_t caliconf = {
+    .bitwidth = SOC_ADC_DIGI_MAX_BITWIDTH,
+    .atten = pattern.atten,
+    .unit_id = unit,
+    .chan = Thermchan,
+  };
+  if((e = adc_cali_create_scheme_curve_fitting(&caliconf, cali)) != ESP_OK){
+    ESP_LOGE(TAG, "error (%s) creating adc calibration", esp_err_to_name(e));
+    // go ahead and use the (uncalibrated) ADC if we must
+  }else{
+    ESP_LOGI(TAG, "using curve fitting adc calibration");
+    *calibrated = true;
+  }
+  return 0;
+}
+
+// convert a (decimated) raw reading to millivolts
+static int32_t
+raw_to_mv(int raw){
+  if(ADC1Calibrated){
+    int mv;
+    esp_err_t e;
+    if((e = adc_cali_raw_to_voltage(ADC1Calibration, raw, &mv)) == ESP_OK){
+      return mv;
+    }
+    ESP_LOGE(TAG, "error (%s) calibrating adc value %d", esp_err_to_name(e), raw);
+  }
+  // Dmax is 4095 at 12 bits
+  // Vmax is 3100mA with ADC_ATTEN_DB_12, 1750 with _6, 1250 w/ _2_5
+  // result is read * Vmax / Dmax
+  return raw * 1750 / 4095;
+}
+
+// pull frames from the DMA engine, accumulate THERM_DECIMATE samples, and
+// publish their mean with a timestamp.
+static void
+therm_task(void* v){
+  uint8_t frame[THERM_FRAME_BYTES];
+  uint32_t sum = 0;
+  unsigned count = 0;
+  while(1){
+    uint32_t got;
+    esp_err_t e = adc_continuous_read(ADC1, frame, sizeof(frame), &got, THERM_TIMEOUT_MS);
+    if(e == ESP_ERR_TIMEOUT){
+      ESP_LOGE(TAG, "timed out reading adc");
+      atomic_store(&ThermValid, false);
+      continue;
+    }else if(e != ESP_OK){
+      ESP_LOGE(TAG, "error (%s) reading adc", esp_err_to_name(e));
+      atomic_store(&ThermValid, false);
+      vTaskDelay(pdMS_TO_TICKS(THERM_TIMEOUT_MS));
+      continue;
+    }
+    for(uint32_t i = 0 ; i + SOC_ADC_DIGI_RESULT_BYTES <= got ; i += SOC_ADC_DIGI_RESULT_BYTES){
+      const adc_digi_output_data_t* p = (const adc_digi_output_data_t*)&frame[i];
+      if(p->type2.channel != Thermchan){
+        continue;
+      }
+      sum += p->type2.data;
+      if(++count == THERM_DECIMATE){
+        int raw = (sum + THERM_DECIMATE / 2) / THERM_DECIMATE;
+        atomic_store(&ThermMV, raw_to_mv(raw));
+        atomic_store(&ThermStampUs, hal_now_us());
+        atomic_store(&ThermValid, true);
+        sum = 0;
+        count = 0;
+      }
+    }
+  }
+}
+
+int hal_therm_start(gpio_num_t pin){
+  if(hal_gpio_input(pin, false, false)){
+    return -1;
+  }
+  adc_unit_t unit;
+  esp_err_t e;
+  if((e = adc_continuous_io_to_channel(pin, &unit, &Thermchan)) != ESP_OK){
+    ESP_LOGE(TAG, "error (%s) getting adc channel for %d", esp_err_to_name(e), pin);
+    return -1;
+  }
+  if(setup_adc_continuous(unit, &ADC1, &ADC1Calibration, &ADC1Calibrated)){
+    return -1;
+  }
+  if((e = adc_continuous_start(ADC1)) != ESP_OK){
+    ESP_LOGE(TAG, "error (%s) starting adc", esp_err_to_name(e));
+    return -1;
+  }
+  if(xTaskCreate(therm_task, "therm", THERM_STACK_BYTES, NULL,
+                 THERM_TASK_PRIO, NULL) != pdPASS){
+    ESP_LOGE(TAG, "error creating thermometer task");
+    return -1;
+  }
+  return 0;
+}
+
+int hal_therm_read(int32_t* mv, int64_t* stampus){
+  if(!atomic_load(&ThermValid)){
+    return -1;
+  }
+  *stampus = atomic_load(&ThermStampUs);
+  *mv = atomic_load(&ThermMV);
+  return 0;
+}
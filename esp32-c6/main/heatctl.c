@@ -0,0 +1,58 @@
+#include "heatctl.h"
+
+void heatctl_init(heatctl* hc){
+  *hc = (heatctl)HEATCTL_INITIALIZER;
+}
+
+static void
+heatctl_reset(heatctl* hc){
+  hc->duty = 0;
+  pid_reset(&hc->pid);
+  hc->lastpidms = 0;
+}
+
+void heatctl_off(heatctl* hc){
+  if(autotune_active_p(&hc->at)){
+    autotune_abort(&hc->at);
+  }
+  heatctl_reset(hc);
+}
+
+void heatctl_autotune(heatctl* hc, unsigned temp, q8_t cur, int64_t nowms){
+  if(temp == 0){
+    if(autotune_active_p(&hc->at)){
+      autotune_abort(&hc->at);
+    }
+  }else{
+    autotune_start(&hc->at, q8_from_int(temp), cur, nowms);
+  }
+}
+
+bool heatctl_step(heatctl* hc, q8_t temp, bool drying, uint32_t targtemp,
+                  int64_t nowms){
+  if(autotune_active_p(&hc->at)){
+    bool on = autotune_update(&hc->at, temp, nowms);
+    if(hc->at.state == AUTOTUNE_DONE){
+      hc->pid.kp = hc->at.kp;
+      hc->pid.ki = hc->at.ki;
+      hc->pid.kd = 0;
+      hc->tuned = true;
+    }
+    heatctl_reset(hc);
+    hc->duty = on ? DUTY_MAX : 0;
+    return on;
+  }
+  // if there is no drying scheduled, the heater ought be off, independent
+  // of all other considerations.
+  if(!drying){
+    heatctl_reset(hc);
+    return false;
+  }
+  uint32_t dt = hc->lastpidms ? nowms - hc->lastpidms : 0;
+  hc->lastpidms = nowms;
+  hc->duty = pid_update(&hc->pid, q8_from_int(targtemp), temp, dt);
+  if(nowms - hc->windowstartms >= hc->windowms){
+    hc->windowstartms = nowms;
+  }
+  return (nowms - hc->windowstartms) * DUTY_MAX < (int64_t)hc->duty * hc->windowms;
+}
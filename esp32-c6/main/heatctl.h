@@ -0,0 +1,62 @@
+#ifndef DANKDRYER_HEATCTL
+#define DANKDRYER_HEATCTL
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "pid.h"
+#include "autotune.h"
+#include "fixedpoint.h"
+
+// the heater decision logic, free of any hardware: given a valid chamber
+// temperature each control period, decide whether the SSR ought be on.
+// normally this is the PID's duty applied as time-proportional output over
+// a window; while autotuning, it is the autotuner's relay. heater.c wraps
+// this with the thermometer and SSR; host tools drive it against a
+// simulated plant.
+
+// each window, the heater is on for the PID's duty fraction of the window.
+// the window is quantized to the control period, so ought be many periods.
+#define SSR_WINDOW_MS_DEFAULT 10000
+#define SSR_WINDOW_MS_MIN 1000
+#define SSR_WINDOW_MS_MAX 60000
+#define DUTY_MAX 1000 // permille
+
+typedef struct heatctl {
+  pid pid;
+  autotune at;
+  uint32_t windowms;
+  uint32_t duty;          // permille
+  int64_t windowstartms;
+  int64_t lastpidms;      // 0 if the PID has no history
+  bool tuned;             // autotune completed; set until the caller clears it
+} heatctl;
+
+#define HEATCTL_INITIALIZER { \
+  .pid = { \
+    .kp = PID_KP_DEFAULT, \
+    .ki = PID_KI_DEFAULT, \
+    .kd = PID_KD_DEFAULT, \
+    .outmax = DUTY_MAX, \
+    .izone = PID_IZONE_DEFAULT, \
+  }, \
+  .windowms = SSR_WINDOW_MS_DEFAULT, \
+}
+
+void heatctl_init(heatctl* hc);
+
+// the heater must be off (i.e. we have no valid temperature). aborts any
+// autotune, and forgets the controller's history.
+void heatctl_off(heatctl* hc);
+
+// start an autotune around temp from the current temperature cur, or abort
+// one in progress if temp is 0.
+void heatctl_autotune(heatctl* hc, unsigned temp, q8_t cur, int64_t nowms);
+
+// run one control period with a valid temperature. drying indicates
+// whether a dry is scheduled, in which case targtemp is its setpoint.
+// an autotune in progress overrides the drying schedule. returns whether
+// the heater ought be on.
+bool heatctl_step(heatctl* hc, q8_t temp, bool drying, uint32_t targtemp,
+                  int64_t nowms);
+
+#endif
@@ -1,83 +1,73 @@
 #include "dankdryer.h"
 #include "heater.h"
-#include "pins.h"
+#include "heatctl.h"
+#include "thermo.h"
+#include "hal.h"
 #include <esp_log.h>
-#include <soc/adc_channel.h>
-#include <esp_adc/adc_oneshot.h>
-#include <driver/temperature_sensor.h>
+#include <inttypes.h>
+#include <stdatomic.h>
 
 #define TAG "therm"
 
+// a decimated reading older than this is not used
+#define THERM_STALE_MS 2000
+
+// gains are stored as Q8 u32s; this bounds all of them
+#define PID_GAIN_MAX (10000 * Q8_ONE)
+
+#define PIDKP_RECNAME "pidkp"
+#define PIDKI_RECNAME "pidki"
+#define PIDKD_RECNAME "pidkd"
+#define PIDIZONE_RECNAME "pidizone"
+#define SSRWINDOW_RECNAME "ssrwindow"
+
+#define AUTOTUNE_ABORT UINT32_MAX
+
 static bool HeaterState;
-static float LastUpperTemp;
-static bool ADC1Calibrated;
-static adc_channel_t Thermchan;
-static adc_oneshot_unit_handle_t ADC1;
-static adc_cali_handle_t ADC1Calibration;
-
-// initialize and calibrate an ADC unit (ESP32-S3 has two, but ADC2 is
-// used by wifi). ADC1 supports GPIO 0--6.
-static int setup_adc_oneshot(adc_unit_t unit, adc_oneshot_unit_handle_t* handle,
-                             adc_cali_handle_t* cali, bool* calibrated){
-  *calibrated = false;
-  adc_oneshot_unit_init_cfg_t acfg = {
-    .unit_id = unit,
-    .ulp_mode = ADC_ULP_MODE_DISABLE,
-  };
-  esp_err_t e;
-  if((e = adc_oneshot_new_unit(&acfg, handle)) != ESP_OK){
-    ESP_LOGE(TAG, "error (%s) getting adc unit", esp_err_to_name(e));
-    return -1;
-  }
-  // the ADC is designed around a 1100mV maximum input value. the LMT87 send
-  // a value between 3277 mV (-50C) and 538 mV (150C). to handle such values,
-  // we need attenuate the input signal. 12dB gives us up to 2450 mV, the
-  // furthest we can go. to get the full range, we'd need a voltage divider
-  // (something like 1000 + 470 ought work well). we don't really care about
-  // such low values, so 12dB it is.
-  adc_oneshot_chan_cfg_t cconf = {
-    .bitwidth = ADC_BITWIDTH_DEFAULT,
-    .atten = ADC_ATTEN_DB_12,
-  };
-  if((e = adc_oneshot_config_channel(*handle, Thermchan, &cconf)) != ESP_OK){
-    ESP_LOGE(TAG, "error (%s) configuring adc channel", esp_err_to_name(e));
-    adc_oneshot_del_unit(*handle);
-    return -1;
-  }
-  adc_cali_curve_fitting_config_t caliconf = {
-    .bitwidth = cconf.bitwidth,
-    .atten = cconf.atten,
-    .unit_id = unit,
-    .chan = Thermchan,
-  };
-  if((e = adc_cali_create_scheme_curve_fitting(&caliconf, cali)) != ESP_OK){
-    ESP_LOGE(TAG, "error (%s) creating adc calibration", esp_err_to_name(e));
-    // go ahead and use the (uncalibrated) ADC if we must
-  }else{
-    ESP_LOGI(TAG, "using curve fitting adc calibration");
-    *calibrated = true;
-  }
-  return 0;
+static q8_t LastUpperTemp;
+static const thermo_table* Thermtable;
+// the heater controller runs in the control task; the lock protects it
+// against concurrent reads of autotune progress from the telemetry task.
+static heatctl Heat = HEATCTL_INITIALIZER;
+static hal_lock HeatLock = HAL_LOCK_INITIALIZER;
+static _Atomic(uint32_t) AutotuneReq;   // requested setpoint, or AUTOTUNE_ABORT
+static _Atomic(bool) AutotunePending;   // results not yet written to nvs
+
+// set up the thermometer pin for analog input, and start continuous
+// sampling.
+int setup_temp(gpio_num_t thermpin){
+  Thermtable = thermo_table_for_board();
+  ESP_LOGI(TAG, "using %s transfer function", Thermtable->name);
+  return hal_therm_start(thermpin);
 }
 
-// the esp32-s3 has a built in temperature sensor, which we enable.
-// we furthermore set up the LM35 pin for input/ADC.
-int setup_temp(gpio_num_t thermpin, adc_unit_t unit){
-  if(gpio_set_input(thermpin)){
-    return -1;
-  }
-  esp_err_t e;
-  if((e = gpio_pullup_dis(thermpin)) != ESP_OK){
-    ESP_LOGE(TAG, "error (%s) disabling pullup on %d", esp_err_to_name(e), thermpin);
-    return -1;
-  }
-  if((e = adc_oneshot_io_to_channel(thermpin, &unit, &Thermchan)) != ESP_OK){
-    ESP_LOGE(TAG, "error (%s) getting adc channel for %d", esp_err_to_name(e), thermpin);
-    return -1;
+// read a Q8 gain, leaving *gain unchanged if the record is absent or invalid
+static void
+read_gain(nvs_handle_t nvsh, const char* recname, int32_t* gain){
+  uint32_t v = *gain;
+  if(nvs_get_opt_u32(nvsh, recname, &v) == 0){
+    if(v <= PID_GAIN_MAX){
+      *gain = v;
+    }else{
+      ESP_LOGE(TAG, "read invalid %s %" PRIu32, recname, v);
+    }
   }
-  if(setup_adc_oneshot(ADC_UNIT_1, &ADC1, &ADC1Calibration, &ADC1Calibrated)){
-    return -1;
+}
+
+int read_heater_pstore(nvs_handle_t nvsh){
+  read_gain(nvsh, PIDKP_RECNAME, &Heat.pid.kp);
+  read_gain(nvsh, PIDKI_RECNAME, &Heat.pid.ki);
+  read_gain(nvsh, PIDKD_RECNAME, &Heat.pid.kd);
+  read_gain(nvsh, PIDIZONE_RECNAME, &Heat.pid.izone);
+  uint32_t v = Heat.windowms;
+  if(nvs_get_opt_u32(nvsh, SSRWINDOW_RECNAME, &v) == 0){
+    if(v >= SSR_WINDOW_MS_MIN && v <= SSR_WINDOW_MS_MAX){
+      Heat.windowms = v;
+    }else{
+      ESP_LOGE(TAG, "read invalid ssr window %" PRIu32, v);
+    }
   }
+  heatctl_off(&Heat);
   return 0;
 }
 
@@ -87,66 +77,117 @@ bool get_heater_state(void){
 
 void set_heater(gpio_num_t pin, bool enabled){
   HeaterState = enabled;
-  gpio_level(pin, enabled);
+  hal_gpio_level(pin, enabled);
   ESP_LOGI(TAG, "set heater %s", bool_as_onoff(HeaterState));
 }
 
-static float
-getLM35(adc_channel_t channel){
-  esp_err_t e;
-  int raw;
-  float o;
-  // FIXME if we didn't get an ADC handle at all, need to elide read entirely
-  if(ADC1Calibrated){
-    if((e = adc_oneshot_get_calibrated_result(ADC1, ADC1Calibration, channel, &raw)) != ESP_OK){
-      ESP_LOGE(TAG, "error (%s) reading calibrated adc value %d", esp_err_to_name(e), raw);
-      return MIN_TEMP - 1;
-    }
-    o = raw;
-  }else{
-    if((e = adc_oneshot_read(ADC1, channel, &raw)) != ESP_OK){
-      ESP_LOGE(TAG, "error (%s) reading from adc", esp_err_to_name(e));
-      return MIN_TEMP - 1;
-    }
-    // Dmax is 4095 on single read mode, 8191 on continuous
-    // Vmax is 3100mA with ADC_ATTEN_DB_12, 1750 with _6, 1250 w/ _2_5
-    // result is read * Vmax / Dmax
-    o = raw * 1750.0 / 4095;
+// returns the most recent decimated temperature in Q8, or MIN_TEMP - 1 if
+// we have no fresh reading. never touches the ADC.
+static q8_t
+getThermometer(void){
+  int32_t mv;
+  int64_t stampus;
+  if(hal_therm_read(&mv, &stampus)){
+    return q8_from_int(MIN_TEMP - 1);
+  }
+  int64_t age = (hal_now_us() - stampus) / 1000;
+  if(age > THERM_STALE_MS){
+    ESP_LOGE(TAG, "stale thermometer reading (%" PRId64 "ms)", age);
+    return q8_from_int(MIN_TEMP - 1);
   }
-  float ret = o / 10.0; // 10 mV per C
-  ESP_LOGI(TAG, "%d -> %f -> %f", raw, o, ret);
+  q8_t ret = thermo_mv_to_q8(Thermtable, mv);
+  ESP_LOGD(TAG, "%" PRId32 "mV -> %" PRId32 "/256C", mv, ret);
   return ret;
 }
 
-// manage the heater based on the temperature of the hot chamber, which is
-// sampled within this function.
-float manage_heater(gpio_num_t ssrpin, time_t dryends, uint32_t targtemp){
-  // if there is no drying scheduled, the heater ought be off, independent
-  // of all other considerations.
-  if(get_heater_state() && !dryends){
-    set_heater(ssrpin, false);
+uint32_t get_heater_duty(void){
+  return Heat.duty;
+}
+
+void request_autotune(unsigned temp){
+  atomic_store(&AutotuneReq, temp ? temp : AUTOTUNE_ABORT);
+}
+
+void get_autotune(autotune* at){
+  hal_lock_enter(&HeatLock);
+  *at = Heat.at;
+  hal_lock_exit(&HeatLock);
+}
+
+// write gains from a completed autotune to nvs. this can stall on flash,
+// so it is called from the telemetry task rather than the control task.
+int persist_autotune(void){
+  if(!atomic_exchange(&AutotunePending, false)){
+    return 0;
+  }
+  autotune at;
+  get_autotune(&at);
+  nvs_handle_t nvsh;
+  esp_err_t err = nvs_open(NVS_HANDLE_NAME, NVS_READWRITE, &nvsh);
+  if(err){
+    ESP_LOGE(TAG, "error (%s) opening nvs:" NVS_HANDLE_NAME, esp_err_to_name(err));
+    return -1;
+  }
+  if((err = nvs_set_u32(nvsh, PIDKP_RECNAME, at.kp)) == ESP_OK){
+    if((err = nvs_set_u32(nvsh, PIDKI_RECNAME, at.ki)) == ESP_OK){
+      if((err = nvs_set_u32(nvsh, PIDKD_RECNAME, 0)) == ESP_OK){
+        err = nvs_commit(nvsh);
+      }
+    }
+  }
+  nvs_close(nvsh);
+  if(err){
+    ESP_LOGE(TAG, "error (%s) writing pid gains", esp_err_to_name(err));
+    return -1;
   }
-  float utemp = getLM35(Thermchan);
+  ESP_LOGI(TAG, "wrote autotuned gains kp %.3f ki %.3f", q8_to_float(at.kp), q8_to_float(at.ki));
+  return 0;
+}
+
+// manage the heater based on the temperature of the hot chamber, which is
+// taken from the latest decimated reading within this function. the
+// decision itself is made by heatctl.
+q8_t manage_heater(gpio_num_t ssrpin, bool drying, uint32_t targtemp){
+  const int64_t now = hal_now_us() / 1000;
+  q8_t utemp = getThermometer();
+  uint32_t req = 0;
+  bool on = false;
+  bool tuned;
+  hal_lock_enter(&HeatLock);
   if(!temp_valid_p(utemp)){
     // without a valid upper chamber measurement, it's unsafe to run the heater
-    set_heater(ssrpin, false);
+    heatctl_off(&Heat);
   }else{
-    // take actions based on a valid read. even if we did just disable the
-    // heater, we still want to update LastUpperTemp.
-    LastUpperTemp = utemp;
-    if(get_heater_state()){
-      // turn it off if we're above the target temp FIXME do this better
-      if(utemp >= targtemp){
-        set_heater(ssrpin, false);
-      }
-      // turn it on if we're below the target temp, and scheduled to dry
-    }else if(dryends && utemp < targtemp){
-      set_heater(ssrpin, true);
+    req = atomic_exchange(&AutotuneReq, 0);
+    if(req){
+      heatctl_autotune(&Heat, req == AUTOTUNE_ABORT ? 0 : req, utemp, now);
     }
+    on = heatctl_step(&Heat, utemp, drying, targtemp, now);
+  }
+  tuned = Heat.tuned;
+  Heat.tuned = false;
+  hal_lock_exit(&HeatLock);
+  if(temp_valid_p(utemp)){
+    LastUpperTemp = utemp;
+  }
+  if(req == AUTOTUNE_ABORT){
+    ESP_LOGI(TAG, "aborted heater autotune");
+  }else if(req){
+    ESP_LOGI(TAG, "autotuning heater at %" PRIu32 "C", req);
+  }
+  if(tuned){
+    atomic_store(&AutotunePending, true);
+  }
+  if(on != get_heater_state()){
+    set_heater(ssrpin, on);
   }
   return utemp;
 }
 
 float get_upper_temp(void){
+  return q8_to_float(LastUpperTemp);
+}
+
+q8_t get_upper_temp_q8(void){
   return LastUpperTemp;
 }
@@ -1,27 +1,47 @@
 #ifndef HOHLRAUM_HEATER
 #define HOHLRAUM_HEATER
 
-#include <time.h>
 #include <stdbool.h>
-#include <driver/gpio.h>
-#include <esp_adc/adc_oneshot.h>
+#include "autotune.h"
+#include "fixedpoint.h"
+#include <nvs.h>
+#include <soc/gpio_num.h>
 
 #define MIN_TEMP -80
 #define MAX_TEMP 200
 
 static inline bool
-temp_valid_p(float temp){
-  return temp >= MIN_TEMP && temp <= MAX_TEMP;
+temp_valid_p(q8_t temp){
+  return temp >= q8_from_int(MIN_TEMP) && temp <= q8_from_int(MAX_TEMP);
 }
 
-int setup_temp(gpio_num_t thermpin, adc_unit_t unit);
+int setup_temp(gpio_num_t thermpin);
+
+// read PID gains and the SSR window from NVS
+int read_heater_pstore(nvs_handle_t nvsh);
 
 bool get_heater_state(void);
 void set_heater(gpio_num_t pin, bool enabled);
-float manage_heater(gpio_num_t ssrpin, time_t dryends, uint32_t targtemp);
+q8_t manage_heater(gpio_num_t ssrpin, bool drying, uint32_t targtemp);
+
+// the PID's most recent duty cycle, in permille
+uint32_t get_heater_duty(void);
+
+// start a relay autotune around temp (from a cold chamber), or abort any
+// running autotune if temp is 0. the control task picks this up on its next
+// iteration. on success, the new gains are used immediately, and written to
+// nvs by persist_autotune().
+void request_autotune(unsigned temp);
+
+// consistent copy of the autotuner's progress and results
+void get_autotune(autotune* at);
+
+// write any newly-autotuned gains to nvs
+int persist_autotune(void);
 
-// get the last sampled temperature of the hot chamber (does not itself
-// trigger a sampling; that takes place in manage_heater()).
+// get the last temperature of the hot chamber seen by manage_heater(). the
+// float form is for HTTP/telemetry.
 float get_upper_temp(void);
+q8_t get_upper_temp_q8(void);
 
 #endif
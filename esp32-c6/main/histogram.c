@@ -0,0 +1,63 @@
+#include "histogram.h"
+#include <string.h>
+
+// values below 1 << HISTOGRAM_SUBBITS get their own buckets. beyond that,
+// the bucket is determined by the most significant bit and the
+// HISTOGRAM_SUBBITS bits immediately below it.
+static inline unsigned
+bucket_of(uint32_t val){
+  if(val < (1u << HISTOGRAM_SUBBITS)){
+    return val;
+  }
+  unsigned msb = 31 - __builtin_clz(val);
+  unsigned sub = (val >> (msb - HISTOGRAM_SUBBITS)) & ((1u << HISTOGRAM_SUBBITS) - 1);
+  unsigned idx = (msb - HISTOGRAM_SUBBITS + 1) * (1u << HISTOGRAM_SUBBITS) + sub;
+  return idx < HISTOGRAM_BUCKETS ? idx : HISTOGRAM_BUCKETS - 1;
+}
+
+// largest value which lands in bucket idx
+static inline uint32_t
+bucket_ceiling(unsigned idx){
+  const unsigned per = 1u << HISTOGRAM_SUBBITS;
+  if(idx < per){
+    return idx;
+  }
+  unsigned msb = idx / per + HISTOGRAM_SUBBITS - 1;
+  unsigned sub = idx % per;
+  uint64_t lower = (uint64_t)(per + sub) << (msb - HISTOGRAM_SUBBITS);
+  uint64_t upper = lower + (1ull << (msb - HISTOGRAM_SUBBITS)) - 1;
+  return upper > UINT32_MAX ? UINT32_MAX : upper;
+}
+
+void histogram_clear(histogram* h){
+  memset(h, 0, sizeof(*h));
+}
+
+void histogram_record(histogram* h, uint32_t val){
+  ++h->counts[bucket_of(val)];
+  ++h->total;
+  if(val > h->max){
+    h->max = val;
+  }
+}
+
+uint32_t histogram_quantile(const histogram* h, unsigned permille){
+  if(h->total == 0){
+    return 0;
+  }
+  // rank of the sample we're looking for, 1-biased, rounded up
+  uint64_t rank = ((uint64_t)h->total * permille + 999) / 1000;
+  if(rank == 0){
+    rank = 1;
+  }
+  uint64_t seen = 0;
+  for(unsigned i = 0 ; i < HISTOGRAM_BUCKETS ; ++i){
+    seen += h->counts[i];
+    if(seen >= rank){
+      uint32_t c = bucket_ceiling(i);
+      // never report more than we've actually seen
+      return c > h->max ? h->max : c;
+    }
+  }
+  return h->max;
+}
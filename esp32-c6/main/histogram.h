@@ -0,0 +1,27 @@
+#ifndef DANKDRYER_HISTOGRAM
+#define DANKDRYER_HISTOGRAM
+
+#include <stdint.h>
+
+// log-linear histogram of unsigned 32-bit values (we use it for loop timings
+// in microseconds). each power of two is split into four buckets, so any
+// reported quantile is within 25% of the true value, and recording a value
+// is a handful of integer operations. the maximum is tracked exactly.
+#define HISTOGRAM_SUBBITS 2
+#define HISTOGRAM_BUCKETS (4 * 31)
+
+typedef struct histogram {
+  uint32_t counts[HISTOGRAM_BUCKETS];
+  uint32_t total;
+  uint32_t max;
+} histogram;
+
+void histogram_clear(histogram* h);
+void histogram_record(histogram* h, uint32_t val);
+
+// returns an upper bound on the value at quantile q (expressed in parts per
+// thousand, i.e. 500 for the median and 990 for p99). returns 0 if the
+// histogram is empty.
+uint32_t histogram_quantile(const histogram* h, unsigned permille);
+
+#endif
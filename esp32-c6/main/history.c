@@ -0,0 +1,216 @@
+#include "history.h"
+#include "heater.h"
+#include "weight.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+const uint32_t HistoryPeriodSec[HISTORY_TIERS] = { 60, 3600, };
+
+static const history_sample GapSample = {
+  .mass = HISTORY_MASS_INVALID,
+  .utemp = HISTORY_TEMP_INVALID,
+  .ltemp = HISTORY_TEMP_INVALID,
+  .flags = HISTORY_GAP,
+};
+
+void history_init(history* h, uint32_t boot){
+  memset(h, 0, sizeof(*h));
+  h->boot = boot;
+}
+
+static void
+stat_fold(history_stat* st, int32_t v){
+  if(st->n == 0 || v < st->min){
+    st->min = v;
+  }
+  if(st->n == 0 || v > st->max){
+    st->max = v;
+  }
+  st->sum += v;
+  ++st->n;
+}
+
+// the mean, rounded half away from zero. requires st->n > 0.
+static int32_t
+stat_mean(const history_stat* st){
+  const int64_t half = st->n / 2;
+  return (st->sum >= 0 ? st->sum + half : st->sum - half) / (int64_t)st->n;
+}
+
+static void
+fold(history_acc* a, const history_sample* s){
+  if(s->utemp != HISTORY_TEMP_INVALID){
+    stat_fold(&a->utemp, s->utemp);
+  }
+  if(s->ltemp != HISTORY_TEMP_INVALID){
+    stat_fold(&a->ltemp, s->ltemp);
+  }
+  if(s->mass != HISTORY_MASS_INVALID){
+    stat_fold(&a->mass, s->mass);
+  }
+  stat_fold(&a->hduty, s->hduty);
+  ++a->count;
+}
+
+static void
+rollup_temp(int16_t r[3], const history_stat* st){
+  if(st->n == 0){
+    r[HISTORY_MIN] = r[HISTORY_MAX] = r[HISTORY_MEAN] = HISTORY_TEMP_INVALID;
+  }else{
+    r[HISTORY_MIN] = st->min;
+    r[HISTORY_MAX] = st->max;
+    r[HISTORY_MEAN] = stat_mean(st);
+  }
+}
+
+// close the period accumulated in a, which began at uptime second start.
+// its wall clock start is derived from t (at uptime second sec), if set.
+static void
+close_period(const history* h, const history_acc* a, uint32_t start,
+             const telemetry* t, uint32_t sec, history_rollup* r){
+  memset(r, 0, sizeof(*r));
+  if(t->epochms){
+    const int64_t epoch = t->epochms / 1000 - (sec - start);
+    if(epoch > 0 && epoch <= UINT32_MAX){
+      r->epoch = epoch;
+    }
+  }
+  r->boot = h->boot;
+  r->count = a->count > UINT16_MAX ? UINT16_MAX : a->count;
+  rollup_temp(r->utemp, &a->utemp);
+  rollup_temp(r->ltemp, &a->ltemp);
+  if(a->mass.n == 0){
+    r->mass[HISTORY_MIN] = r->mass[HISTORY_MAX] = r->mass[HISTORY_MEAN] = HISTORY_MASS_INVALID;
+  }else{
+    r->mass[HISTORY_MIN] = a->mass.min;
+    r->mass[HISTORY_MAX] = a->mass.max;
+    r->mass[HISTORY_MEAN] = stat_mean(&a->mass);
+  }
+  r->hduty[HISTORY_MIN] = a->hduty.min;
+  r->hduty[HISTORY_MAX] = a->hduty.max;
+  r->hduty[HISTORY_MEAN] = stat_mean(&a->hduty);
+}
+
+unsigned history_push(history* h, const telemetry* t,
+                      history_rollup rollups[HISTORY_TIERS]){
+  const uint32_t sec = t->uptimeus / 1000000ll;
+  if(h->count && sec <= h->lastsec){
+    return 0;
+  }
+  // mark any seconds we skipped (the control period can exceed 1s)
+  if(h->count){
+    uint32_t gap = sec - h->lastsec - 1;
+    if(gap > HISTORY_SECS){
+      gap = HISTORY_SECS;
+    }
+    for(uint32_t i = 1 ; i <= gap ; ++i){
+      h->s[(sec - i) % HISTORY_SECS] = GapSample;
+    }
+    h->count += gap;
+  }
+  history_sample* s = &h->s[sec % HISTORY_SECS];
+  s->utemp = temp_valid_p(t->utemp) ? q8_to_tenths(t->utemp) : HISTORY_TEMP_INVALID;
+  s->ltemp = temp_valid_p(t->ltemp) ? q8_to_tenths(t->ltemp) : HISTORY_TEMP_INVALID;
+  s->mass = weight_valid_p(t->weight) ? q8_round(t->weight) : HISTORY_MASS_INVALID;
+  s->hduty = t->hduty;
+  s->flags = (t->heater ? HISTORY_HEATER : 0) | (t->motor ? HISTORY_MOTOR : 0);
+  if(++h->count > HISTORY_SECS){
+    h->count = HISTORY_SECS;
+  }
+  h->lastsec = sec;
+  unsigned closed = 0;
+  for(unsigned tier = 0 ; tier < HISTORY_TIERS ; ++tier){
+    history_acc* a = &h->acc[tier];
+    const uint32_t period = sec / HistoryPeriodSec[tier];
+    if(a->count && a->period != period){
+      close_period(h, a, a->period * HistoryPeriodSec[tier], t, sec, &rollups[tier]);
+      closed |= 1u << tier;
+      memset(a, 0, sizeof(*a));
+    }
+    a->period = period;
+    fold(a, s);
+  }
+  return closed;
+}
+
+unsigned history_samples(const history* h, uint32_t* sec0,
+                         history_sample* out, unsigned max){
+  if(h->count == 0){
+    return 0;
+  }
+  const uint32_t oldest = h->lastsec - (h->count - 1);
+  if(*sec0 < oldest){
+    *sec0 = oldest;
+  }
+  unsigned n = 0;
+  while(n < max && *sec0 + n <= h->lastsec){
+    out[n] = h->s[(*sec0 + n) % HISTORY_SECS];
+    ++n;
+  }
+  return n;
+}
+
+// append ",v" (or "[v" if first), or null if !valid
+static void
+put_int(char* buf, size_t len, size_t* used, bool first, bool valid, int64_t v){
+  if(*used >= len){
+    return;
+  }
+  const char sep = first ? '[' : ',';
+  int r;
+  if(valid){
+    r = snprintf(buf + *used, len - *used, "%c%" PRId64, sep, v);
+  }else{
+    r = snprintf(buf + *used, len - *used, "%cnull", sep);
+  }
+  *used = r < 0 ? len : *used + r;
+}
+
+// close the array, returning its length or -1
+static int
+put_end(char* buf, size_t len, size_t used){
+  if(used + 2 > len){
+    return -1;
+  }
+  memcpy(buf + used, "]", 2);
+  return used + 1;
+}
+
+int history_sample_json(const history_sample* s, char* buf, size_t len){
+  if(s->flags & HISTORY_GAP){
+    if(len < sizeof("null")){
+      return -1;
+    }
+    memcpy(buf, "null", sizeof("null"));
+    return sizeof("null") - 1;
+  }
+  size_t used = 0;
+  put_int(buf, len, &used, true, s->utemp != HISTORY_TEMP_INVALID, s->utemp);
+  put_int(buf, len, &used, false, s->ltemp != HISTORY_TEMP_INVALID, s->ltemp);
+  put_int(buf, len, &used, false, s->mass != HISTORY_MASS_INVALID, s->mass);
+  put_int(buf, len, &used, false, true, s->hduty);
+  put_int(buf, len, &used, false, true, s->flags);
+  return put_end(buf, len, used);
+}
+
+int history_rollup_json(const history_rollup* r, char* buf, size_t len){
+  size_t used = 0;
+  put_int(buf, len, &used, true, r->epoch, r->epoch);
+  put_int(buf, len, &used, false, true, r->boot);
+  put_int(buf, len, &used, false, true, r->count);
+  for(unsigned i = 0 ; i < 3 ; ++i){
+    put_int(buf, len, &used, false, r->utemp[i] != HISTORY_TEMP_INVALID, r->utemp[i]);
+  }
+  for(unsigned i = 0 ; i < 3 ; ++i){
+    put_int(buf, len, &used, false, r->ltemp[i] != HISTORY_TEMP_INVALID, r->ltemp[i]);
+  }
+  for(unsigned i = 0 ; i < 3 ; ++i){
+    put_int(buf, len, &used, false, r->mass[i] != HISTORY_MASS_INVALID, r->mass[i]);
+  }
+  for(unsigned i = 0 ; i < 3 ; ++i){
+    put_int(buf, len, &used, false, true, r->hduty[i]);
+  }
+  return put_end(buf, len, used);
+}
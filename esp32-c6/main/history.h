@@ -0,0 +1,112 @@
+#ifndef DANKDRYER_HISTORY
+#define DANKDRYER_HISTORY
+
+// on-device history of the chamber, so that a drying curve can be seen
+// without a broker having been listening. the control task folds one
+// snapshot per second into a RAM ring of the last HISTORY_MINUTES of 1s
+// samples, and into running minute and hour rollups (minimum, maximum, and
+// mean of each quantity). each closed rollup is handed back to be stored
+// in flash (see histstore.h). each second costs O(1), plus one slot for
+// each second skipped. callers provide any locking.
+
+#include <stddef.h>
+#include <stdint.h>
+#include "telemetry.h"
+
+#define HISTORY_MINUTES 15
+#define HISTORY_SECS (HISTORY_MINUTES * 60)
+
+// readings which were invalid (or seconds which weren't sampled)
+#define HISTORY_TEMP_INVALID INT16_MIN
+#define HISTORY_MASS_INVALID INT32_MIN
+
+#define HISTORY_HEATER 0x01u
+#define HISTORY_MOTOR 0x02u
+#define HISTORY_GAP 0x80u   // this second wasn't sampled
+
+// one second, 12 bytes. temperatures are in tenths of a degree, mass in
+// the units of the load cell (rounded), and heater duty in permille.
+typedef struct history_sample {
+  int32_t mass;
+  int16_t utemp, ltemp;
+  uint16_t hduty;
+  uint8_t flags;      // HISTORY_* bits
+} history_sample;
+
+typedef enum {
+  HISTORY_MINUTE,
+  HISTORY_HOUR,
+  HISTORY_TIERS
+} history_tier;
+
+// the seconds in each tier's period
+extern const uint32_t HistoryPeriodSec[HISTORY_TIERS];
+
+// indices into each triple of a rollup
+enum {
+  HISTORY_MIN,
+  HISTORY_MAX,
+  HISTORY_MEAN
+};
+
+// one period of one tier, 40 bytes. a quantity with no valid samples has
+// invalid minimum, maximum, and mean.
+typedef struct history_rollup {
+  uint32_t epoch;     // wall clock seconds at the period's start (0 if unknown)
+  uint16_t boot;      // low bits of the boot count
+  uint16_t count;     // seconds sampled
+  int32_t mass[3];
+  int16_t utemp[3], ltemp[3];
+  uint16_t hduty[3];
+} history_rollup;
+
+// a quantity as it's accumulated over a period
+typedef struct history_stat {
+  int32_t min, max;
+  int64_t sum;
+  uint32_t n;         // valid samples
+} history_stat;
+
+typedef struct history_acc {
+  uint32_t period;    // uptime seconds / the tier's period
+  uint32_t count;     // seconds sampled
+  history_stat mass, utemp, ltemp, hduty;
+} history_acc;
+
+typedef struct history {
+  history_sample s[HISTORY_SECS];   // indexed by uptime second
+  uint32_t lastsec;   // uptime second of the newest sample
+  uint32_t count;     // samples held, up to HISTORY_SECS
+  uint16_t boot;
+  history_acc acc[HISTORY_TIERS];
+} history;
+
+void history_init(history* h, uint32_t boot);
+
+// fold t into the history, if it's the first snapshot of its second.
+// returns a mask with bit (1 << tier) set for each tier whose period t
+// closed, having written that period's rollup to rollups[tier].
+unsigned history_push(history* h, const telemetry* t,
+                      history_rollup rollups[HISTORY_TIERS]);
+
+// copy up to max consecutive samples, starting at uptime second *sec0,
+// into out. if *sec0 precedes the oldest sample held, it's advanced to
+// that. returns the number copied (0 once *sec0 passes the newest).
+unsigned history_samples(const history* h, uint32_t* sec0,
+                         history_sample* out, unsigned max);
+
+// the longest renderings of a sample and a rollup below
+#define HISTORY_SAMPLE_JSON_MAX 48
+#define HISTORY_ROLLUP_JSON_MAX 160
+
+// write a sample as a JSON array [utempdC,ltempdC,mass,hduty,flags], with
+// invalid readings as null (and a skipped second as null entirely).
+// returns its length, or -1 if len was insufficient.
+int history_sample_json(const history_sample* s, char* buf, size_t len);
+
+// write a rollup as a JSON array [epoch,boot,count, then minimum, maximum,
+// and mean of each of utempdC, ltempdC, mass, and hduty], with invalid
+// values as null. returns its length, or -1 if len was insufficient.
+int history_rollup_json(const history_rollup* r, char* buf, size_t len);
+
+#endif
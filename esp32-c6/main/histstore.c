@@ -0,0 +1,217 @@
+#include "histstore.h"
+#include "flashring.h"
+#include <string.h>
+#include <esp_log.h>
+#include <inttypes.h>
+#include <esp_rom_crc.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#define TAG "histstore"
+
+#define HISTSTORE_LABEL "history"
+#define SECTOR_MAGIC 0x54534844ul // "DHST"
+// the hour ring's share of the partition; the minute ring gets the rest
+#define HOUR_SECTORS 4
+// rollups close at most twice a minute, so this is plenty
+#define WRITER_QUEUE_DEPTH 4
+#define WRITER_TASK_PRIO 1
+#define WRITER_TASK_STACK_BYTES 3072
+
+// a record as stored, following the sector header at a fixed stride. it's
+// empty if entirely erased, and torn if its crc doesn't match.
+typedef struct slot {
+  uint32_t crc;     // of r
+  history_rollup r;
+} slot;
+
+typedef struct ring {
+  flashring fr;
+  unsigned next;            // the next free slot in fr.head
+} ring;
+
+typedef struct pending {
+  history_tier tier;
+  history_rollup r;
+} pending;
+
+static const esp_partition_t* Part;
+static unsigned SlotsPerSector;
+static ring Rings[HISTORY_TIERS];
+static SemaphoreHandle_t Lock;
+static QueueHandle_t Queue;
+
+static inline size_t
+slot_addr(const ring* r, unsigned sector, unsigned idx){
+  return flashring_addr(&r->fr, sector) + sizeof(flashring_hdr) + idx * sizeof(slot);
+}
+
+// returns 0 and fills in out (if not NULL) if the slot holds a valid
+// record, 1 if it's empty, and -1 if it's torn or unreadable
+static int
+read_slot(const ring* r, unsigned sector, unsigned idx, history_rollup* out){
+  slot s;
+  const size_t addr = slot_addr(r, sector, idx);
+  esp_err_t e = esp_partition_read(r->fr.part, addr, &s, sizeof(s));
+  if(e != ESP_OK){
+    ESP_LOGE(TAG, "error (%s) reading record at 0x%zx", esp_err_to_name(e), addr);
+    return -1;
+  }
+  const uint8_t* raw = (const uint8_t*)&s;
+  size_t i = 0;
+  while(i < sizeof(s) && raw[i] == 0xff){
+    ++i;
+  }
+  if(i == sizeof(s)){
+    return 1;
+  }
+  if(s.crc != esp_rom_crc32_le(0, (const uint8_t*)&s.r, sizeof(s.r))){
+    return -1;
+  }
+  if(out){
+    *out = s.r;
+  }
+  return 0;
+}
+
+// call with Lock held
+static int
+append(ring* r, const history_rollup* rollup){
+  if(r->next == SlotsPerSector){
+    if(flashring_claim(&r->fr, (r->fr.head + 1) % r->fr.sectors)){
+      return -1;
+    }
+    r->next = 0;
+  }
+  const slot s = {
+    .crc = esp_rom_crc32_le(0, (const uint8_t*)rollup, sizeof(*rollup)),
+    .r = *rollup,
+  };
+  const size_t addr = slot_addr(r, r->fr.head, r->next);
+  // don't reuse a slot we might have partially written
+  ++r->next;
+  esp_err_t e = esp_partition_write(r->fr.part, addr, &s, sizeof(s));
+  if(e != ESP_OK){
+    ESP_LOGE(TAG, "error (%s) writing record at 0x%zx", esp_err_to_name(e), addr);
+    return -1;
+  }
+  return 0;
+}
+
+// find the head, and the slot following the last one written in it
+static int
+mount(ring* r){
+  const int m = flashring_mount(&r->fr);
+  r->next = 0;
+  if(m){
+    return m < 0 ? -1 : 0;
+  }
+  for(unsigned i = 0 ; i < SlotsPerSector ; ++i){
+    if(read_slot(r, r->fr.head, i, NULL) != 1){
+      r->next = i + 1;
+    }
+  }
+  return 0;
+}
+
+int histstore_read(histstore_cursor* c, history_rollup* out, unsigned max){
+  if(Part == NULL || c->tier >= HISTORY_TIERS){
+    return -1;
+  }
+  const ring* r = &Rings[c->tier];
+  unsigned n = 0;
+  xSemaphoreTake(Lock, portMAX_DELAY);
+  int sector = c->started ? flashring_find(&r->fr, c->seq) : -1;
+  if(sector < 0){
+    sector = flashring_oldest(&r->fr, &c->seq);
+    c->slot = 0;
+    c->started = true;
+  }
+  while(n < max){
+    const unsigned limit = c->seq == r->fr.seq ? r->next : SlotsPerSector;
+    if(c->slot >= limit){
+      if(c->seq == r->fr.seq || (sector = flashring_find(&r->fr, c->seq + 1)) < 0){
+        break;
+      }
+      ++c->seq;
+      c->slot = 0;
+      continue;
+    }
+    // torn and empty slots are skipped
+    if(read_slot(r, sector, c->slot++, &out[n]) == 0){
+      ++n;
+    }
+  }
+  xSemaphoreGive(Lock);
+  return n;
+}
+
+int histstore_append(history_tier tier, const history_rollup* r){
+  if(Queue == NULL || tier >= HISTORY_TIERS){
+    return -1;
+  }
+  const pending p = {
+    .tier = tier,
+    .r = *r,
+  };
+  return xQueueSend(Queue, &p, 0) == pdTRUE ? 0 : -1;
+}
+
+static void
+writer_task(void* v){
+  pending p;
+  while(1){
+    if(xQueueReceive(Queue, &p, portMAX_DELAY) == pdTRUE){
+      xSemaphoreTake(Lock, portMAX_DELAY);
+      append(&Rings[p.tier], &p.r);
+      xSemaphoreGive(Lock);
+    }
+  }
+}
+
+int histstore_init(void){
+  const esp_partition_t* part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                          ESP_PARTITION_SUBTYPE_ANY, HISTSTORE_LABEL);
+  if(part == NULL){
+    ESP_LOGW(TAG, "no " HISTSTORE_LABEL " partition; history is not persisted");
+    return -1;
+  }
+  const unsigned sectors = part->size / part->erase_size;
+  if(sectors < HOUR_SECTORS + 2){
+    ESP_LOGE(TAG, "%zuB " HISTSTORE_LABEL " partition is too small", part->size);
+    return -1;
+  }
+  SlotsPerSector = (part->erase_size - sizeof(flashring_hdr)) / sizeof(slot);
+  flashring_init(&Rings[HISTORY_MINUTE].fr, "minute history", part, SECTOR_MAGIC,
+                 0, sectors - HOUR_SECTORS);
+  flashring_init(&Rings[HISTORY_HOUR].fr, "hour history", part, SECTOR_MAGIC,
+                 sectors - HOUR_SECTORS, HOUR_SECTORS);
+  if((Lock = xSemaphoreCreateMutex()) == NULL){
+    ESP_LOGE(TAG, "couldn't create history lock");
+    return -1;
+  }
+  Part = part;
+  for(unsigned t = 0 ; t < HISTORY_TIERS ; ++t){
+    if(mount(&Rings[t])){
+      Part = NULL;
+      return -1;
+    }
+  }
+  ESP_LOGI(TAG, "%u records per sector", SlotsPerSector);
+  QueueHandle_t q = xQueueCreate(WRITER_QUEUE_DEPTH, sizeof(pending));
+  if(q == NULL){
+    ESP_LOGE(TAG, "couldn't create history queue");
+    return -1;
+  }
+  Queue = q;
+  if(xTaskCreate(writer_task, "histstore", WRITER_TASK_STACK_BYTES, NULL,
+                 WRITER_TASK_PRIO, NULL) != pdPASS){
+    ESP_LOGE(TAG, "error creating writer task");
+    Queue = NULL;
+    vQueueDelete(q);
+    return -1;
+  }
+  return 0;
+}
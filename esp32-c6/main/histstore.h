@@ -0,0 +1,36 @@
+#ifndef DANKDRYER_HISTSTORE
+#define DANKDRYER_HISTSTORE
+
+// the minute and hour rollups of history.h, kept across reboots in the
+// "history" flash partition. each tier is a ring of sectors holding
+// fixed-size records; when a ring is full, its oldest sector is erased.
+// records are written by a task of our own, so the control task, which
+// produces them, never waits on flash.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "history.h"
+
+// mount the rings and start the writer task. returns -1 if the partition
+// is missing or unusable, in which case histstore_append() always fails.
+int histstore_init(void);
+
+// queue r to be written to tier's ring. never blocks; returns -1 if it
+// couldn't be queued.
+int histstore_append(history_tier tier, const history_rollup* r);
+
+// a position in a ring, oldest first. a zeroed cursor starts at the oldest
+// record of tier.
+typedef struct histstore_cursor {
+  history_tier tier;
+  bool started;
+  uint32_t seq;       // of the sector we're in
+  unsigned slot;
+} histstore_cursor;
+
+// copy up to max records following c into out, advancing c. returns the
+// number copied (0 once we're caught up), or -1 on error. if the ring
+// overtook c, we continue from the oldest record.
+int histstore_read(histstore_cursor* c, history_rollup* out, unsigned max);
+
+#endif
@@ -0,0 +1,176 @@
+#include "jsonw.h"
+#include <math.h>
+#include <string.h>
+
+static void
+put(jsonw* j, const char* s, size_t slen){
+  if(j->overflow){
+    return;
+  }
+  // always leave room for the terminator
+  if(j->len - j->used <= slen){
+    j->overflow = true;
+    return;
+  }
+  memcpy(j->buf + j->used, s, slen);
+  j->used += slen;
+}
+
+static inline void
+put_char(jsonw* j, char c){
+  put(j, &c, 1);
+}
+
+static void
+key(jsonw* j, const char* k){
+  if(!j->first){
+    put_char(j, ',');
+  }
+  j->first = false;
+  put_char(j, '"');
+  put(j, k, strlen(k));
+  put(j, "\":", 2);
+}
+
+// decimal digits of v, least significant first into the end of buf.
+// returns a pointer to the most significant digit.
+static char*
+utoa_rev(uint64_t v, char* end){
+  do{
+    *--end = '0' + v % 10;
+    v /= 10;
+  }while(v);
+  return end;
+}
+
+static void
+put_uint(jsonw* j, uint64_t v){
+  char buf[20];
+  char* s = utoa_rev(v, buf + sizeof(buf));
+  put(j, s, buf + sizeof(buf) - s);
+}
+
+static void
+put_int(jsonw* j, int64_t v){
+  if(v < 0){
+    put_char(j, '-');
+    put_uint(j, -(uint64_t)v);
+  }else{
+    put_uint(j, v);
+  }
+}
+
+// an integer part and a fractional part of 'digits' digits, less any
+// trailing zeros.
+static void
+put_fixed(jsonw* j, bool neg, uint64_t ipart, uint64_t frac, unsigned digits){
+  while(digits && frac % 10 == 0){
+    frac /= 10;
+    --digits;
+  }
+  if(neg && (ipart || digits)){
+    put_char(j, '-');
+  }
+  put_uint(j, ipart);
+  if(digits){
+    char buf[20];
+    char* end = buf + sizeof(buf);
+    char* s = utoa_rev(frac, end);
+    while(end - s < digits){
+      *--s = '0';
+    }
+    put_char(j, '.');
+    put(j, s, end - s);
+  }
+}
+
+void jsonw_begin(jsonw* j, char* buf, size_t len){
+  j->buf = buf;
+  j->len = len;
+  j->used = 0;
+  j->first = true;
+  j->overflow = false;
+  put_char(j, '{');
+}
+
+void jsonw_int(jsonw* j, const char* k, int64_t v){
+  key(j, k);
+  put_int(j, v);
+}
+
+void jsonw_q8(jsonw* j, const char* k, q8_t v){
+  key(j, k);
+  const bool neg = v < 0;
+  const uint32_t a = neg ? -(uint32_t)v : (uint32_t)v;
+  // 1/256 is exactly 0.00390625
+  put_fixed(j, neg, a >> 8u, (a & 0xffu) * 390625ull, 8);
+}
+
+void jsonw_milli(jsonw* j, const char* k, int64_t v){
+  key(j, k);
+  const bool neg = v < 0;
+  const uint64_t a = neg ? -(uint64_t)v : (uint64_t)v;
+  put_fixed(j, neg, a / 1000u, a % 1000u, 3);
+}
+
+void jsonw_float(jsonw* j, const char* k, float v, unsigned decimals){
+  static const uint32_t pow10[] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000,
+  };
+  key(j, k);
+  if(decimals >= sizeof(pow10) / sizeof(*pow10)){
+    decimals = sizeof(pow10) / sizeof(*pow10) - 1;
+  }
+  const float scaled = fabsf(v) * pow10[decimals];
+  // also catches NaN
+  if(!(scaled < 9e18f)){
+    put(j, "null", 4);
+    return;
+  }
+  const uint64_t s = llrintf(scaled);
+  put_fixed(j, v < 0, s / pow10[decimals], s % pow10[decimals], decimals);
+}
+
+void jsonw_str(jsonw* j, const char* k, const char* s){
+  static const char hex[] = "0123456789abcdef";
+  key(j, k);
+  put_char(j, '"');
+  for(const char* c = s ; *c ; ++c){
+    if(*c == '"' || *c == '\\'){
+      put_char(j, '\\');
+      put_char(j, *c);
+    }else if((unsigned char)*c < 0x20){
+      char esc[6] = { '\\', 'u', '0', '0', hex[*c >> 4], hex[*c & 0xf] };
+      put(j, esc, sizeof(esc));
+    }else{
+      put_char(j, *c);
+    }
+  }
+  put_char(j, '"');
+}
+
+void jsonw_ints(jsonw* j, const char* k, const int32_t* v, size_t n,
+                int32_t nullval){
+  key(j, k);
+  put_char(j, '[');
+  for(size_t i = 0 ; i < n ; ++i){
+    if(i){
+      put_char(j, ',');
+    }
+    if(v[i] == nullval){
+      put(j, "null", 4);
+    }else{
+      put_int(j, v[i]);
+    }
+  }
+  put_char(j, ']');
+}
+
+int jsonw_end(jsonw* j){
+  put_char(j, '}');
+  if(j->overflow){
+    return -1;
+  }
+  j->buf[j->used] = '\0';
+  return j->used;
+}
@@ -0,0 +1,43 @@
+#ifndef DANKDRYER_JSONW
+#define DANKDRYER_JSONW
+
+// a streaming writer of compact JSON objects into a caller-supplied buffer.
+// it never allocates, and never touches floating point printf (newlib's
+// allocates). only flat objects (whose members may be arrays of integers)
+// are supported, which is all we publish.
+// keys are written verbatim, and must not require escaping. once the
+// buffer is exhausted, further writes are dropped, and jsonw_end() reports
+// the failure.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "fixedpoint.h"
+
+typedef struct jsonw {
+  char* buf;
+  size_t len;       // bytes available in buf
+  size_t used;      // bytes written, not including any terminator
+  bool first;       // no members yet
+  bool overflow;
+} jsonw;
+
+void jsonw_begin(jsonw* j, char* buf, size_t len);
+void jsonw_int(jsonw* j, const char* key, int64_t v);
+// exact decimal expansion of a Q8 value (at most 8 fractional digits)
+void jsonw_q8(jsonw* j, const char* key, q8_t v);
+// v thousandths, as a decimal (at most 3 fractional digits)
+void jsonw_milli(jsonw* j, const char* key, int64_t v);
+// v rounded to 'decimals' fractional digits (at most 9), with trailing
+// zeros removed. non-finite values are written as null.
+void jsonw_float(jsonw* j, const char* key, float v, unsigned decimals);
+void jsonw_str(jsonw* j, const char* key, const char* s);
+// an array of n integers, where any equal to nullval are written as null
+void jsonw_ints(jsonw* j, const char* key, const int32_t* v, size_t n,
+                int32_t nullval);
+
+// close the object and NUL-terminate it. returns its length, or -1 if buf
+// was too small.
+int jsonw_end(jsonw* j);
+
+#endif
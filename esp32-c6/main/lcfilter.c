@@ -0,0 +1,98 @@
+#include "lcfilter.h"
+#include <string.h>
+
+void lcfilter_init(lcfilter* f, unsigned median, unsigned emashift){
+  memset(f, 0, sizeof(*f));
+  f->median = median;
+  f->emashift = emashift;
+}
+
+// median of the most recent samples. insertion sort of at most
+// LCFILTER_MAX_MEDIAN integers is cheaper than anything cleverer at this
+// size.
+static int32_t
+ring_median(const lcfilter* f){
+  int32_t s[LCFILTER_MAX_MEDIAN];
+  unsigned n = f->count < f->median ? f->count : f->median;
+  for(unsigned i = 0 ; i < n ; ++i){
+    int32_t v = f->ring[(f->count - 1 - i) % LCFILTER_RING_LEN];
+    unsigned j = i;
+    while(j && s[j - 1] > v){
+      s[j] = s[j - 1];
+      --j;
+    }
+    s[j] = v;
+  }
+  return s[n / 2];
+}
+
+int32_t lcfilter_push(lcfilter* f, int32_t raw){
+  f->ring[f->count++ % LCFILTER_RING_LEN] = raw;
+  const int32_t med = ring_median(f);
+  const int64_t m = (int64_t)med << LCFILTER_EMA_FRACBITS;
+  if(f->count == 1){
+    f->ema = m;
+  }else{
+    f->ema += (m - f->ema) >> f->emashift;
+  }
+  return med;
+}
+
+static void
+clear_phase_bins(lcfilter* f){
+  memset(f->phasesum, 0, sizeof(f->phasesum));
+  memset(f->phasecount, 0, sizeof(f->phasecount));
+}
+
+// the mean of the per-phase means, if every phase was sampled
+static bool
+close_revolution(const lcfilter* f, int32_t* mean){
+  int64_t total = 0;
+  for(unsigned i = 0 ; i < LCFILTER_PHASE_BINS ; ++i){
+    if(f->phasecount[i] == 0){
+      return false;
+    }
+    total += f->phasesum[i] / f->phasecount[i];
+  }
+  *mean = total / LCFILTER_PHASE_BINS;
+  return true;
+}
+
+lcphase_result lcfilter_phase(lcfilter* f, int32_t m, uint32_t edges,
+                              int64_t last, int64_t prev, unsigned ppr,
+                              int64_t now, int32_t* mean){
+  if(edges < 2){
+    f->windowopen = false;
+    return LCPHASE_STOPPED;
+  }
+  if(!f->windowopen){
+    clear_phase_bins(f);
+    f->windowedge = edges - 1;
+    f->windowopen = true;
+  }
+  lcphase_result r = LCPHASE_ACCUMULATED;
+  uint32_t since = edges - 1 - f->windowedge; // whole pulses into this revolution
+  if(since >= ppr){
+    r = close_revolution(f, mean) ? LCPHASE_REVOLUTION : LCPHASE_GAPPED;
+    clear_phase_bins(f);
+    f->windowedge += since - since % ppr;
+    since %= ppr;
+  }
+  // estimate our position from the most recent pulse period
+  const int64_t pulseper = last - prev;
+  if(pulseper <= 0){
+    return r == LCPHASE_ACCUMULATED ? LCPHASE_SKIPPED : r;
+  }
+  const int64_t rev = pulseper * ppr;
+  int64_t into = since * pulseper + (now - last);
+  if(into >= rev){
+    into = rev - 1; // we've slowed down since the last pulse
+  }
+  if(into < 0){
+    into = 0;
+  }
+  const unsigned bin = into * LCFILTER_PHASE_BINS / rev;
+  f->phasesum[bin] += m;
+  ++f->phasecount[bin];
+  return r;
+}
@@ -0,0 +1,72 @@
+#ifndef DANKDRYER_LCFILTER
+#define DANKDRYER_LCFILTER
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// the load cell's filters. each raw conversion goes through a median-of-N,
+// rejecting impulsive noise, and then an EMA. while the spool turns, the
+// medians are also tagged with the spool's phase (estimated from the hall
+// sensor's edge times) and averaged over each whole revolution, cancelling
+// ripple from eccentric mass. loadcell.c feeds this from the NAU7802 and
+// the hall tach; dryerhost feeds it a simulated eccentric spool.
+
+#define LCFILTER_MAX_MEDIAN 9
+#define LCFILTER_MAX_EMA 8
+// ring of raw samples; must be a power of two no smaller than
+// LCFILTER_MAX_MEDIAN
+#define LCFILTER_RING_LEN 16
+// fractional bits kept in the EMA state
+#define LCFILTER_EMA_FRACBITS 8
+// each revolution is divided into this many phase bins. averaging the bin
+// means (rather than all samples) weights every phase equally, even if our
+// sampling isn't uniform across the revolution.
+#define LCFILTER_PHASE_BINS 16
+
+typedef struct lcfilter {
+  unsigned median;    // median-of-N, N odd
+  unsigned emashift;  // y += (x - y) >> emashift
+  int32_t ring[LCFILTER_RING_LEN];
+  uint32_t count;     // samples since the last reset
+  int64_t ema;        // raw << LCFILTER_EMA_FRACBITS
+  // rotation-synchronous accumulation
+  bool windowopen;
+  uint32_t windowedge; // hall event which began the current revolution
+  int64_t phasesum[LCFILTER_PHASE_BINS];
+  uint32_t phasecount[LCFILTER_PHASE_BINS];
+} lcfilter;
+
+// median and emashift must be valid (median odd and no more than
+// LCFILTER_MAX_MEDIAN, emashift no more than LCFILTER_MAX_EMA).
+void lcfilter_init(lcfilter* f, unsigned median, unsigned emashift);
+
+// push a raw sample through the median and EMA filters. returns the median
+// of the most recent samples.
+int32_t lcfilter_push(lcfilter* f, int32_t raw);
+
+// the EMA as of the last lcfilter_push()
+static inline int32_t
+lcfilter_ema(const lcfilter* f){
+  return f->ema >> LCFILTER_EMA_FRACBITS;
+}
+
+typedef enum {
+  LCPHASE_STOPPED,     // not turning; any partial revolution was abandoned
+  LCPHASE_ACCUMULATED, // the sample went into the current revolution
+  LCPHASE_SKIPPED,     // no pulse period to place it by, so it was dropped
+  LCPHASE_REVOLUTION,  // a revolution closed, with its average in *mean
+  LCPHASE_GAPPED,      // a revolution closed with a phase unsampled, and
+                       // was discarded
+} lcphase_result;
+
+// tag the median m, taken at 'now', with the spool's phase, and accumulate
+// it. edges is the count of hall events seen (pass 0 if the spool isn't
+// turning), last and prev the times of the most recent two, and ppr the
+// events per revolution. coincident edges (contact bounce) give no period,
+// and the sample is skipped. a closed revolution is reported in preference
+// to what became of m.
+lcphase_result lcfilter_phase(lcfilter* f, int32_t m, uint32_t edges,
+                              int64_t last, int64_t prev, unsigned ppr,
+                              int64_t now, int32_t* mean);
+
+#endif
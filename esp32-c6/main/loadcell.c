@@ -0,0 +1,333 @@
+#include "loadcell.h"
+#include "lcfilter.h"
+#include "dankdryer.h"
+#include "networking.h"
+#include "nau7802.h"
+#include "hal.h"
+#include <esp_log.h>
+#include <stdatomic.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#define TAG "lcell"
+
+// below the control task, above sensor acquisition (with which we share the
+// I2C bus), so that bus contention doesn't drop conversions.
+#define LOADCELL_TASK_PRIO 8
+#define LOADCELL_STACK_BYTES 3072
+#define I2C_TIMEOUT_MS 100
+
+// NAU7802 registers we touch directly, rather than through the component
+#define NAU_PU_CTRL 0x00
+#define NAU_PU_CTRL_CR 0x20   // cycle ready (conversion available)
+#define NAU_CTRL2 0x02
+#define NAU_CTRL2_CALS 0x04   // start/in-progress calibration
+#define NAU_CTRL2_CRS_SHIFT 4 // conversion rate select, 3 bits
+#define NAU_CTRL2_CRS_MASK 0x70
+
+#define DEFAULT_SPS 80
+#define DEFAULT_GAIN 32
+#define DEFAULT_MEDIAN 5  // median-of-N, N odd
+#define DEFAULT_EMA 3     // y += (x - y) >> shift
+// a revolution average older than this is not used
+#define SYNC_STALE_MS 30000
+// we poll this much faster than the conversion rate, so that drift between
+// our clock and the NAU7802's can't put two conversions between polls
+#define POLL_SPEEDUP_NUM 7
+#define POLL_SPEEDUP_DEN 8
+
+static uint32_t SampleRate = DEFAULT_SPS;
+static uint32_t Gain = DEFAULT_GAIN;
+static uint32_t MedianN = DEFAULT_MEDIAN;
+static uint32_t EMAShift = DEFAULT_EMA;
+
+static i2c_master_bus_handle_t I2CMaster;
+static i2c_master_dev_handle_t NAU7802;
+static bool NAUAvailable;
+static TaskHandle_t LoadcellTask;
+static esp_timer_handle_t PollTimer;
+
+// owned by the acquisition task
+static lcfilter Filter;
+static const tach* Hall;
+
+// published to readers
+static _Atomic(int32_t) Filtered;
+static _Atomic(bool) FilteredValid;
+static _Atomic(int32_t) SyncFiltered;
+static _Atomic(uint32_t) SyncStampMs;
+static _Atomic(bool) SyncValid;
+
+// map a rate in SPS to the CRS field. returns -1 for unsupported rates.
+static int
+crs_from_sps(uint32_t sps){
+  switch(sps){
+    case 10: return 0;
+    case 20: return 1;
+    case 40: return 2;
+    case 80: return 3;
+    case 320: return 7;
+  }
+  return -1;
+}
+
+static bool
+gain_valid_p(uint32_t gain){
+  return gain && gain <= 128 && !(gain & (gain - 1));
+}
+
+static bool
+median_valid_p(uint32_t n){
+  return n % 2 && n <= LCFILTER_MAX_MEDIAN;
+}
+
+static bool
+ema_valid_p(uint32_t shift){
+  return shift <= LCFILTER_MAX_EMA;
+}
+
+bool loadcell_params_valid_p(uint32_t sps, uint32_t gain, uint32_t median, uint32_t ema){
+  return crs_from_sps(sps) >= 0 && gain_valid_p(gain) &&
+         median_valid_p(median) && ema_valid_p(ema);
+}
+
+int read_loadcell_pstore(nvs_handle_t nvsh){
+  uint32_t v = SampleRate;
+  if(nvs_get_opt_u32(nvsh, LCSPS_RECNAME, &v) == 0){
+    if(crs_from_sps(v) >= 0){
+      SampleRate = v;
+    }else{
+      ESP_LOGE(TAG, "read invalid sample rate %lu", v);
+    }
+  }
+  v = Gain;
+  if(nvs_get_opt_u32(nvsh, LCGAIN_RECNAME, &v) == 0){
+    if(gain_valid_p(v)){
+      Gain = v;
+    }else{
+      ESP_LOGE(TAG, "read invalid gain %lu", v);
+    }
+  }
+  v = MedianN;
+  if(nvs_get_opt_u32(nvsh, LCMEDIAN_RECNAME, &v) == 0){
+    if(median_valid_p(v)){
+      MedianN = v;
+    }else{
+      ESP_LOGE(TAG, "read invalid median depth %lu", v);
+    }
+  }
+  v = EMAShift;
+  if(nvs_get_opt_u32(nvsh, LCEMA_RECNAME, &v) == 0){
+    if(ema_valid_p(v)){
+      EMAShift = v;
+    }else{
+      ESP_LOGE(TAG, "read invalid ema shift %lu", v);
+    }
+  }
+  return 0;
+}
+
+static int
+nau_read_reg(uint8_t reg, uint8_t* val){
+  esp_err_t e = i2c_master_transmit_receive(NAU7802, &reg, 1, val, 1, I2C_TIMEOUT_MS);
+  if(e != ESP_OK){
+    ESP_LOGE(TAG, "error (%s) reading register 0x%02x", esp_err_to_name(e), reg);
+    return -1;
+  }
+  return 0;
+}
+
+static int
+nau_write_reg(uint8_t reg, uint8_t val){
+  uint8_t buf[2] = { reg, val };
+  esp_err_t e = i2c_master_transmit(NAU7802, buf, sizeof(buf), I2C_TIMEOUT_MS);
+  if(e != ESP_OK){
+    ESP_LOGE(TAG, "error (%s) writing register 0x%02x", esp_err_to_name(e), reg);
+    return -1;
+  }
+  return 0;
+}
+
+// set the conversion rate, and run an internal offset calibration, which the
+// datasheet recommends following any change to rate or gain.
+static int
+nau_set_rate(uint32_t sps){
+  uint8_t c2;
+  if(nau_read_reg(NAU_CTRL2, &c2)){
+    return -1;
+  }
+  c2 &= ~NAU_CTRL2_CRS_MASK;
+  c2 |= crs_from_sps(sps) << NAU_CTRL2_CRS_SHIFT;
+  if(nau_write_reg(NAU_CTRL2, c2 | NAU_CTRL2_CALS)){
+    return -1;
+  }
+  // calibration takes a few conversion cycles
+  for(int i = 0 ; i < 50 ; ++i){
+    vTaskDelay(pdMS_TO_TICKS(20));
+    if(nau_read_reg(NAU_CTRL2, &c2)){
+      return -1;
+    }
+    if(!(c2 & NAU_CTRL2_CALS)){
+      return 0;
+    }
+  }
+  ESP_LOGE(TAG, "calibration didn't complete");
+  return -1;
+}
+
+static int
+setup_nau7802(void){
+  if(nau7802_detect(I2CMaster, &NAU7802)){
+    return -1;
+  }
+  if(nau7802_poweron(NAU7802)){
+    return -1;
+  }
+  if(nau7802_enable_ldo(NAU7802, NAU7802_LDO_30V, false)){
+    return -1;
+  }
+  if(nau7802_set_bandgap_chop(NAU7802, false)){
+    return -1;
+  }
+  if(nau7802_set_pga_cap(NAU7802, true)){
+    return -1;
+  }
+  if(nau7802_set_gain(NAU7802, Gain)){
+    return -1;
+  }
+  if(nau_set_rate(SampleRate)){
+    return -1;
+  }
+  ESP_LOGI(TAG, "sampling at %lu SPS, gain %lu, median-of-%lu, ema >> %lu",
+           SampleRate, Gain, MedianN, EMAShift);
+  lcfilter_init(&Filter, MedianN, EMAShift);
+  NAUAvailable = true;
+  return 0;
+}
+
+// tag the (median-filtered) sample m with the spool's phase, and publish
+// the average of each revolution as it completes. if the motor is off or
+// the spool isn't turning, abandon any partial revolution.
+static void
+sync_sample(int32_t m, int64_t now){
+  int64_t last = 0, prev = 0;
+  uint32_t h = tach_last_edges(Hall, &last, &prev);
+  if(!get_motor_state() || tach_rpm(Hall, now) == 0){
+    h = 0;
+  }
+  int32_t mean;
+  switch(lcfilter_phase(&Filter, m, h, last, prev, Hall->ppr, now, &mean)){
+    case LCPHASE_STOPPED:
+      atomic_store(&SyncValid, false);
+      break;
+    case LCPHASE_REVOLUTION:
+      atomic_store(&SyncFiltered, mean);
+      atomic_store(&SyncStampMs, (uint32_t)(now / 1000));
+      atomic_store(&SyncValid, true);
+      break;
+    case LCPHASE_GAPPED:
+      ESP_LOGW(TAG, "phase bin empty, discarding revolution");
+      break;
+    case LCPHASE_SKIPPED:
+      ESP_LOGD(TAG, "coincident hall edges, skipping sample");
+      break;
+    case LCPHASE_ACCUMULATED:
+      break;
+  }
+}
+
+// push a raw sample through the median and EMA filters, and publish
+static void
+filter_sample(int32_t raw){
+  const int32_t med = lcfilter_push(&Filter, raw);
+  if(Hall){
+    sync_sample(med, hal_now_us());
+  }
+  atomic_store(&Filtered, lcfilter_ema(&Filter));
+  atomic_store(&FilteredValid, true);
+}
+
+// wake the acquisition task. the tick is too coarse for our faster rates
+// (320sps wants a poll every ~3ms, but a 100Hz tick can't wait less than
+// 10ms), so polls are paced by an esp_timer rather than xTaskDelayUntil().
+static void
+poll_timer_cb(void* v){
+  xTaskNotifyGive(LoadcellTask);
+}
+
+static void
+loadcell_task(void* v){
+  while(1){
+    if(!NAUAvailable){
+      atomic_store(&FilteredValid, false);
+      if(setup_nau7802()){
+        vTaskDelay(pdMS_TO_TICKS(1000));
+        continue;
+      }
+    }
+    // we have no DRDY line, so poll for each conversion
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    uint8_t pu;
+    if(nau_read_reg(NAU_PU_CTRL, &pu)){
+      NAUAvailable = false;
+      continue;
+    }
+    if(!(pu & NAU_PU_CTRL_CR)){
+      continue; // conversion not yet available
+    }
+    int32_t raw;
+    if(nau7802_read(NAU7802, &raw)){
+      // don't immediately retry setup, which might hide error
+      NAUAvailable = false;
+      vTaskDelay(pdMS_TO_TICKS(1000));
+      continue;
+    }
+    if(raw < 0){
+      ESP_LOGE(TAG, "bad nau7802 read %" PRId32, raw);
+      continue;
+    }
+    filter_sample(raw);
+  }
+}
+
+int setup_loadcell(i2c_master_bus_handle_t master, const tach* hall){
+  I2CMaster = master;
+  Hall = hall;
+  if(xTaskCreate(loadcell_task, "loadcell", LOADCELL_STACK_BYTES, NULL,
+                 LOADCELL_TASK_PRIO, &LoadcellTask) != pdPASS){
+    ESP_LOGE(TAG, "error creating loadcell task");
+    return -1;
+  }
+  const esp_timer_create_args_t targs = {
+    .callback = poll_timer_cb,
+    .name = "lcpoll",
+  };
+  esp_err_t e = esp_timer_create(&targs, &PollTimer);
+  if(e != ESP_OK){
+    ESP_LOGE(TAG, "error (%s) creating poll timer", esp_err_to_name(e));
+    return -1;
+  }
+  const uint64_t periodus = 1000000ull * POLL_SPEEDUP_NUM / POLL_SPEEDUP_DEN / SampleRate;
+  if((e = esp_timer_start_periodic(PollTimer, periodus)) != ESP_OK){
+    ESP_LOGE(TAG, "error (%s) starting poll timer", esp_err_to_name(e));
+    return -1;
+  }
+  ESP_LOGI(TAG, "polling every %" PRIu64 "us for %" PRIu32 "sps", periodus, SampleRate);
+  return 0;
+}
+
+bool loadcell_raw(int32_t* raw){
+  if(!atomic_load(&FilteredValid)){
+    return false;
+  }
+  if(atomic_load(&SyncValid) && get_motor_state()){
+    uint32_t age = (uint32_t)(hal_now_us() / 1000) - atomic_load(&SyncStampMs);
+    if(age < SYNC_STALE_MS){
+      *raw = atomic_load(&SyncFiltered);
+      return true;
+    }
+  }
+  *raw = atomic_load(&Filtered);
+  return true;
+}
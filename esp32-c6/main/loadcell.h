@@ -0,0 +1,34 @@
+#ifndef DANKDRYER_LOADCELL
+#define DANKDRYER_LOADCELL
+
+#include <nvs.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "tach.h"
+#include <driver/i2c_master.h>
+
+#define LCSPS_RECNAME "lcsps"
+#define LCGAIN_RECNAME "lcgain"
+#define LCMEDIAN_RECNAME "lcmedian"
+#define LCEMA_RECNAME "lcema"
+
+// read sample rate, gain, and filter parameters from nvs (call before
+// setup_loadcell(); changes take effect at the next boot).
+int read_loadcell_pstore(nvs_handle_t nvsh);
+
+// are these a supported sample rate (10, 20, 40, 80, or 320), gain (a power
+// of two up to 128), median depth (odd, up to 9), and EMA shift (up to 8)?
+bool loadcell_params_valid_p(uint32_t sps, uint32_t gain, uint32_t median, uint32_t ema);
+
+// start the acquisition task, which (re)initializes the NAU7802 on the
+// specified bus as necessary, and then samples it continuously. hall is the
+// spool's tach, used to phase-tag samples while the motor is running.
+int setup_loadcell(i2c_master_bus_handle_t master, const tach* hall);
+
+// get the most recent filtered reading, in raw ADC units. while the spool
+// is turning, this is the mean over the last whole revolution (cancelling
+// ripple from eccentric mass); otherwise it's the plain filtered reading.
+// returns false if we have no valid reading.
+bool loadcell_raw(int32_t* raw);
+
+#endif
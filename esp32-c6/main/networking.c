@@ -3,8 +3,15 @@
 #include "version.h"
 #include "efuse.h"
 #include "ota.h"
+#include "spool.h"
+#include "pubq.h"
+#include "sse.h"
+#include "histstore.h"
 #include <mdns.h>
 #include <esp_log.h>
+#include <inttypes.h>
+#include <esp_random.h>
+#include <stdatomic.h>
 #include <esp_wifi.h>
 #include <esp_netif.h>
 #include <lwip/netif.h>
@@ -20,6 +27,8 @@
 #include <services/gap/ble_svc_gap.h>
 #include <services/gatt/ble_svc_gatt.h>
 #include <nimble/nimble_port_freertos.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 
 #define TAG "net"
 
@@ -67,12 +76,32 @@ static const ble_uuid128_t mqtttopic_chr_uuid =
 
 static SemaphoreHandle_t MQTTSemaphore;
 
+// publications are queued by their producers, and sent by the publisher
+// task, which alone calls into the client to publish (and thus alone waits
+// on MQTTSemaphore and the network). PubMsg is its working copy.
+#define PUBLISHER_TASK_PRIO 3
+#define PUBLISHER_TASK_STACK_BYTES 4096
+// kinds of queued publication
+#define PUBKIND_CBOR 0x1u   // to CBOR_SUBTOPIC, rather than the topic
+#define PUBKIND_SPOOL 0x2u  // telemetry, to be spooled if it can't be sent
+static pubq PubQueue;
+static pubq_msg PubMsg;
+static TaskHandle_t Publisher;
+// a producer's copy of a message it evicted from the full queue, so that
+// it can be spooled. there's one, held under EvictLock; a producer which
+// finds it taken simply loses what it evicts, as it would have anyway.
+static pubq_msg Evicted;
+static SemaphoreHandle_t EvictLock;
+
 // MQTTConfig is the actual config we're working with. BLEConfig is one being
 // built up via a series of BLE GATT characteristic writes. When we commit the
 // BLEConfig, we copy the entries into MQTTConfig.
 static mqttconfig MQTTConfig, BLEConfig;
 
 static esp_mqtt_client_handle_t MQTTHandle;
+// set and cleared from the MQTT event handler, which mustn't take
+// MQTTSemaphore (we hold it across calls into the client)
+static _Atomic(bool) MQTTConnected;
 
 static httpd_handle_t HTTPServ;
 static uint8_t WifiEssid[33];
@@ -250,21 +279,6 @@ state_str(void){
           SetupState == SETUP_STATE_CONFIGURED ? "Configured" : "Unknown state";
 }
 
-static inline const char*
-bool_as_onoff_http(bool b){
-  return b ? "<font color=\"green\">on</font>" : "off";
-}
-
-static inline const char*
-motor_state_http(void){
-  return bool_as_onoff_http(get_motor_state());
-}
-
-static inline const char*
-heater_state_http(void){
-  return bool_as_onoff_http(get_heater_state());
-}
-
 static void
 set_network_state(int state){
   // FIXME lock
@@ -276,18 +290,93 @@ set_network_state(int state){
   }
 }
 
-void mqtt_publish(const char *s){
-  size_t slen = strlen(s);
-  ESP_LOGI(TAG, "MQTT: %s", s);
-  if(mqtt_lock()){
-    return;
+// binary telemetry goes to TOPIC/cbor, so that subscribers to TOPIC
+// needn't know about it
+#define CBOR_SUBTOPIC "/cbor"
+
+// store telemetry m, which couldn't be published, in the spool
+static void
+spool_msg(const pubq_msg* m){
+  if(m->kind & PUBKIND_SPOOL){
+    spool_append(m->kind & PUBKIND_CBOR ? TELEMETRY_FMT_CBOR : TELEMETRY_FMT_JSON,
+                 m->buf, m->len);
+  }
+}
+
+// queue len bytes for the publisher task. JSON includes its terminator.
+// returns -1 if we're not connected to the broker, or the queue couldn't
+// take it. never waits on the network, but telemetry evicted from a full
+// queue is spooled (as is ours, by our caller, if it can't be queued).
+static int
+enqueue(unsigned kind, const void* buf, size_t len){
+  if(!MQTTConnected){
+    return -1;
   }
-  if(MQTTHandle && MQTTConfig.topic){
-    if(esp_mqtt_client_publish(MQTTHandle, MQTTConfig.topic, s, slen, 0, 0)){
-      ESP_LOGE(TAG, "couldn't publish %zuB mqtt message", slen);
+  pubq_msg* ev = xSemaphoreTake(EvictLock, 0) == pdTRUE ? &Evicted : NULL;
+  const int r = pubq_push(&PubQueue, kind, buf, len, ev);
+  if(ev){
+    if(ev->len){
+      spool_msg(ev);
     }
+    xSemaphoreGive(EvictLock);
   }
-  mqtt_unlock();
+  if(r){
+    ESP_LOGE(TAG, "couldn't queue %zuB mqtt message", len);
+    return -1;
+  }
+  xTaskNotifyGive(Publisher);
+  return 0;
+}
+
+// publish m to the configured topic. telemetry which can't be published
+// is spooled.
+static void
+send_msg(const pubq_msg* m){
+  const bool cbor = m->kind & PUBKIND_CBOR;
+  // JSON is queued with its terminator, which we needn't send
+  const size_t len = cbor ? m->len : m->len - 1;
+  int r = -1;
+  if(mqtt_lock() == 0){
+    if(MQTTHandle && MQTTConfig.topic){
+      char topic[strlen(MQTTConfig.topic) + strlen(CBOR_SUBTOPIC) + 1];
+      strcpy(topic, MQTTConfig.topic);
+      if(cbor){
+        strcat(topic, CBOR_SUBTOPIC);
+      }
+      if(esp_mqtt_client_publish(MQTTHandle, topic, (const char*)m->buf, len, 0, 0) >= 0){
+        r = 0;
+      }
+    }
+    mqtt_unlock();
+  }
+  if(r){
+    ESP_LOGE(TAG, "couldn't publish %zuB mqtt message", len);
+    spool_msg(m);
+  }
+}
+
+static void
+publisher_task(void* v){
+  while(1){
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    while(pubq_pop(&PubQueue, &PubMsg) == 0){
+      send_msg(&PubMsg);
+    }
+  }
+}
+
+int mqtt_publish(const char *s){
+  ESP_LOGI(TAG, "MQTT: %s", s);
+  return enqueue(PUBKIND_SPOOL, s, strlen(s) + 1);
+}
+
+int mqtt_publish_cbor(const void* buf, size_t len){
+  ESP_LOGI(TAG, "MQTT: %zuB CBOR", len);
+  return enqueue(PUBKIND_CBOR | PUBKIND_SPOOL, buf, len);
+}
+
+uint32_t mqtt_publish_drops(void){
+  return pubq_dropped(&PubQueue);
 }
 
 static void
@@ -313,7 +402,7 @@ mqtt_publish_hadiscovery(void){
   // FIXME set up discovery message
   static const char s[] = "";
   ESP_LOGI(TAG, "HADiscovery to %s: [%s]", topic, s);
-  mqtt_publish(s);
+  enqueue(0, s, sizeof(s));
   #undef CKEY
   #undef DKEY
   #undef DISCOVERYPREFIX
@@ -330,10 +419,23 @@ mqtt_event_handler(void* arg, esp_event_base_t base, int32_t id, void* data){
     subscribe(MQTTHandle, UPWM_CHANNEL);
     subscribe(MQTTHandle, OTA_CHANNEL);
     subscribe(MQTTHandle, DRY_CHANNEL);
+    subscribe(MQTTHandle, AUTOTUNE_CHANNEL);
     subscribe(MQTTHandle, TARE_CHANNEL);
     subscribe(MQTTHandle, CALIBRATE_CHANNEL);
     subscribe(MQTTHandle, FACTORYRESET_CHANNEL);
+    subscribe(MQTTHandle, TELEMETRY_CHANNEL);
+    subscribe(MQTTHandle, HEARTBEAT_CHANNEL);
+    subscribe(MQTTHandle, RATES_CHANNEL);
+    subscribe(MQTTHandle, STREAM_CHANNEL);
+    subscribe(MQTTHandle, CTLPERIOD_CHANNEL);
+    subscribe(MQTTHandle, LOADCELL_CHANNEL);
+    MQTTConnected = true;
     mqtt_publish_hadiscovery();
+    spool_kick();
+  }else if(id == MQTT_EVENT_DISCONNECTED){
+    ESP_LOGW(TAG, "disconnected from mqtt");
+    MQTTConnected = false;
+    set_network_state(MQTT_CONNECTING);
   }else if(id == MQTT_EVENT_DATA){
     handle_mqtt_msg(data);
   }else{
@@ -349,36 +451,9 @@ httpd_get_handler(httpd_req_t *req){
     ESP_LOGE(TAG, "couldn't allocate httpd response");
     return ESP_FAIL;
   }
-  time_t now = time(NULL);
-  // FIXME need locking or atomics now
-  int slen = snprintf(resp, RESPBYTES, "<!DOCTYPE html><html><head><title>" DEVICE "</title></head>"
-            "<body><h2>a drying comes across the sky</h2><br/>"
-            "<b>lpwm:</b> %u<br/>"
-            "<b>upwm:</b> %u<br/>"
-            "<b>lrpm</b>: %u<br/>"
-            "<b>urpm</b>: %u<br/>"
-            "<b>srpm</b>: %" PRIu32 "<br/>"
-            "<b>motor</b>: %s<br/>"
-            "<b>heater</b>: %s<br/>"
-            "<b>mass</b>: %.2f<br/>"
-            "<b>tare</b>: %.2f<br/>"
-            "<b>lm35</b>: %.2f<br/>"
-            "<b>esp32s3</b>: %.2f<br/>"
-            "<b>dryends</b>: %llu<br/>"
-            "<b>target temp</b>: %lu<br/>"
-            "<hr/>%s<br/>"
-            "</body></html>",
-            get_lower_pwm(), get_upper_pwm(),
-            get_lower_rpm(), get_upper_rpm(),
-            get_spool_rpm(),
-            motor_state_http(),
-            heater_state_http(),
-            get_weight(), get_tare(),
-            get_upper_temp(), get_lower_temp(),
-            get_dry_ends_at(),
-            get_target_temp(),
-            asctime(localtime(&now))
-            );
+  telemetry t;
+  get_telemetry(&t);
+  int slen = telemetry_html(resp, RESPBYTES, &t, time(NULL));
   esp_err_t ret = ESP_FAIL;
   if(slen < 0 || slen >= RESPBYTES){
     ESP_LOGE(TAG, "httpd response too large (%d)", slen);
@@ -394,6 +469,207 @@ httpd_get_handler(httpd_req_t *req){
   return ret;
 }
 
+// the JSON state API. the server runs all handlers on its one task, so a
+// single response buffer suffices, and we needn't allocate per request.
+#define STATE_URI "/api/v1/state"
+static char StateJSON[TELEMETRY_JSON_MAX];
+// the snapshot generation starts over with each boot, so its ETag also
+// carries a value chosen at boot
+static uint32_t ETagBoot;
+
+// does the request's If-None-Match list etag (or "*")?
+static bool
+etag_matches(httpd_req_t* req, const char* etag){
+  char inm[128];
+  if(httpd_req_get_hdr_value_str(req, "If-None-Match", inm, sizeof(inm)) != ESP_OK){
+    return false;
+  }
+  return !strcmp(inm, "*") || strstr(inm, etag);
+}
+
+// the snapshot as the compact JSON we publish, less the histograms and
+// samples. its ETag changes with each snapshot, so a client polling faster
+// than the control loop gets a 304 (with no body) until there's news.
+static esp_err_t
+httpd_state_handler(httpd_req_t *req){
+  telemetry t;
+  const uint32_t gen = get_telemetry(&t);
+  char etag[20];
+  snprintf(etag, sizeof(etag), "\"%08" PRIx32 "-%08" PRIx32 "\"", ETagBoot, gen);
+  httpd_resp_set_hdr(req, "ETag", etag);
+  httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+  esp_err_t e;
+  if(etag_matches(req, etag)){
+    httpd_resp_set_status(req, "304 Not Modified");
+    e = httpd_resp_send(req, NULL, 0);
+  }else{
+    int jlen = telemetry_json(&t, StateJSON, sizeof(StateJSON));
+    if(jlen < 0){
+      ESP_LOGE(TAG, "state exceeded %zuB", sizeof(StateJSON));
+      return httpd_resp_send_500(req);
+    }
+    httpd_resp_set_type(req, "application/json");
+    e = httpd_resp_send(req, StateJSON, jlen);
+  }
+  if(e != ESP_OK){
+    ESP_LOGE(TAG, "failure (%s) sending http response", esp_err_to_name(e));
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
+// the history, at 1s (the default), 1m, or 1h resolution, streamed in
+// chunks as it's read. as with the state API, the buffers are static.
+#define HISTORY_URI "/api/v1/history"
+#define HISTORY_CHUNK_RECS 16
+static char HistoryChunk[1024];
+static union {
+  history_sample s[HISTORY_CHUNK_RECS];
+  history_rollup r[HISTORY_CHUNK_RECS];
+} HistoryRecs;
+
+// buffers output into HistoryChunk, sending it whenever it fills
+typedef struct chunker {
+  httpd_req_t* req;
+  size_t used;
+  esp_err_t err;
+} chunker;
+
+static void
+chunk_put(chunker* c, const char* s, size_t len){
+  if(c->err != ESP_OK){
+    return;
+  }
+  if(c->used + len > sizeof(HistoryChunk)){
+    c->err = httpd_resp_send_chunk(c->req, HistoryChunk, c->used);
+    c->used = 0;
+    if(c->err != ESP_OK){
+      return;
+    }
+  }
+  memcpy(HistoryChunk + c->used, s, len);
+  c->used += len;
+}
+
+// put an element of a JSON array rendered at row + 1, with a separator
+// written to row[0] unless it's the first
+static void
+chunk_elem(chunker* c, char* row, int rlen, bool* first){
+  if(rlen < 0){
+    return;
+  }
+  if(*first){
+    chunk_put(c, row + 1, rlen);
+    *first = false;
+  }else{
+    row[0] = ',';
+    chunk_put(c, row, rlen + 1);
+  }
+}
+
+static esp_err_t
+chunk_end(chunker* c){
+  if(c->err == ESP_OK && c->used){
+    c->err = httpd_resp_send_chunk(c->req, HistoryChunk, c->used);
+  }
+  if(c->err == ESP_OK){
+    c->err = httpd_resp_send_chunk(c->req, NULL, 0);
+  }
+  return c->err;
+}
+
+// seconds per record requested via the res parameter, or 0 if invalid
+static uint32_t
+history_res(httpd_req_t* req){
+  char query[32];
+  char res[4];
+  if(httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK ||
+      httpd_query_key_value(query, "res", res, sizeof(res)) != ESP_OK){
+    return 1;
+  }
+  if(!strcmp(res, "1s")){
+    return 1;
+  }else if(!strcmp(res, "1m")){
+    return HistoryPeriodSec[HISTORY_MINUTE];
+  }else if(!strcmp(res, "1h")){
+    return HistoryPeriodSec[HISTORY_HOUR];
+  }
+  return 0;
+}
+
+// the 1Hz samples held in RAM. should the oldest be overwritten while we
+// send, they're sent as skipped, so that every row stays one second on.
+static void
+send_history_samples(chunker* c){
+  telemetry t;
+  get_telemetry(&t);
+  uint32_t sec = 0;
+  unsigned n = get_history(&sec, HistoryRecs.s, HISTORY_CHUNK_RECS);
+  char row[HISTORY_SAMPLE_JSON_MAX + 96];
+  int rlen = snprintf(row, sizeof(row), "{\"res\":1,\"uptimesec\":%lld,", t.uptimeus / 1000000ll);
+  chunk_put(c, row, rlen);
+  if(t.epochms){
+    rlen = snprintf(row, sizeof(row), "\"epochms\":%lld,", t.epochms);
+    chunk_put(c, row, rlen);
+  }
+  rlen = snprintf(row, sizeof(row), "\"t0sec\":%" PRIu32 ",\"samples\":[", sec);
+  chunk_put(c, row, rlen);
+  bool first = true;
+  uint32_t want = sec;
+  while(n && c->err == ESP_OK){
+    for( ; want < sec ; ++want){
+      chunk_elem(c, strcpy(row, " null"), 4, &first);
+    }
+    for(unsigned i = 0 ; i < n ; ++i){
+      rlen = history_sample_json(&HistoryRecs.s[i], row + 1, sizeof(row) - 1);
+      chunk_elem(c, row, rlen, &first);
+    }
+    sec += n;
+    want = sec;
+    n = get_history(&sec, HistoryRecs.s, HISTORY_CHUNK_RECS);
+  }
+  chunk_put(c, "]}", 2);
+}
+
+// the rollups of tier from flash, oldest first
+static void
+send_history_rollups(chunker* c, history_tier tier){
+  char row[HISTORY_ROLLUP_JSON_MAX + 1];
+  int rlen = snprintf(row, sizeof(row), "{\"res\":%" PRIu32 ",\"rollups\":[", HistoryPeriodSec[tier]);
+  chunk_put(c, row, rlen);
+  histstore_cursor cur = { .tier = tier, };
+  bool first = true;
+  int n;
+  while(c->err == ESP_OK && (n = histstore_read(&cur, HistoryRecs.r, HISTORY_CHUNK_RECS)) > 0){
+    for(int i = 0 ; i < n ; ++i){
+      rlen = history_rollup_json(&HistoryRecs.r[i], row + 1, sizeof(row) - 1);
+      chunk_elem(c, row, rlen, &first);
+    }
+  }
+  chunk_put(c, "]}", 2);
+}
+
+static esp_err_t
+httpd_history_handler(httpd_req_t *req){
+  const uint32_t res = history_res(req);
+  if(res == 0){
+    return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "res must be 1s, 1m, or 1h");
+  }
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+  chunker c = { .req = req, .err = ESP_OK, };
+  if(res == 1){
+    send_history_samples(&c);
+  }else{
+    send_history_rollups(&c, res == HistoryPeriodSec[HISTORY_MINUTE] ? HISTORY_MINUTE : HISTORY_HOUR);
+  }
+  esp_err_t e = chunk_end(&c);
+  if(e != ESP_OK){
+    ESP_LOGE(TAG, "failure (%s) sending history", esp_err_to_name(e));
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
 
 static int
 setup_httpd(void){
@@ -413,6 +689,30 @@ setup_httpd(void){
     ESP_LOGE(TAG, "failure (%s) preparing URI %s", esp_err_to_name(err), httpd_get.uri);
     return -1;
   }
+  ETagBoot = esp_random();
+  const httpd_uri_t httpd_state = {
+    .uri = STATE_URI,
+    .method = HTTP_GET,
+    .handler = httpd_state_handler,
+    .user_ctx = NULL,
+  };
+  if((err = httpd_register_uri_handler(HTTPServ, &httpd_state)) != ESP_OK){
+    ESP_LOGE(TAG, "failure (%s) preparing URI %s", esp_err_to_name(err), httpd_state.uri);
+    return -1;
+  }
+  const httpd_uri_t httpd_history = {
+    .uri = HISTORY_URI,
+    .method = HTTP_GET,
+    .handler = httpd_history_handler,
+    .user_ctx = NULL,
+  };
+  if((err = httpd_register_uri_handler(HTTPServ, &httpd_history)) != ESP_OK){
+    ESP_LOGE(TAG, "failure (%s) preparing URI %s", esp_err_to_name(err), httpd_history.uri);
+    return -1;
+  }
+  if(sse_init(HTTPServ)){
+    return -1;
+  }
   return 0;
 }
 
@@ -557,6 +857,10 @@ setup_wifi(void){
     ESP_LOGE(TAG, "error (%s) registering mqtt events", esp_err_to_name(err));
     return -1;
   }
+  if((err = esp_mqtt_client_register_event(MQTTHandle, MQTT_EVENT_DISCONNECTED, mqtt_event_handler, NULL)) != ESP_OK){
+    ESP_LOGE(TAG, "error (%s) registering mqtt events", esp_err_to_name(err));
+    return -1;
+  }
   if((err = esp_wifi_set_mode(WIFI_MODE_STA)) != ESP_OK){
     ESP_LOGE(TAG, "error (%s) setting STA mode", esp_err_to_name(err));
     return -1;
@@ -980,6 +1284,16 @@ int setup_network(void){
     ESP_LOGE(TAG, "error creating semaphore");
     return -1;
   }
+  if((EvictLock = xSemaphoreCreateMutex()) == NULL){
+    ESP_LOGE(TAG, "error creating semaphore");
+    return -1;
+  }
+  pubq_init(&PubQueue);
+  if(xTaskCreate(publisher_task, "mqttpub", PUBLISHER_TASK_STACK_BYTES, NULL,
+                 PUBLISHER_TASK_PRIO, &Publisher) != pdPASS){
+    ESP_LOGE(TAG, "error creating publisher task");
+    return -1;
+  }
   set_client_name();
   int sstate;
   read_mqtt_config(&mqttconf);
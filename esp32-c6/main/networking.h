@@ -6,30 +6,40 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <soc/gpio_num.h>
+#include <mqtt_client.h>
+#include "ctlmsg.h"
+#include "telemetry.h"
+#include "history.h"
 
 int setup_network(void);
+void handle_mqtt_msg(const esp_mqtt_event_t* e);
 int handle_dry(unsigned sec, unsigned temp);
-int extract_bool(const char* data, size_t dlen, bool* val);
-int extract_pwm(const char* data, size_t dlen);
 void set_motor(bool enabled);
 void set_lower_pwm(unsigned pwm);
 void set_upper_pwm(unsigned pwm);
 unsigned get_lower_pwm(void);
 unsigned get_upper_pwm(void);
-unsigned get_lower_rpm(void);
-unsigned get_upper_rpm(void);
-uint32_t get_spool_rpm(void);
-float get_weight(void);
-float get_tare(void);
 float get_upper_temp(void);
-float get_lower_temp(void);
-unsigned long long get_dry_ends_at(void);
-unsigned long get_target_temp(void);
 bool get_motor_state(void);
 bool get_heater_state(void);
 void set_tare(void);
+// a consistent snapshot of the current state, without locking. returns its
+// generation, which increases with each control loop iteration (0 if
+// there's been none yet). histograms and samples are NULL.
+uint32_t get_telemetry(telemetry* t);
+// copy up to max 1Hz samples of the recent history, starting at uptime
+// second *sec0 (advanced to the oldest held, if it's older). returns the
+// number copied.
+unsigned get_history(uint32_t* sec0, history_sample* out, unsigned max);
 void factory_reset(void);
-void mqtt_publish(const char *s);
+// these queue a publication without blocking, returning -1 if we're not
+// connected to the broker, or it couldn't be queued. telemetry which is
+// queued but then can't be published is spooled.
+int mqtt_publish(const char *s);
+// publish len bytes of CBOR to the telemetry topic's /cbor subtopic
+int mqtt_publish_cbor(const void* buf, size_t len);
+// publications dropped from a full queue since boot
+uint32_t mqtt_publish_drops(void);
 int write_wifi_config(const unsigned char* essid, const unsigned char* psk,
                       uint32_t state);
 int read_wifi_config(unsigned char* essid, size_t essidlen,
@@ -47,15 +57,4 @@ int read_mqtt_config(mqttconfig* conf);
 int write_mqtt_config(const mqttconfig* conf);
 void mqttconfig_free(mqttconfig *conf);
 
-#define CCHAN "control/"
-#define MOTOR_CHANNEL CCHAN DEVICE "/motor"
-#define HEATER_CHANNEL CCHAN DEVICE "/heater"
-#define LPWM_CHANNEL CCHAN DEVICE "/lpwm"
-#define UPWM_CHANNEL CCHAN DEVICE "/upwm"
-#define OTA_CHANNEL CCHAN DEVICE "/ota"
-#define DRY_CHANNEL CCHAN DEVICE "/dry"
-#define TARE_CHANNEL CCHAN DEVICE "/tare"
-#define CALIBRATE_CHANNEL CCHAN DEVICE "/calibrate"
-#define FACTORYRESET_CHANNEL CCHAN DEVICE "/factoryreset"
-
 #endif
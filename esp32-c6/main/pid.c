@@ -0,0 +1,57 @@
+#include "pid.h"
+
+#define PID_FRACBITS (2 * Q8_FRACBITS) // Q8 gain times Q8 temperature
+
+void pid_init(pid* p, int32_t kp, int32_t ki, int32_t kd, int32_t outmax,
+              q8_t izone){
+  p->kp = kp;
+  p->ki = ki;
+  p->kd = kd;
+  p->outmax = outmax;
+  p->izone = izone;
+  pid_reset(p);
+}
+
+void pid_reset(pid* p){
+  p->integ = 0;
+  p->lastmeas = 0;
+  p->primed = false;
+}
+
+int32_t pid_update(pid* p, q8_t setpoint, q8_t meas, uint32_t dtms){
+  const int64_t outmax = (int64_t)p->outmax << PID_FRACBITS;
+  const q8_t err = setpoint - meas;
+  if(dtms == 0){
+    dtms = 1;
+  }
+  int64_t prop = (int64_t)p->kp * err;
+  int64_t deriv = 0;
+  if(p->primed){
+    deriv = -((int64_t)p->kd * (meas - p->lastmeas) * 1000) / dtms;
+  }
+  p->lastmeas = meas;
+  p->primed = true;
+  int64_t integ = p->integ;
+  if(p->izone == 0 || (err < p->izone && err > -p->izone)){
+    integ += ((int64_t)p->ki * err * dtms) / 1000;
+  }
+  if(integ < 0){
+    integ = 0;
+  }else if(integ > outmax){
+    integ = outmax;
+  }
+  int64_t out = prop + integ + deriv;
+  if(out > outmax){
+    out = outmax;
+    if(err > 0){
+      integ = p->integ;
+    }
+  }else if(out < 0){
+    out = 0;
+    if(err < 0){
+      integ = p->integ;
+    }
+  }
+  p->integ = integ;
+  return out >> PID_FRACBITS;
+}
@@ -0,0 +1,46 @@
+#ifndef DANKDRYER_PID
+#define DANKDRYER_PID
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "fixedpoint.h"
+
+// fixed-point PID controller with a unipolar output in [0, outmax] (for us,
+// heater duty in permille). gains are Q8:
+//  kp: output units per C of error
+//  ki: output units per C of error per second
+//  kd: output units per C/s of measurement change
+// the derivative acts on the measurement rather than the error, so setpoint
+// changes don't kick the output. the integral is clamped to the output
+// range, and does not accumulate while the output is saturated in the
+// direction of the error, nor while the error is larger than izone (the
+// chamber takes tens of minutes to come up to temperature, and integrating
+// the whole approach winds up far more than the steady-state duty).
+typedef struct pid {
+  int32_t kp, ki, kd;
+  int32_t outmax;
+  q8_t izone;     // integrate only while |error| < izone (0 for always)
+  int64_t integ;  // integral term, output units with 16 fractional bits
+  q8_t lastmeas;
+  bool primed;    // lastmeas is valid
+} pid;
+
+// defaults for the hot chamber, chosen with host/heatsim. kp of 100 puts
+// the heater at full duty until we're within 10C.
+#define PID_KP_DEFAULT (100 * Q8_ONE)
+#define PID_KI_DEFAULT (Q8_ONE / 5)
+#define PID_KD_DEFAULT 0
+#define PID_IZONE_DEFAULT (10 * Q8_ONE)
+
+void pid_init(pid* p, int32_t kp, int32_t ki, int32_t kd, int32_t outmax,
+              q8_t izone);
+
+// forget history (integral and last measurement), i.e. when the heater is
+// forced off.
+void pid_reset(pid* p);
+
+// returns the new output in [0, outmax], given the elapsed time in ms since
+// the previous update.
+int32_t pid_update(pid* p, q8_t setpoint, q8_t meas, uint32_t dtms);
+
+#endif
@@ -0,0 +1,19 @@
+#include "pstore.h"
+#include <stdio.h>
+#include <inttypes.h>
+#include <esp_log.h>
+
+#define TAG "pstore"
+
+int nvs_get_opt_u32(nvs_handle_t nh, const char* recname, uint32_t* val){
+  esp_err_t err = nvs_get_u32(nh, recname, val);
+  if(err == ESP_ERR_NVS_NOT_FOUND){
+    printf("no record '%s' in nvs\n", recname);
+    return 0;
+  }else if(err){
+    ESP_LOGE(TAG, "failure (%d) reading %s", err, recname);
+    return -1;
+  }
+  printf("read configured default %" PRIu32 " from nvs:%s\n", *val, recname);
+  return 0;
+}
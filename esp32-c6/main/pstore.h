@@ -0,0 +1,13 @@
+#ifndef DANKDRYER_PSTORE
+#define DANKDRYER_PSTORE
+
+#include <nvs.h>
+#include <stdint.h>
+
+#define NVS_HANDLE_NAME "pstore"
+
+// check for an optional record in the nvs handle. if not defined, return 0.
+// if defined, load val and return 0. on other errors, return -1.
+int nvs_get_opt_u32(nvs_handle_t nh, const char* recname, uint32_t* val);
+
+#endif
@@ -0,0 +1,87 @@
+#include "pubq.h"
+#include <string.h>
+
+void pubq_init(pubq* q){
+  for(unsigned i = 0 ; i < PUBQ_DEPTH ; ++i){
+    atomic_init(&q->slots[i].seq, i);
+  }
+  atomic_init(&q->enq, 0);
+  atomic_init(&q->deq, 0);
+  atomic_init(&q->dropped, 0);
+}
+
+// claim the oldest message, copying it into m unless m is NULL. a slot
+// whose producer hasn't finished writing it looks empty.
+static int
+take(pubq* q, pubq_msg* m){
+  unsigned pos = atomic_load_explicit(&q->deq, memory_order_relaxed);
+  while(1){
+    pubq_slot* s = &q->slots[pos % PUBQ_DEPTH];
+    const unsigned seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+    const int diff = (int)(seq - (pos + 1));
+    if(diff < 0){
+      return -1;
+    }
+    if(diff > 0){ // another consumer beat us to it
+      pos = atomic_load_explicit(&q->deq, memory_order_relaxed);
+    }else if(atomic_compare_exchange_weak_explicit(&q->deq, &pos, pos + 1,
+                  memory_order_relaxed, memory_order_relaxed)){
+      if(m){
+        m->len = s->m.len;
+        m->kind = s->m.kind;
+        memcpy(m->buf, s->m.buf, s->m.len);
+      }
+      // hand the slot back to producers, a lap later
+      atomic_store_explicit(&s->seq, pos + PUBQ_DEPTH, memory_order_release);
+      return 0;
+    }
+  }
+}
+
+// claim a free slot and fill it, returning -1 if the queue is full
+static int
+put(pubq* q, unsigned kind, const void* buf, size_t len){
+  unsigned pos = atomic_load_explicit(&q->enq, memory_order_relaxed);
+  while(1){
+    pubq_slot* s = &q->slots[pos % PUBQ_DEPTH];
+    const unsigned seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+    const int diff = (int)(seq - pos);
+    if(diff < 0){
+      return -1;
+    }
+    if(diff > 0){ // another producer beat us to it
+      pos = atomic_load_explicit(&q->enq, memory_order_relaxed);
+    }else if(atomic_compare_exchange_weak_explicit(&q->enq, &pos, pos + 1,
+                  memory_order_relaxed, memory_order_relaxed)){
+      s->m.len = len;
+      s->m.kind = kind;
+      memcpy(s->m.buf, buf, len);
+      atomic_store_explicit(&s->seq, pos + 1, memory_order_release);
+      return 0;
+    }
+  }
+}
+
+int pubq_push(pubq* q, unsigned kind, const void* buf, size_t len,
+              pubq_msg* evicted){
+  if(evicted){
+    evicted->len = 0;
+  }
+  if(len && len <= PUBQ_MSG_MAX){
+    if(put(q, kind, buf, len) == 0){
+      return 0;
+    }
+    if(take(q, evicted) == 0){
+      atomic_fetch_add_explicit(&q->dropped, 1, memory_order_relaxed);
+      if(put(q, kind, buf, len) == 0){
+        return 0;
+      }
+    }
+  }
+  atomic_fetch_add_explicit(&q->dropped, 1, memory_order_relaxed);
+  return -1;
+}
+
+int pubq_pop(pubq* q, pubq_msg* m){
+  return take(q, m);
+}
@@ -0,0 +1,60 @@
+#ifndef DANKDRYER_PUBQ
+#define DANKDRYER_PUBQ
+
+// a bounded queue of serialized MQTT publications, so that the tasks which
+// produce them never wait on the network (or on a BLE reconfiguration of
+// the client) to hand them off. it's lock-free: producers and the consumer
+// claim slots by compare-and-swap on a pair of counters, and each slot's
+// sequence number says whose turn it is (after Vyukov's bounded MPMC
+// queue). nobody ever waits on another task's progress, so it's safe
+// across priorities without inversion. when the queue is full, a producer
+// evicts the oldest message to make room, counts the drop, and gets the
+// evicted message back, so that it can be kept some other way.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "telemetry.h"
+
+// a power of two
+#define PUBQ_DEPTH 4
+
+// the largest message, which is a JSON rendering of telemetry
+#define PUBQ_MSG_MAX TELEMETRY_JSON_MAX
+
+typedef struct pubq_msg {
+  uint16_t len;
+  uint8_t kind;     // the producer's, carried through
+  uint8_t buf[PUBQ_MSG_MAX];
+} pubq_msg;
+
+typedef struct pubq_slot {
+  _Atomic(unsigned) seq;  // whose turn it is
+  pubq_msg m;
+} pubq_slot;
+
+typedef struct pubq {
+  pubq_slot slots[PUBQ_DEPTH];
+  _Atomic(unsigned) enq, deq;
+  _Atomic(uint32_t) dropped;
+} pubq;
+
+void pubq_init(pubq* q);
+
+// copy len bytes into the queue, evicting the oldest message if it's full.
+// if evicted is not NULL, the evicted message is copied there; its len is
+// 0 if none was. returns -1 if len is 0 or exceeds PUBQ_MSG_MAX, or if no
+// room could be made (another task held the oldest slot); the message is
+// then counted as dropped itself. a message can be evicted even so.
+int pubq_push(pubq* q, unsigned kind, const void* buf, size_t len,
+              pubq_msg* evicted);
+
+// copy the oldest message into m, returning -1 if there is none
+int pubq_pop(pubq* q, pubq_msg* m);
+
+static inline uint32_t
+pubq_dropped(pubq* q){
+  return atomic_load_explicit(&q->dropped, memory_order_relaxed);
+}
+
+#endif
@@ -1,14 +1,12 @@
 #include "dankdryer.h"
 #include "reset.h"
-#include "pins.h"
+#include "hal.h"
 #include <esp_log.h>
-#include <esp_timer.h>
 #include <stdatomic.h>
-#include <driver/gpio.h>
 
 #define TAG "freset"
 
-#define FRESET_HOLD_TIME_US 5000000ul
+#define FRESET_HOLD_TIME_US 5000000ll
 
 // false means we last saw it low, true high
 static bool FResetState;
@@ -17,13 +15,14 @@ static _Atomic(int64_t) last_low_start = -1;
 
 static void
 freset_intr(void* v){
+  (void)v;
   ESP_LOGI(TAG, "got an interrupt");
-  int s = gpio_get_level(FResetPin);
+  int s = hal_gpio_get(FResetPin);
   if(s == FResetState && last_low_start >= 0){
     return; // no need to change
   }
   if(!s){ // either first sample, or new low sample
-    last_low_start = esp_timer_get_time();
+    last_low_start = hal_now_us();
   }else{
     last_low_start = -1;
   }
@@ -31,29 +30,11 @@ freset_intr(void* v){
 }
 
 int setup_factory_reset(gpio_num_t pin){
-  if(gpio_set_input(pin)){
-    return -1;
-  }
-  esp_err_t e;
-  if((e = gpio_pulldown_dis(pin)) != ESP_OK){
-    ESP_LOGE(TAG, "error (%s) disabling pulldown on %d", esp_err_to_name(e), pin);
-    return -1;
-  }
-  if((e = gpio_pullup_en(pin)) != ESP_OK){
-    ESP_LOGE(TAG, "error (%s) enabling pullup on %d", esp_err_to_name(e), pin);
-    return -1;
-  }
-  if((e = gpio_set_intr_type(pin, GPIO_INTR_ANYEDGE)) != ESP_OK){
-    ESP_LOGE(TAG, "failure (%s) installing %d interrupt", esp_err_to_name(e), pin);
-    return -1;
-  }
-  if((e = gpio_isr_handler_add(pin, freset_intr, NULL)) != ESP_OK){
-    ESP_LOGE(TAG, "failure (%s) setting %d isr", esp_err_to_name(e), pin);
+  if(hal_gpio_input(pin, true, false)){
     return -1;
   }
   FResetPin = pin;
-  if((e = gpio_intr_enable(pin)) != ESP_OK){
-    ESP_LOGE(TAG, "failure (%s) enabling %d interrupt", esp_err_to_name(e), pin);
+  if(hal_gpio_on_edge(pin, freset_intr, NULL)){
     return -1;
   }
   return 0;
@@ -64,7 +45,7 @@ bool check_factory_reset(int64_t curtime){
   if(lls < 0 || curtime < 0){
     return false;
   }
-  if(gpio_get_level(FResetPin)){
+  if(hal_gpio_get(FResetPin)){
     return false;
   }
   if(curtime - lls < FRESET_HOLD_TIME_US){
@@ -2,7 +2,8 @@
 #define HOHLRAUM_RESET
 
 #include <stdint.h>
-#include <driver/gpio.h>
+#include <stdbool.h>
+#include <soc/gpio_num.h>
 
 // install an interrupt handler on the specified pin. when it goes low,
 // it saves the time. when it goes high, it marks the time with a
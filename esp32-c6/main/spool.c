@@ -0,0 +1,371 @@
+#include "spool.h"
+#include "flashring.h"
+#include "networking.h"
+#include "telemetry.h"
+#include <string.h>
+#include <esp_log.h>
+#include <inttypes.h>
+#include <esp_rom_crc.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#define TAG "spool"
+
+#define SPOOL_LABEL "spool"
+#define SECTOR_MAGIC 0x4c505344ul // "DSPL"
+// while draining, publish at most one record per interval, so that a long
+// backlog neither swamps the broker nor starves our live telemetry
+#define DRAIN_INTERVAL_MS 250
+#define DRAIN_TASK_PRIO 1
+#define DRAIN_TASK_STACK_BYTES 4096
+
+// flash bits can only be cleared without an erase, so a record moves
+// through these states by clearing successive bits of its first byte.
+#define REC_EMPTY 0xffu     // erased; no records follow in this sector
+#define REC_ALLOCATED 0x7fu // header written; torn if seen after a reboot
+#define REC_COMMITTED 0x3fu // payload written and awaiting publication
+#define REC_SENT 0x1fu      // published
+
+typedef struct record_hdr {
+  uint8_t state;
+  uint8_t fmt;
+  uint16_t len;
+  uint32_t crc;     // of the payload
+} record_hdr;
+
+// a position in the ring
+typedef struct spoolpos {
+  unsigned sector;
+  uint32_t off;
+} spoolpos;
+
+static const esp_partition_t* Part;
+static flashring Ring;
+static SemaphoreHandle_t Lock;
+static TaskHandle_t Drainer;
+static spoolpos Head;       // where the next record will be written
+static spoolpos Tail;       // where we next look for a record to drain
+static uint32_t Pending;    // committed and unsent records
+static uint32_t Lost;       // reclaimed while still unsent
+// records are read here for publication, only by the drain task
+static uint8_t DrainBuf[TELEMETRY_JSON_MAX];
+
+static inline uint32_t
+align4(uint32_t n){
+  return (n + 3) & ~3u;
+}
+
+static inline size_t
+addr_of(const spoolpos* p){
+  return flashring_addr(&Ring, p->sector) + p->off;
+}
+
+// read the record header at p. returns -1 if p is past the last record
+// which could fit in its sector.
+static int
+read_record_hdr(const spoolpos* p, record_hdr* rh){
+  if(p->off + sizeof(*rh) > Ring.sectorbytes){
+    return -1;
+  }
+  esp_err_t e = esp_partition_read(Part, addr_of(p), rh, sizeof(*rh));
+  if(e != ESP_OK){
+    ESP_LOGE(TAG, "error (%s) reading record at 0x%zx", esp_err_to_name(e), addr_of(p));
+    return -1;
+  }
+  if(rh->state == REC_EMPTY){
+    return -1;
+  }
+  // a torn header might have an impossible length
+  if(p->off + sizeof(*rh) + rh->len > Ring.sectorbytes){
+    return -1;
+  }
+  return 0;
+}
+
+static inline uint32_t
+record_bytes(const record_hdr* rh){
+  return sizeof(*rh) + align4(rh->len);
+}
+
+static int
+set_record_state(size_t addr, uint8_t state){
+  esp_err_t e = esp_partition_write(Part, addr, &state, sizeof(state));
+  if(e != ESP_OK){
+    ESP_LOGE(TAG, "error (%s) writing state at 0x%zx", esp_err_to_name(e), addr);
+    return -1;
+  }
+  return 0;
+}
+
+// the number of committed records in sector, and the offset following the
+// last record of any kind
+static uint32_t
+scan_sector(unsigned sector, uint32_t* end){
+  spoolpos p = { sector, sizeof(flashring_hdr) };
+  uint32_t committed = 0;
+  record_hdr rh;
+  while(read_record_hdr(&p, &rh) == 0){
+    committed += rh.state == REC_COMMITTED;
+    p.off += record_bytes(&rh);
+  }
+  *end = p.off;
+  return committed;
+}
+
+// make sector the head, accounting for any unsent records it held
+static int
+claim_sector(unsigned sector){
+  flashring_hdr sh;
+  if(flashring_read_hdr(&Ring, sector, &sh) == 0){
+    uint32_t end;
+    uint32_t unsent = scan_sector(sector, &end);
+    if(unsent){
+      Lost += unsent;
+      Pending -= unsent;
+      ESP_LOGW(TAG, "reclaiming sector %u lost %" PRIu32 " records", sector, unsent);
+    }
+  }
+  if(flashring_claim(&Ring, sector)){
+    return -1;
+  }
+  Head.sector = sector;
+  Head.off = sizeof(flashring_hdr);
+  return 0;
+}
+
+// move the head on to the next sector. if that's where the tail is, the
+// tail moves on to the sector after it (the oldest remaining).
+static int
+advance_head(void){
+  const unsigned next = (Head.sector + 1) % Ring.sectors;
+  if(Tail.sector == next){
+    Tail.sector = (next + 1) % Ring.sectors;
+    Tail.off = sizeof(flashring_hdr);
+  }
+  return claim_sector(next);
+}
+
+int spool_append(unsigned fmt, const void* buf, size_t len){
+  if(Part == NULL){
+    return -1;
+  }
+  const uint32_t need = sizeof(record_hdr) + align4(len);
+  if(need > Ring.sectorbytes - sizeof(flashring_hdr) || len > UINT16_MAX){
+    ESP_LOGE(TAG, "can't spool %zuB record", len);
+    return -1;
+  }
+  int ret = -1;
+  xSemaphoreTake(Lock, portMAX_DELAY);
+  if(Head.off + need > Ring.sectorbytes){
+    if(advance_head()){
+      goto done;
+    }
+  }
+  const record_hdr rh = {
+    .state = REC_ALLOCATED,
+    .fmt = fmt,
+    .len = len,
+    .crc = esp_rom_crc32_le(0, buf, len),
+  };
+  const size_t addr = addr_of(&Head);
+  esp_err_t e;
+  if((e = esp_partition_write(Part, addr, &rh, sizeof(rh))) != ESP_OK ||
+      (e = esp_partition_write(Part, addr + sizeof(rh), buf, len)) != ESP_OK){
+    ESP_LOGE(TAG, "error (%s) writing record at 0x%zx", esp_err_to_name(e), addr);
+    // don't reuse space we might have partially written
+    Head.off += need;
+    goto done;
+  }
+  Head.off += need;
+  if(set_record_state(addr, REC_COMMITTED) == 0){
+    ++Pending;
+    ret = 0;
+  }
+
+done:
+  xSemaphoreGive(Lock);
+  return ret;
+}
+
+// find the next committed record at or after Tail, and read its payload
+// into DrainBuf. Tail is left at the record. returns -1 if there are none.
+// call with Lock held.
+static int
+next_record(record_hdr* rh, uint32_t* seq){
+  while(1){
+    if(read_record_hdr(&Tail, rh)){
+      if(Tail.sector == Head.sector){
+        return -1;
+      }
+      Tail.sector = (Tail.sector + 1) % Ring.sectors;
+      Tail.off = sizeof(flashring_hdr);
+      continue;
+    }
+    const size_t addr = addr_of(&Tail);
+    if(rh->state == REC_COMMITTED){
+      flashring_hdr sh;
+      if(rh->len <= sizeof(DrainBuf) && flashring_read_hdr(&Ring, Tail.sector, &sh) == 0 &&
+          esp_partition_read(Part, addr + sizeof(*rh), DrainBuf, rh->len) == ESP_OK &&
+          esp_rom_crc32_le(0, DrainBuf, rh->len) == rh->crc){
+        *seq = sh.seq;
+        return 0;
+      }
+      ESP_LOGW(TAG, "discarding bad record at 0x%zx", addr);
+      if(set_record_state(addr, REC_SENT) == 0){
+        --Pending;
+      }
+    }
+    Tail.off += record_bytes(rh);
+  }
+}
+
+// mark the record at p (in the sector with sequence number seq) as sent,
+// unless its sector was reclaimed while we were publishing it
+static void
+mark_sent(const spoolpos* p, uint32_t seq){
+  xSemaphoreTake(Lock, portMAX_DELAY);
+  flashring_hdr sh;
+  if(flashring_read_hdr(&Ring, p->sector, &sh) == 0 && sh.seq == seq){
+    record_hdr rh;
+    if(read_record_hdr(p, &rh) == 0){
+      if(rh.state == REC_COMMITTED && set_record_state(addr_of(p), REC_SENT) == 0){
+        --Pending;
+      }
+      if(Tail.sector == p->sector && Tail.off == p->off){
+        Tail.off += record_bytes(&rh);
+      }
+    }
+  }
+  xSemaphoreGive(Lock);
+}
+
+// a record spooled earlier in this boot, before SNTP set the clock, has no
+// epochms. if the clock has since been set, we know when this boot began,
+// and thus when the record was taken; add it to the copy in DrainBuf. if
+// it won't fit, the record goes out as it is (its uptimesec and boot still
+// place it).
+static void
+rebase(record_hdr* rh){
+  telemetry t;
+  get_telemetry(&t);
+  if(t.epochms == 0){
+    return;
+  }
+  const int64_t bootms = t.epochms - t.uptimeus / 1000;
+  const int r = telemetry_rebase(rh->fmt, DrainBuf, rh->len, sizeof(DrainBuf), t.boot, bootms);
+  if(r > 0){
+    rh->len = r;
+  }
+}
+
+static void
+drain_task(void* v){
+  while(1){
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    unsigned sent = 0;
+    while(1){
+      record_hdr rh;
+      uint32_t seq;
+      xSemaphoreTake(Lock, portMAX_DELAY);
+      int r = next_record(&rh, &seq);
+      const spoolpos p = Tail;
+      xSemaphoreGive(Lock);
+      if(r){
+        break;
+      }
+      rebase(&rh);
+      // a JSON record without its terminator is dropped as if sent
+      if(rh.fmt == TELEMETRY_FMT_CBOR){
+        r = mqtt_publish_cbor(DrainBuf, rh.len);
+      }else if(rh.len && DrainBuf[rh.len - 1] == '\0'){
+        r = mqtt_publish((const char*)DrainBuf);
+      }
+      if(r){ // we'll be kicked again once we reconnect
+        break;
+      }
+      mark_sent(&p, seq);
+      ++sent;
+      vTaskDelay(pdMS_TO_TICKS(DRAIN_INTERVAL_MS));
+    }
+    if(sent){
+      ESP_LOGI(TAG, "drained %u records, %" PRIu32 " remain (%" PRIu32 " lost)", sent, Pending, Lost);
+    }
+  }
+}
+
+void spool_kick(void){
+  if(Drainer){
+    xTaskNotifyGive(Drainer);
+  }
+}
+
+// find the head and the tail (the oldest sector), and count the records
+// awaiting publication
+static int
+mount(void){
+  const int m = flashring_mount(&Ring);
+  if(m < 0){
+    return -1;
+  }
+  Head.sector = Ring.head;
+  Head.off = sizeof(flashring_hdr);
+  if(m){
+    Tail = Head;
+    return 0;
+  }
+  for(unsigned s = 0 ; s < Ring.sectors ; ++s){
+    flashring_hdr sh;
+    uint32_t end;
+    if(flashring_read_hdr(&Ring, s, &sh) == 0){
+      Pending += scan_sector(s, &end);
+    }
+  }
+  scan_sector(Head.sector, &Head.off);
+  // if the scan stopped at a torn header rather than erased flash, we
+  // can't write there; start afresh in the next sector
+  if(Head.off + sizeof(record_hdr) <= Ring.sectorbytes){
+    uint8_t raw[sizeof(record_hdr)];
+    static const uint8_t erased[sizeof(raw)] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, };
+    esp_err_t e = esp_partition_read(Part, addr_of(&Head), raw, sizeof(raw));
+    if(e != ESP_OK || memcmp(raw, erased, sizeof(raw))){
+      Head.off = Ring.sectorbytes;
+    }
+  }
+  uint32_t seq;
+  Tail.sector = flashring_oldest(&Ring, &seq);
+  Tail.off = sizeof(flashring_hdr);
+  ESP_LOGI(TAG, "%" PRIu32 " records pending", Pending);
+  return 0;
+}
+
+int spool_init(void){
+  const esp_partition_t* part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                          ESP_PARTITION_SUBTYPE_ANY, SPOOL_LABEL);
+  if(part == NULL){
+    ESP_LOGW(TAG, "no " SPOOL_LABEL " partition; spooling disabled");
+    return -1;
+  }
+  Part = part;
+  flashring_init(&Ring, SPOOL_LABEL, part, SECTOR_MAGIC, 0, part->size / part->erase_size);
+  if(Ring.sectors < 2){
+    ESP_LOGE(TAG, "%zuB " SPOOL_LABEL " partition is too small", part->size);
+    Part = NULL;
+    return -1;
+  }
+  if((Lock = xSemaphoreCreateMutex()) == NULL){
+    ESP_LOGE(TAG, "couldn't create spool lock");
+    Part = NULL;
+    return -1;
+  }
+  if(mount()){
+    Part = NULL;
+    return -1;
+  }
+  if(xTaskCreate(drain_task, "spool", DRAIN_TASK_STACK_BYTES, NULL,
+                 DRAIN_TASK_PRIO, &Drainer) != pdPASS){
+    ESP_LOGE(TAG, "error creating drain task");
+    return -1;
+  }
+  return 0;
+}
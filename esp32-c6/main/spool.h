@@ -0,0 +1,28 @@
+#ifndef DANKDRYER_SPOOL
+#define DANKDRYER_SPOOL
+
+// store-and-forward of telemetry which couldn't be published, in the
+// "spool" flash partition. records are appended to a log-structured ring
+// of sectors, and drained to the broker (at a limited rate) once we're
+// connected again. records are serialized telemetry, which carries its
+// uptime and boot count, and the wall clock time if it had been set. a
+// record from this boot taken before the clock was set gets its wall clock
+// time as it's drained, once the clock is set. either way, whatever stores
+// them can backfill them.
+
+#include <stddef.h>
+
+// mount the spool, recovering any records from before a reboot, and start
+// the drain task. returns -1 if the partition is missing or unusable, in
+// which case spool_append() always fails.
+int spool_init(void);
+
+// spool len bytes of telemetry rendered as fmt (one of TELEMETRY_FMT_*).
+// JSON must include its NUL terminator. if the ring is full, the oldest
+// sector is reclaimed, and any records yet unsent within it are lost.
+int spool_append(unsigned fmt, const void* buf, size_t len);
+
+// we (re)connected to the broker; start draining
+void spool_kick(void);
+
+#endif
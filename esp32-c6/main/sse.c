@@ -0,0 +1,146 @@
+#include "sse.h"
+#include "networking.h"
+#include "telemetry.h"
+#include "version.h"
+#include <stdatomic.h>
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#define TAG "sse"
+
+#define STREAM_URI "/api/v1/stream"
+// below the HTTP server (5), so that a slow subscriber doesn't hold up
+// ordinary requests
+#define STREAMER_TASK_PRIO 4
+#define STREAMER_TASK_STACK_BYTES 4096
+
+// held requests, added by the HTTP server task and removed by the streamer.
+// a slot is free if NULL.
+static httpd_req_t* Subscribers[SSE_SUBSCRIBERS_MAX];
+static portMUX_TYPE SubscribersLock = portMUX_INITIALIZER_UNLOCKED;
+static _Atomic(unsigned) MaxSubscribers = SSE_SUBSCRIBERS_DEFAULT;
+static TaskHandle_t Streamer;
+
+// rendered once per snapshot, written only by the streamer
+static char Event[TELEMETRY_SSE_MAX];
+
+// find a free slot, returning -1 if we're at our limit. only the server
+// task adds subscribers, so a slot found free stays free until it's filled.
+static int
+free_slot(void){
+  const unsigned max = MaxSubscribers;
+  int slot = -1;
+  unsigned count = 0;
+  taskENTER_CRITICAL(&SubscribersLock);
+  for(unsigned i = 0 ; i < SSE_SUBSCRIBERS_MAX ; ++i){
+    if(Subscribers[i]){
+      ++count;
+    }else if(slot < 0){
+      slot = i;
+    }
+  }
+  taskEXIT_CRITICAL(&SubscribersLock);
+  return count < max ? slot : -1;
+}
+
+// send the headers (and a comment, to get them onto the wire), then hand
+// the request to the streamer. we return immediately, freeing the server
+// task; the connection stays open until the streamer completes the request.
+static esp_err_t
+stream_handler(httpd_req_t* req){
+  const int slot = free_slot();
+  if(slot < 0){
+    httpd_resp_set_status(req, "503 Service Unavailable");
+    return httpd_resp_send(req, "too many subscribers\n", HTTPD_RESP_USE_STRLEN);
+  }
+  httpd_resp_set_type(req, "text/event-stream");
+  httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+  static const char hello[] = ": " DEVICE "\n\n";
+  esp_err_t e;
+  if((e = httpd_resp_send_chunk(req, hello, sizeof(hello) - 1)) != ESP_OK){
+    ESP_LOGE(TAG, "failure (%s) starting stream", esp_err_to_name(e));
+    return ESP_FAIL;
+  }
+  httpd_req_t* areq;
+  if((e = httpd_req_async_handler_begin(req, &areq)) != ESP_OK){
+    ESP_LOGE(TAG, "failure (%s) holding request", esp_err_to_name(e));
+    return ESP_FAIL;
+  }
+  taskENTER_CRITICAL(&SubscribersLock);
+  Subscribers[slot] = areq;
+  taskEXIT_CRITICAL(&SubscribersLock);
+  ESP_LOGI(TAG, "new subscriber");
+  // the first event goes out with the next snapshot, within a control period
+  return ESP_OK;
+}
+
+static void
+streamer_task(void* v){
+  uint32_t lastgen = 0;
+  while(1){
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    httpd_req_t* subs[SSE_SUBSCRIBERS_MAX];
+    unsigned count = 0;
+    taskENTER_CRITICAL(&SubscribersLock);
+    for(unsigned i = 0 ; i < SSE_SUBSCRIBERS_MAX ; ++i){
+      if((subs[i] = Subscribers[i])){
+        ++count;
+      }
+    }
+    taskEXIT_CRITICAL(&SubscribersLock);
+    telemetry t;
+    const uint32_t gen = get_telemetry(&t);
+    if(count == 0 || gen == lastgen){
+      continue;
+    }
+    lastgen = gen;
+    const int elen = telemetry_sse(&t, gen, Event, sizeof(Event));
+    if(elen < 0){
+      ESP_LOGE(TAG, "event exceeded %zuB", sizeof(Event));
+      continue;
+    }
+    for(unsigned i = 0 ; i < SSE_SUBSCRIBERS_MAX ; ++i){
+      if(subs[i] == NULL){
+        continue;
+      }
+      if(httpd_resp_send_chunk(subs[i], Event, elen) != ESP_OK){
+        ESP_LOGI(TAG, "subscriber went away");
+        taskENTER_CRITICAL(&SubscribersLock);
+        Subscribers[i] = NULL;
+        taskEXIT_CRITICAL(&SubscribersLock);
+        httpd_req_async_handler_complete(subs[i]);
+      }
+    }
+  }
+}
+
+int sse_init(httpd_handle_t serv){
+  if(xTaskCreate(streamer_task, "sse", STREAMER_TASK_STACK_BYTES, NULL,
+                 STREAMER_TASK_PRIO, &Streamer) != pdPASS){
+    ESP_LOGE(TAG, "error creating streamer task");
+    return -1;
+  }
+  const httpd_uri_t uri = {
+    .uri = STREAM_URI,
+    .method = HTTP_GET,
+    .handler = stream_handler,
+    .user_ctx = NULL,
+  };
+  esp_err_t err = httpd_register_uri_handler(serv, &uri);
+  if(err != ESP_OK){
+    ESP_LOGE(TAG, "failure (%s) preparing URI %s", esp_err_to_name(err), uri.uri);
+    return -1;
+  }
+  return 0;
+}
+
+unsigned sse_set_max(unsigned max){
+  return atomic_exchange(&MaxSubscribers, max > SSE_SUBSCRIBERS_MAX ? SSE_SUBSCRIBERS_MAX : max);
+}
+
+void sse_kick(void){
+  if(Streamer){
+    xTaskNotifyGive(Streamer);
+  }
+}
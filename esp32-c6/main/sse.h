@@ -0,0 +1,29 @@
+#ifndef DANKDRYER_SSE
+#define DANKDRYER_SSE
+
+// the live state as a stream of Server-Sent Events at /api/v1/stream. each
+// subscriber's request is held open with the HTTP server's async handler
+// support, and a streamer task sends every new state snapshot to all of
+// them as it's published. each snapshot is rendered once, and the same
+// buffer is sent to every subscriber.
+
+#include <esp_http_server.h>
+
+// the most subscribers we can ever have, and how many we allow by default.
+// each holds one of the HTTP server's sockets.
+#define SSE_SUBSCRIBERS_MAX 4
+#define SSE_SUBSCRIBERS_DEFAULT 2
+
+// start the streamer task, and register the stream URI with serv
+int sse_init(httpd_handle_t serv);
+
+// limit the number of subscribers (at most SSE_SUBSCRIBERS_MAX; 0 disables
+// the stream), returning the old limit. existing subscribers beyond the new
+// limit are kept.
+unsigned sse_set_max(unsigned max);
+
+// a new state snapshot has been published. never blocks; safe to call
+// before sse_init().
+void sse_kick(void);
+
+#endif
@@ -0,0 +1,24 @@
+#include "state.h"
+
+void devstate_publish(devstate* s, const telemetry* t){
+  const uint32_t seq = atomic_load_explicit(&s->seq, memory_order_relaxed);
+  atomic_store_explicit(&s->seq, seq + 1, memory_order_relaxed);
+  // readers mustn't see any of the new state until they've seen seq go odd
+  atomic_thread_fence(memory_order_release);
+  s->t = *t;
+  s->t.exech = s->t.jitterh = NULL;
+  s->t.samples = NULL;
+  atomic_store_explicit(&s->seq, seq + 2, memory_order_release);
+}
+
+uint32_t devstate_read(const devstate* s, telemetry* t){
+  uint32_t seq0, seq1;
+  do{
+    seq0 = atomic_load_explicit(&s->seq, memory_order_acquire);
+    *t = s->t;
+    // our copy must be complete before we recheck seq
+    atomic_thread_fence(memory_order_acquire);
+    seq1 = atomic_load_explicit(&s->seq, memory_order_relaxed);
+  }while((seq0 & 1u) || seq0 != seq1);
+  return seq0 / 2;
+}
@@ -0,0 +1,30 @@
+#ifndef DANKDRYER_STATE
+#define DANKDRYER_STATE
+
+// the dryer's live state, published as a whole by a single writer (the
+// control task, once per iteration) under a sequence lock, so that any
+// number of readers (MQTT telemetry, HTTP) get a consistent snapshot
+// without taking a lock, and without ever delaying the writer. in
+// particular, no reader sees a torn 64-bit dry end time. a reader which
+// overlaps a publication simply copies again; on our single core, the
+// writer always has the highest priority, so that's rare and brief.
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include "telemetry.h"
+
+typedef struct devstate {
+  _Atomic(uint32_t) seq;  // odd while a publication is in progress
+  telemetry t;            // histograms and samples are always NULL
+} devstate;
+
+// replace the state with t (whose histograms and samples are ignored). only
+// ever call this from one task.
+void devstate_publish(devstate* s, const telemetry* t);
+
+// copy the current state into t. returns its generation, which increases
+// with each publication, or 0 if there has been none (in which case t is
+// zeroed).
+uint32_t devstate_read(const devstate* s, telemetry* t);
+
+#endif
@@ -0,0 +1,78 @@
+#include "tach.h"
+#include "hal.h"
+#include <esp_attr.h>
+
+// called from interrupt context every t->pulses edges
+static void IRAM_ATTR
+tach_event(void* arg){
+  tach* t = arg;
+  // we're the only writer of head, so a relaxed load suffices. the release
+  // store publishes the timestamp before the new head.
+  uint32_t h = atomic_load_explicit(&t->head, memory_order_relaxed);
+  t->stamps[h % TACH_RING_LEN] = hal_now_us();
+  atomic_store_explicit(&t->head, h + 1, memory_order_release);
+}
+
+int setup_tach(tach* t, gpio_num_t pin, unsigned pulses, unsigned ppr,
+               int64_t stallus){
+  t->pulses = pulses;
+  t->ppr = ppr;
+  t->stallus = stallus;
+  t->running = false;
+  atomic_init(&t->head, 0);
+  t->started = hal_now_us();
+  if(hal_pulse_counter(pin, pulses, tach_event, t)){
+    return -1;
+  }
+  t->running = true;
+  return 0;
+}
+
+uint32_t tach_last_edges(const tach* t, int64_t* last, int64_t* prev){
+  uint32_t h = atomic_load_explicit(&t->head, memory_order_acquire);
+  // the ISR would have to lap the ring during our reads to tear these
+  if(h >= 1){
+    *last = t->stamps[(h - 1) % TACH_RING_LEN];
+  }
+  if(h >= 2){
+    *prev = t->stamps[(h - 2) % TACH_RING_LEN];
+  }
+  return h;
+}
+
+// revolutions per minute, scaled by 'scale' and rounded to nearest
+static uint32_t
+tach_scaled_rpm(const tach* t, int64_t now, uint64_t scale){
+  if(!t->running){
+    return UINT32_MAX;
+  }
+  int64_t last = t->started;
+  int64_t prev = 0;
+  uint32_t h = tach_last_edges(t, &last, &prev);
+  int64_t since = now - last;
+  if(since > t->stallus){
+    return 0;
+  }
+  if(h < 2){
+    return UINT32_MAX;
+  }
+  int64_t period = last - prev;
+  if(since > period){
+    period = since; // we're at least this slow
+  }
+  if(period <= 0){
+    return UINT32_MAX;
+  }
+  const uint64_t div = (uint64_t)t->ppr * period;
+  const uint64_t r = (60000000ull * scale * t->pulses + div / 2) / div;
+  // a rate of UINT32_MAX or more can't be told from "no period yet"
+  return r >= UINT32_MAX ? UINT32_MAX - 1 : r;
+}
+
+uint32_t tach_rpm(const tach* t, int64_t now){
+  return tach_scaled_rpm(t, now, 1);
+}
+
+uint32_t tach_mrpm(const tach* t, int64_t now){
+  return tach_scaled_rpm(t, now, 1000);
+}
@@ -0,0 +1,49 @@
+#ifndef DANKDRYER_TACH
+#define DANKDRYER_TACH
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <soc/gpio_num.h>
+
+// pulse timing via the HAL's pulse counter (PCNT on the esp32-c6). edges
+// are counted and glitch-filtered in hardware. every 'pulses' edges, our
+// callback pushes a hal_now_us() timestamp into a lock-free ring. speed is computed
+// from the edge-to-edge period, so a slow spool gets an accurate reading
+// after every pulse, and a fast fan costs only one interrupt per 'pulses'.
+
+#define TACH_RING_LEN 8 // must be a power of two
+
+typedef struct tach {
+  bool running;                 // the pulse counter was set up
+  unsigned pulses;              // pulses per timestamped event
+  unsigned ppr;                 // pulses per revolution
+  int64_t stallus;              // no event in this long means we're stalled
+  int64_t started;              // when we started counting
+  int64_t stamps[TACH_RING_LEN];
+  _Atomic(uint32_t) head;       // events seen; written only by the ISR
+} tach;
+
+// configure a pulse counter to timestamp every 'pulses' falling edges on pin.
+// ppr is the number of pulses per revolution, and stallus the longest
+// period we'll accept between events before declaring a stall.
+int setup_tach(tach* t, gpio_num_t pin, unsigned pulses, unsigned ppr,
+               int64_t stallus);
+
+// compute the RPM as of 'now' from the most recent event period. if no
+// event has been seen for longer than that period, the elapsed time is
+// used instead, so deceleration shows up without waiting for an edge.
+// returns 0 if stalled, and UINT32_MAX if we don't yet have a period. the
+// result is rounded to the nearest RPM.
+uint32_t tach_rpm(const tach* t, int64_t now);
+
+// as tach_rpm(), but in thousandths of an RPM, for slow shafts (where a
+// whole RPM is a large fraction of the speed).
+uint32_t tach_mrpm(const tach* t, int64_t now);
+
+// get the timestamps of the most recent event and the one before it.
+// returns the number of events seen in total (if less than 2, the
+// timestamps are not all valid).
+uint32_t tach_last_edges(const tach* t, int64_t* last, int64_t* prev);
+
+#endif
@@ -0,0 +1,464 @@
+#include "telemetry.h"
+#include "version.h"
+#include "heater.h"
+#include "weight.h"
+#include "jsonw.h"
+#include "cborw.h"
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+static void
+add_hist_json(jsonw* j, const char* pfx, const histogram* h){
+  if(h == NULL){
+    return;
+  }
+  char key[16];
+  const size_t plen = strlen(pfx);
+  if(plen + sizeof("p50us") > sizeof(key)){
+    return;
+  }
+  memcpy(key, pfx, plen);
+  strcpy(key + plen, "p50us");
+  jsonw_int(j, key, histogram_quantile(h, 500));
+  strcpy(key + plen, "p99us");
+  jsonw_int(j, key, histogram_quantile(h, 990));
+  strcpy(key + plen, "maxus");
+  jsonw_int(j, key, h->max);
+}
+
+// autotune progress, and results once complete. nothing if we've never
+// autotuned since boot.
+static void
+add_autotune_json(jsonw* j, const autotune* at){
+  if(at->state == AUTOTUNE_IDLE){
+    return;
+  }
+  jsonw_str(j, "atstate", autotune_state_str(at->state));
+  jsonw_int(j, "atcycles", at->cycles);
+  if(at->state == AUTOTUNE_DONE){
+    jsonw_float(j, "atK", at->k, 5);
+    jsonw_float(j, "atLsec", at->l, 1);
+    jsonw_float(j, "atTsec", at->t, 1);
+    jsonw_float(j, "atKu", at->ku, 3);
+    jsonw_float(j, "atTusec", at->tu, 1);
+    jsonw_q8(j, "atkp", at->kp);
+    jsonw_q8(j, "atki", at->ki);
+  }
+}
+
+// the samples since the last publication, as columns. temperatures are in
+// tenths of a degree, and invalid readings are null.
+static void
+add_batch_json(jsonw* j, const batch* b){
+  if(b == NULL || b->n == 0){
+    return;
+  }
+  jsonw_int(j, "bt0ms", b->t0ms);
+  jsonw_ints(j, "bdtms", b->dtms, b->n, BATCH_INVALID);
+  jsonw_ints(j, "butempdC", b->utemp, b->n, BATCH_INVALID);
+  jsonw_ints(j, "bltempdC", b->ltemp, b->n, BATCH_INVALID);
+  jsonw_ints(j, "bmass", b->mass, b->n, BATCH_INVALID);
+  jsonw_ints(j, "bhduty", b->hduty, b->n, BATCH_INVALID);
+  if(b->dropped){
+    jsonw_int(j, "bdropped", b->dropped);
+  }
+}
+
+int telemetry_json(const telemetry* t, char* buf, size_t len){
+  jsonw j;
+  jsonw_begin(&j, buf, len);
+  jsonw_int(&j, "uptimesec", t->uptimeus / 1000000ll);
+  if(t->boot){
+    jsonw_int(&j, "boot", t->boot);
+  }
+  if(t->epochms){
+    jsonw_int(&j, "epochms", t->epochms);
+  }
+  if(temp_valid_p(t->ltemp)){
+    jsonw_q8(&j, "ltempC", t->ltemp);
+  }
+  if(rpm_valid_p(t->lrpm)){
+    jsonw_int(&j, "lrpm", t->lrpm);
+  }
+  if(rpm_valid_p(t->urpm)){
+    jsonw_int(&j, "urpm", t->urpm);
+  }
+  if(spool_mrpm_valid_p(t->smrpm)){
+    jsonw_milli(&j, "srpm", t->smrpm);
+  }
+  jsonw_int(&j, "lpwm", t->lpwm);
+  jsonw_int(&j, "upwm", t->upwm);
+  if(weight_valid_p(t->weight)){
+    jsonw_q8(&j, "mass", t->weight);
+  }
+  jsonw_q8(&j, "tare", t->tare);
+  jsonw_int(&j, "motor", t->motor);
+  jsonw_int(&j, "heater", t->heater);
+  jsonw_int(&j, "hduty", t->hduty);
+  add_autotune_json(&j, &t->at);
+  if(temp_valid_p(t->utemp)){
+    jsonw_q8(&j, "utempC", t->utemp);
+  }
+  jsonw_int(&j, "ttempC", t->targtemp);
+  jsonw_int(&j, "dryendsec", t->dryendsus);
+  add_hist_json(&j, "ctl", t->exech);
+  add_hist_json(&j, "jit", t->jitterh);
+  if(t->pubdropped){
+    jsonw_int(&j, "pubdropped", t->pubdropped);
+  }
+  add_batch_json(&j, t->samples);
+  return jsonw_end(&j);
+}
+
+int telemetry_sse(const telemetry* t, uint32_t id, char* buf, size_t len){
+  int hlen = snprintf(buf, len, "id: %" PRIu32 "\ndata: ", id);
+  if(hlen < 0 || (size_t)hlen >= len){
+    return -1;
+  }
+  // compact JSON never contains a newline, so it's a single data line
+  int jlen = telemetry_json(t, buf + hlen, len - hlen);
+  if(jlen < 0 || len - hlen - jlen < 3){
+    return -1;
+  }
+  memcpy(buf + hlen + jlen, "\n\n", 3);
+  return hlen + jlen + 2;
+}
+
+// as add_hist_json(), with the p50, p99, and max keys following base
+static void
+add_hist_cbor(cborw* c, unsigned base, const histogram* h){
+  if(h == NULL){
+    return;
+  }
+  cborw_int(c, base, histogram_quantile(h, 500));
+  cborw_int(c, base + 1, histogram_quantile(h, 990));
+  cborw_int(c, base + 2, h->max);
+}
+
+static void
+add_autotune_cbor(cborw* c, const autotune* at){
+  if(at->state == AUTOTUNE_IDLE){
+    return;
+  }
+  cborw_str(c, TKEY_ATSTATE, autotune_state_str(at->state));
+  cborw_int(c, TKEY_ATCYCLES, at->cycles);
+  if(at->state == AUTOTUNE_DONE){
+    cborw_float(c, TKEY_ATK, at->k);
+    cborw_float(c, TKEY_ATLSEC, at->l);
+    cborw_float(c, TKEY_ATTSEC, at->t);
+    cborw_float(c, TKEY_ATKU, at->ku);
+    cborw_float(c, TKEY_ATTUSEC, at->tu);
+    cborw_q8(c, TKEY_ATKP, at->kp);
+    cborw_q8(c, TKEY_ATKI, at->ki);
+  }
+}
+
+static void
+add_batch_cbor(cborw* c, const batch* b){
+  if(b == NULL || b->n == 0){
+    return;
+  }
+  cborw_int(c, TKEY_BT0MS, b->t0ms);
+  cborw_ints(c, TKEY_BDTMS, b->dtms, b->n, BATCH_INVALID);
+  cborw_ints(c, TKEY_BUTEMP, b->utemp, b->n, BATCH_INVALID);
+  cborw_ints(c, TKEY_BLTEMP, b->ltemp, b->n, BATCH_INVALID);
+  cborw_ints(c, TKEY_BMASS, b->mass, b->n, BATCH_INVALID);
+  cborw_ints(c, TKEY_BHDUTY, b->hduty, b->n, BATCH_INVALID);
+  if(b->dropped){
+    cborw_int(c, TKEY_BDROPPED, b->dropped);
+  }
+}
+
+// members in the same order, and under the same conditions, as
+// telemetry_json()
+int telemetry_cbor(const telemetry* t, void* buf, size_t len){
+  cborw c;
+  cborw_begin(&c, buf, len);
+  cborw_int(&c, TKEY_SCHEMA, TELEMETRY_CBOR_SCHEMA);
+  cborw_int(&c, TKEY_UPTIMESEC, t->uptimeus / 1000000ll);
+  if(t->boot){
+    cborw_int(&c, TKEY_BOOT, t->boot);
+  }
+  if(t->epochms){
+    cborw_int(&c, TKEY_EPOCHMS, t->epochms);
+  }
+  if(temp_valid_p(t->ltemp)){
+    cborw_q8_half(&c, TKEY_LTEMPC, t->ltemp);
+  }
+  if(rpm_valid_p(t->lrpm)){
+    cborw_int(&c, TKEY_LRPM, t->lrpm);
+  }
+  if(rpm_valid_p(t->urpm)){
+    cborw_int(&c, TKEY_URPM, t->urpm);
+  }
+  if(spool_mrpm_valid_p(t->smrpm)){
+    // to the nearest 1/256 RPM, which is finer than we can measure
+    cborw_q8(&c, TKEY_SRPM, ((int64_t)t->smrpm * Q8_ONE + 500) / 1000);
+  }
+  cborw_int(&c, TKEY_LPWM, t->lpwm);
+  cborw_int(&c, TKEY_UPWM, t->upwm);
+  if(weight_valid_p(t->weight)){
+    cborw_q8(&c, TKEY_MASS, t->weight);
+  }
+  cborw_q8(&c, TKEY_TARE, t->tare);
+  cborw_int(&c, TKEY_MOTOR, t->motor);
+  cborw_int(&c, TKEY_HEATER, t->heater);
+  cborw_int(&c, TKEY_HDUTY, t->hduty);
+  add_autotune_cbor(&c, &t->at);
+  if(temp_valid_p(t->utemp)){
+    cborw_q8_half(&c, TKEY_UTEMPC, t->utemp);
+  }
+  cborw_int(&c, TKEY_TTEMPC, t->targtemp);
+  cborw_int(&c, TKEY_DRYENDSEC, t->dryendsus);
+  add_hist_cbor(&c, TKEY_CTLP50US, t->exech);
+  add_hist_cbor(&c, TKEY_JITP50US, t->jitterh);
+  if(t->pubdropped){
+    cborw_int(&c, TKEY_PUBDROPPED, t->pubdropped);
+  }
+  add_batch_cbor(&c, t->samples);
+  return cborw_end(&c);
+}
+
+// a Q8 reading becoming valid or invalid is a discrete change
+static telemetry_change
+q8_change(q8_t last, q8_t cur, bool lastvalid, bool curvalid, q8_t band){
+  if(lastvalid != curvalid){
+    return TCHANGE_DISCRETE;
+  }
+  if(curvalid && (cur - last >= band || last - cur >= band)){
+    return TCHANGE_ANALOG;
+  }
+  return TCHANGE_NONE;
+}
+
+static telemetry_change
+rpm_change(uint32_t last, uint32_t cur, bool lastvalid, bool curvalid,
+           unsigned pct){
+  if(lastvalid != curvalid){
+    return TCHANGE_DISCRETE;
+  }
+  if(curvalid){
+    uint32_t d = cur > last ? cur - last : last - cur;
+    if(d * 100 > last * pct){
+      return TCHANGE_ANALOG;
+    }
+  }
+  return TCHANGE_NONE;
+}
+
+static inline telemetry_change
+max_change(telemetry_change a, telemetry_change b){
+  return a > b ? a : b;
+}
+
+telemetry_change telemetry_compare(const telemetry* last, const telemetry* cur,
+                                   const deadbands* db){
+  const bool controlled = cur->dryendsus || autotune_active_p(&cur->at);
+  if(last->motor != cur->motor || last->lpwm != cur->lpwm || last->upwm != cur->upwm
+      || last->tare != cur->tare || last->targtemp != cur->targtemp
+      || last->dryendsus != cur->dryendsus || last->at.state != cur->at.state
+      || last->at.cycles != cur->at.cycles
+      || (!controlled && last->heater != cur->heater)){
+    return TCHANGE_DISCRETE;
+  }
+  telemetry_change c = q8_change(last->ltemp, cur->ltemp, temp_valid_p(last->ltemp),
+                                 temp_valid_p(cur->ltemp), db->temp);
+  c = max_change(c, q8_change(last->utemp, cur->utemp, temp_valid_p(last->utemp),
+                         temp_valid_p(cur->utemp), db->temp));
+  c = max_change(c, q8_change(last->weight, cur->weight, weight_valid_p(last->weight),
+                         weight_valid_p(cur->weight), db->mass));
+  c = max_change(c, rpm_change(last->lrpm, cur->lrpm, rpm_valid_p(last->lrpm),
+                         rpm_valid_p(cur->lrpm), db->rpmpct));
+  c = max_change(c, rpm_change(last->urpm, cur->urpm, rpm_valid_p(last->urpm),
+                         rpm_valid_p(cur->urpm), db->rpmpct));
+  c = max_change(c, rpm_change(last->smrpm, cur->smrpm, spool_mrpm_valid_p(last->smrpm),
+                         spool_mrpm_valid_p(cur->smrpm), db->rpmpct));
+  if(c == TCHANGE_NONE){
+    uint32_t d = cur->hduty > last->hduty ? cur->hduty - last->hduty : last->hduty - cur->hduty;
+    if(d >= db->hduty){
+      c = TCHANGE_ANALOG;
+    }
+  }
+  return c;
+}
+
+telemetry_rate telemetry_rate_of(const telemetry* t, const telemetry_rates* r){
+  if(t->at.state == AUTOTUNE_HEATING){
+    return TRATE_FAST;
+  }
+  if(t->dryendsus){
+    if(t->dryendsus - t->uptimeus <= r->endingsec * 1000000ll){
+      return TRATE_FAST;
+    }
+    if(temp_valid_p(t->utemp) && t->utemp < q8_from_int(t->targtemp) - TELEMETRY_RAMP_BAND){
+      return TRATE_FAST;
+    }
+    return TRATE_ACTIVE;
+  }
+  return autotune_active_p(&t->at) ? TRATE_ACTIVE : TRATE_IDLE;
+}
+
+unsigned telemetry_rate_sec(telemetry_rate rate, const telemetry_rates* r){
+  switch(rate){
+    case TRATE_FAST: return r->fastsec;
+    case TRATE_ACTIVE: return r->activesec;
+    case TRATE_IDLE: break;
+  }
+  return r->idlesec;
+}
+
+bool telemetry_rates_valid_p(const telemetry_rates* r){
+  return r->fastsec && r->fastsec <= r->activesec && r->activesec <= r->idlesec
+    && r->idlesec <= TELEMETRY_RATE_SEC_MAX && r->endingsec <= TELEMETRY_RATE_SEC_MAX;
+}
+
+static inline const char*
+bool_as_onoff_http(bool b){
+  return b ? "<font color=\"green\">on</font>" : "off";
+}
+
+int telemetry_html(char* buf, size_t len, const telemetry* t, time_t now){
+  struct tm tm;
+  char tbuf[32]; // asctime_r() requires at least 26
+  if(localtime_r(&now, &tm) == NULL || asctime_r(&tm, tbuf) == NULL){
+    tbuf[0] = '\0';
+  }
+  return snprintf(buf, len, "<!DOCTYPE html><html><head><title>" DEVICE "</title></head>"
+            "<body><h2>a drying comes across the sky</h2><br/>"
+            "<b>lpwm:</b> %u<br/>"
+            "<b>upwm:</b> %u<br/>"
+            "<b>lrpm</b>: %" PRIu32 "<br/>"
+            "<b>urpm</b>: %" PRIu32 "<br/>"
+            "<b>srpm</b>: %" PRIu32 ".%03" PRIu32 "<br/>"
+            "<b>motor</b>: %s<br/>"
+            "<b>heater</b>: %s<br/>"
+            "<b>mass</b>: %.2f<br/>"
+            "<b>tare</b>: %.2f<br/>"
+            "<b>lm35</b>: %.2f<br/>"
+            "<b>esp32s3</b>: %.2f<br/>"
+            "<b>dryends</b>: %" PRId64 "<br/>"
+            "<b>target temp</b>: %" PRIu32 "<br/>"
+            "<hr/>%s<br/>"
+            "</body></html>",
+            t->lpwm, t->upwm,
+            t->lrpm, t->urpm,
+            t->smrpm / 1000, t->smrpm % 1000,
+            bool_as_onoff_http(t->motor),
+            bool_as_onoff_http(t->heater),
+            q8_to_float(t->weight), q8_to_float(t->tare),
+            q8_to_float(t->utemp), q8_to_float(t->ltemp),
+            t->dryendsus,
+            t->targtemp,
+            tbuf);
+}
+
+// skip the literal lit at *off, if it's there
+static bool
+json_take(const char* b, size_t len, size_t* off, const char* lit){
+  const size_t llen = strlen(lit);
+  if(len - *off < llen || memcmp(b + *off, lit, llen)){
+    return false;
+  }
+  *off += llen;
+  return true;
+}
+
+static bool
+json_uint(const char* b, size_t len, size_t* off, uint64_t* v){
+  const size_t start = *off;
+  *v = 0;
+  while(*off < len && b[*off] >= '0' && b[*off] <= '9'){
+    *v = *v * 10 + b[*off] - '0';
+    ++*off;
+  }
+  return *off != start;
+}
+
+// an unsigned integer item, per RFC 8949 3.1
+static bool
+cbor_uint(const uint8_t* b, size_t len, size_t* off, uint64_t* v){
+  if(*off >= len || b[*off] >> 5u){
+    return false;
+  }
+  const unsigned info = b[(*off)++] & 0x1fu;
+  if(info < 24){
+    *v = info;
+    return true;
+  }
+  if(info > 27){
+    return false;
+  }
+  const unsigned bytes = 1u << (info - 24);
+  if(len - *off < bytes){
+    return false;
+  }
+  *v = 0;
+  for(unsigned i = 0 ; i < bytes ; ++i){
+    *v = (*v << 8u) | b[(*off)++];
+  }
+  return true;
+}
+
+// both renderings begin with uptimesec, then boot (if known), then epochms
+// (if known), so we needn't parse beyond them. find the offset following
+// boot, returning false if the record isn't from this boot, or already
+// has epochms.
+static bool
+rebase_point(unsigned fmt, const uint8_t* b, size_t len, uint32_t boot,
+             size_t* off, uint64_t* upsec){
+  uint64_t key, rboot;
+  *off = 0;
+  if(fmt == TELEMETRY_FMT_JSON){
+    const char* j = (const char*)b;
+    if(!json_take(j, len, off, "{\"uptimesec\":") || !json_uint(j, len, off, upsec)
+        || !json_take(j, len, off, ",\"boot\":") || !json_uint(j, len, off, &rboot)
+        || rboot != boot){
+      return false;
+    }
+    size_t next = *off;
+    return !json_take(j, len, &next, ",\"epochms\":");
+  }
+  if(len == 0 || b[(*off)++] != 0xbf){
+    return false;
+  }
+  uint64_t schema;
+  if(!cbor_uint(b, len, off, &key) || key != TKEY_SCHEMA || !cbor_uint(b, len, off, &schema)
+      || !cbor_uint(b, len, off, &key) || key != TKEY_UPTIMESEC || !cbor_uint(b, len, off, upsec)
+      || !cbor_uint(b, len, off, &key) || key != TKEY_BOOT || !cbor_uint(b, len, off, &rboot)
+      || rboot != boot){
+    return false;
+  }
+  size_t next = *off;
+  return !(cbor_uint(b, len, &next, &key) && key == TKEY_EPOCHMS);
+}
+
+int telemetry_rebase(unsigned fmt, void* buf, size_t len, size_t cap,
+                     uint32_t boot, int64_t bootms){
+  size_t off;
+  uint64_t upsec;
+  if(boot == 0 || !rebase_point(fmt, buf, len, boot, &off, &upsec)){
+    return len;
+  }
+  // rendered as the encoders would have, were epochms set
+  char ins[32];
+  int ilen;
+  const int64_t epochms = bootms + (int64_t)upsec * 1000;
+  if(fmt == TELEMETRY_FMT_JSON){
+    ilen = snprintf(ins, sizeof(ins), ",\"epochms\":%lld", (long long)epochms);
+  }else{
+    cborw c;
+    cborw_begin(&c, ins, sizeof(ins));
+    cborw_int(&c, TKEY_EPOCHMS, epochms);
+    // drop the map header cborw_begin() wrote
+    ilen = c.overflow ? -1 : (int)c.used - 1;
+    memmove(ins, ins + 1, ilen > 0 ? ilen : 0);
+  }
+  if(ilen < 0 || (size_t)ilen >= sizeof(ins) || cap - len < (size_t)ilen){
+    return -1;
+  }
+  uint8_t* b = buf;
+  memmove(b + off + ilen, b + off, len - off);
+  memcpy(b + off, ins, ilen);
+  return len + ilen;
+}
@@ -0,0 +1,224 @@
+#ifndef DANKDRYER_TELEMETRY
+#define DANKDRYER_TELEMETRY
+
+// a snapshot of the dryer's state, and its renderings for MQTT (as JSON
+// and/or CBOR) and the HTTP status page. each renderer writes into a
+// buffer provided by the caller, and never allocates.
+
+#include <time.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "autotune.h"
+#include "histogram.h"
+#include "batch.h"
+#include "fixedpoint.h"
+#include "weight.h"
+
+typedef struct telemetry {
+  int64_t uptimeus;
+  int64_t epochms;            // wall clock; 0 if not yet synchronized
+  uint32_t boot;              // boot count; 0 if unknown
+  q8_t ltemp, utemp;          // MIN_TEMP - 1 if invalid
+  q8_t weight, tare;          // negative if invalid
+  uint32_t lrpm, urpm;        // see rpm_valid_p()
+  uint32_t smrpm;             // spool milli-RPM, see spool_mrpm_valid_p()
+  unsigned lpwm, upwm;
+  bool motor, heater;
+  uint32_t hduty;             // permille
+  uint32_t targtemp;
+  int64_t dryendsus;
+  autotune at;
+  // control loop timings since the last publication (MQTT only, may be
+  // NULL)
+  const histogram* exech;
+  const histogram* jitterh;
+  uint32_t pubdropped;        // publications dropped since boot (MQTT only)
+  // samples since the last publication (MQTT only, may be NULL)
+  const batch* samples;
+} telemetry;
+
+// UINT_MAX is sentinel for known bad reading, but anything over 3KRPM on
+// these Noctua NF-A8 fans is indicative of error; they max out at 2500.
+static inline bool
+rpm_valid_p(unsigned rpm){
+  return rpm < 3000;
+}
+
+// the spool turns at ~5 RPM, so is measured in thousandths of an RPM.
+// UINT_MAX is again the sentinel, and anything over 60 RPM is an error.
+static inline bool
+spool_mrpm_valid_p(unsigned mrpm){
+  return mrpm < 60000;
+}
+
+// the largest JSON object telemetry_json() can produce, with terminator:
+// the snapshot, plus a batch of five columns of up to 11 characters (and
+// a comma) per sample, and its keys
+#define TELEMETRY_JSON_MAX (768 + 5 * 12 * BATCH_MAX + 128)
+
+// write the (compact) JSON object we publish into buf, without allocating.
+// returns its length, or -1 if len was insufficient.
+int telemetry_json(const telemetry* t, char* buf, size_t len);
+
+// the CBOR rendering is a map of the same members as the JSON object,
+// under the small integer keys below (one or two bytes apiece). temperatures
+// are half-precision floats, other Q8 values and the autotune results are
+// half precision where that is exact, and single precision otherwise, as
+// is the spool speed (in RPM, since schema 2; it was a whole number of RPM
+// before). a member is never renumbered nor has its type changed without bumping
+// the schema version, which is always present. new members may be added
+// without bumping it.
+#define TELEMETRY_CBOR_SCHEMA 2
+
+typedef enum {
+  TKEY_SCHEMA,
+  TKEY_UPTIMESEC,
+  TKEY_LTEMPC,
+  TKEY_LRPM,
+  TKEY_URPM,
+  TKEY_SRPM,
+  TKEY_LPWM,
+  TKEY_UPWM,
+  TKEY_MASS,
+  TKEY_TARE,
+  TKEY_MOTOR,
+  TKEY_HEATER,
+  TKEY_HDUTY,
+  TKEY_ATSTATE,
+  TKEY_ATCYCLES,
+  TKEY_ATK,
+  TKEY_ATLSEC,
+  TKEY_ATTSEC,
+  TKEY_ATKU,
+  TKEY_ATTUSEC,
+  TKEY_ATKP,
+  TKEY_ATKI,
+  TKEY_UTEMPC,
+  TKEY_TTEMPC,
+  TKEY_DRYENDSEC,
+  TKEY_CTLP50US,
+  TKEY_CTLP99US,
+  TKEY_CTLMAXUS,
+  TKEY_JITP50US,
+  TKEY_JITP99US,
+  TKEY_JITMAXUS,
+  TKEY_BT0MS,
+  TKEY_BDTMS,
+  TKEY_BUTEMP,
+  TKEY_BLTEMP,
+  TKEY_BMASS,
+  TKEY_BHDUTY,
+  TKEY_BDROPPED,
+  TKEY_EPOCHMS,
+  TKEY_PUBDROPPED,
+  TKEY_BOOT,
+  TKEY_COUNT
+} telemetry_key;
+
+// the largest CBOR map telemetry_cbor() can produce: the snapshot, plus a
+// batch of five arrays of up to five bytes per sample, and their keys
+#define TELEMETRY_CBOR_MAX (384 + 5 * 5 * BATCH_MAX + 64)
+
+// write the CBOR map we publish into buf, without allocating. returns its
+// length, or -1 if len was insufficient.
+int telemetry_cbor(const telemetry* t, void* buf, size_t len);
+
+// the longest Server-Sent Event telemetry_sse() can produce, with
+// terminator: the JSON, and its framing
+#define TELEMETRY_SSE_MAX (TELEMETRY_JSON_MAX + 32)
+
+// write t as a Server-Sent Event (its JSON rendering as the data, and id as
+// the event ID) into buf, without allocating. returns its length, or -1 if
+// len was insufficient.
+int telemetry_sse(const telemetry* t, uint32_t id, char* buf, size_t len);
+
+// which renderings are published, a mask settable via TELEMETRY_CHANNEL
+#define TELEMETRY_FMT_JSON 0x1u
+#define TELEMETRY_FMT_CBOR 0x2u
+
+// buf holds len bytes of a record rendered by telemetry_json() (with its
+// terminator) or telemetry_cbor(), per fmt. if it was taken during boot
+// before the wall clock was set, insert the epochms it would have carried,
+// had boot begun at wall clock bootms. returns the record's new length (len
+// if it was left alone), or -1 if the result would exceed cap bytes (in
+// which case buf is untouched).
+int telemetry_rebase(unsigned fmt, void* buf, size_t len, size_t cap,
+                     uint32_t boot, int64_t bootms);
+
+// deadbands for publishing on change. a measurement must move at least
+// this far from its last published value before it's worth publishing.
+typedef struct deadbands {
+  q8_t temp;        // either thermometer, C
+  q8_t mass;        // load cell units
+  unsigned rpmpct;  // percent of the last published speed
+  unsigned hduty;   // permille
+} deadbands;
+
+#define DEADBANDS_INITIALIZER { \
+  .temp = Q8_ONE / 2, \
+  .mass = LOAD_CELL_UNITS_PER_G * Q8_ONE / 10, /* 0.1g */ \
+  .rpmpct = 2, \
+  .hduty = 50, \
+}
+
+typedef enum {
+  TCHANGE_NONE,     // everything is within its deadband
+  TCHANGE_ANALOG,   // some measurement has left its deadband
+  TCHANGE_DISCRETE, // some state has changed
+} telemetry_change;
+
+// compare cur against the last published snapshot. discrete changes are
+// the motor, fan PWMs, tare, the dry schedule and autotune progress, any
+// reading becoming valid or invalid, and the heater when neither a dry nor
+// an autotune is driving it (the SSR's time-proportional switching under
+// control is instead covered by the duty's deadband). times, histograms,
+// samples and drop counts are ignored.
+telemetry_change telemetry_compare(const telemetry* last, const telemetry* cur,
+                                   const deadbands* db);
+
+// how often we publish depends on what the dryer is doing. while it's
+// heating towards a setpoint, or a dry is nearing its end, we publish every
+// fastsec. otherwise, a measurement leaving its deadband is published at
+// most every activesec (while drying or autotuning) or idlesec (while
+// idle). discrete changes are always published immediately.
+typedef struct telemetry_rates {
+  unsigned fastsec;
+  unsigned activesec;
+  unsigned idlesec;
+  unsigned endingsec; // a dry is nearing its end within this many seconds
+} telemetry_rates;
+
+#define TELEMETRY_RATES_INITIALIZER { \
+  .fastsec = 2, \
+  .activesec = 15, \
+  .idlesec = 60, \
+  .endingsec = 300, \
+}
+
+// the longest any interval may be configured
+#define TELEMETRY_RATE_SEC_MAX 3600
+
+// we're heating towards a setpoint until within this much of it
+#define TELEMETRY_RAMP_BAND (2 * Q8_ONE)
+
+typedef enum {
+  TRATE_IDLE,
+  TRATE_ACTIVE,
+  TRATE_FAST,
+} telemetry_rate;
+
+// classify the snapshot t
+telemetry_rate telemetry_rate_of(const telemetry* t, const telemetry_rates* r);
+
+// the interval of seconds at which a rate publishes
+unsigned telemetry_rate_sec(telemetry_rate rate, const telemetry_rates* r);
+
+// fast <= active <= idle, all nonzero, and none exceeding
+// TELEMETRY_RATE_SEC_MAX
+bool telemetry_rates_valid_p(const telemetry_rates* r);
+
+// format the HTTP status page into buf (len bytes), as of 'now'. returns
+// what snprintf() would have (so a return >= len indicates truncation).
+int telemetry_html(char* buf, size_t len, const telemetry* t, time_t now);
+
+#endif
@@ -0,0 +1,61 @@
+#include "thermo.h"
+#include "efuse.h"
+
+#define ARRAY_LEN(a) (sizeof(a) / sizeof(*(a)))
+
+// LM35: 10 mV/C, linear across its range. we only power it from a single
+// supply, so it cannot report below 2C, but the table is uniform with the
+// LMT87's.
+static const thermo_point LM35Points[] = {
+  {    0,   0 }, {  100,  10 }, {  200,  20 }, {  300,  30 }, {  400,  40 },
+  {  500,  50 }, {  600,  60 }, {  700,  70 }, {  800,  80 }, {  900,  90 },
+  { 1000, 100 }, { 1100, 110 }, { 1200, 120 }, { 1300, 130 }, { 1400, 140 },
+  { 1500, 150 },
+};
+
+// LMT87: inverted and slightly parabolic. these are the datasheet's
+// transfer function V = 2230.8 - 13.582(T - 30) - 0.00433(T - 30)^2 mV,
+// evaluated every 10C and rounded. the datasheet's own table has 3277 mV
+// at -50C, but we can't read that high with 12dB attenuation anyway.
+static const thermo_point LMT87Points[] = {
+  {  539, 150 }, {  684, 140 }, {  829, 130 }, {  973, 120 }, { 1117, 110 },
+  { 1259, 100 }, { 1400,  90 }, { 1541,  80 }, { 1681,  70 }, { 1819,  60 },
+  { 1957,  50 }, { 2095,  40 }, { 2231,  30 }, { 2366,  20 }, { 2501,  10 },
+  { 2634,   0 }, { 2767, -10 }, { 2899, -20 }, { 3030, -30 }, { 3160, -40 },
+  { 3290, -50 },
+};
+
+const thermo_table LM35Table = {
+  .name = "LM35",
+  .pts = LM35Points,
+  .count = ARRAY_LEN(LM35Points),
+};
+
+const thermo_table LMT87Table = {
+  .name = "LMT87",
+  .pts = LMT87Points,
+  .count = ARRAY_LEN(LMT87Points),
+};
+
+const thermo_table* thermo_table_for_board(void){
+  return electronics_use_lm35() ? &LM35Table : &LMT87Table;
+}
+
+q8_t thermo_mv_to_q8(const thermo_table* t, int32_t mv){
+  // find the segment [lo, lo + 1] containing mv, clamping to the ends
+  unsigned lo = 0;
+  unsigned hi = t->count - 1;
+  while(hi - lo > 1){
+    unsigned mid = (lo + hi) / 2;
+    if(mv < t->pts[mid].mv){
+      hi = mid;
+    }else{
+      lo = mid;
+    }
+  }
+  const thermo_point* p0 = &t->pts[lo];
+  const thermo_point* p1 = &t->pts[hi];
+  int32_t dc = p1->c - p0->c;
+  int32_t dmv = p1->mv - p0->mv;
+  return q8_from_int(p0->c) + ((int64_t)(mv - p0->mv) * dc * Q8_ONE) / dmv;
+}
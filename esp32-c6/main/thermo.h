@@ -0,0 +1,32 @@
+#ifndef DANKDRYER_THERMO
+#define DANKDRYER_THERMO
+
+#include <stdint.h>
+#include "fixedpoint.h"
+
+// transfer functions of the analog thermometers we've shipped, as tables
+// of (millivolts, C) points sorted by increasing voltage. conversion is a
+// binary search plus integer linear interpolation, yielding Q8 C.
+typedef struct thermo_point {
+  int16_t mv;
+  int16_t c;
+} thermo_point;
+
+typedef struct thermo_table {
+  const char* name;
+  const thermo_point* pts;
+  unsigned count;
+} thermo_table;
+
+extern const thermo_table LM35Table;  // PCB 2.0.0
+extern const thermo_table LMT87Table; // PCB 2.2.0 and later
+
+// select the table appropriate for this board
+const thermo_table* thermo_table_for_board(void);
+
+// convert a reading in mV to Q8 C. readings outside the table are
+// extrapolated from the nearest segment (it is the caller's duty to
+// reject implausible temperatures).
+q8_t thermo_mv_to_q8(const thermo_table* t, int32_t mv);
+
+#endif
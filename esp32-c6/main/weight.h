@@ -0,0 +1,29 @@
+#ifndef DANKDRYER_WEIGHT
+#define DANKDRYER_WEIGHT
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "fixedpoint.h"
+
+// the load cell reads in units of 10mg
+#define LOAD_CELL_UNITS_PER_G 100
+#define LOAD_CELL_MAX (5000 * LOAD_CELL_UNITS_PER_G) // 5kg capable
+
+static inline bool
+weight_valid_p(q8_t weight){
+  return weight >= 0 && weight <= q8_from_int(LOAD_CELL_MAX);
+}
+
+// scale a filtered load cell reading to Q8, less the tare (if valid). we use
+// a single-ended signal (not differential) and thus lose half of our range,
+// yielding 1 << 22.
+static inline q8_t
+weight_from_raw(int32_t raw, q8_t tare){
+  q8_t sv = q8_scale(raw, LOAD_CELL_MAX, 22);
+  if(weight_valid_p(tare)){
+    sv -= tare;
+  }
+  return sv;
+}
+
+#endif